@@ -0,0 +1,611 @@
+/**
+ * @file bench.c
+ * @brief Microbenchmarks of the core walkers. They run against an image
+ *        of the mixed shape built by tools/mkimage.sh and print the
+ *        results as JSON so that releases can be diffed.
+ */
+#define EXT2_NO_MAIN
+#include "ext2.c"
+
+/**
+ * Benchmark constraints
+ */
+
+#define BENCH_MIN_TIME_MS  (200u)
+#define BENCH_MAX_ITERS    (100000u)
+#define BENCH_MAX_COLD_ITERS (500u)
+#define BENCH_MAX_DEPTH    (64u)
+
+/* Benchmark mode - Caches kept across the iterations */
+#define BENCH_MODE_WARM    (1u << 0)
+/* Benchmark mode - Caches and device pages dropped before every iteration */
+#define BENCH_MODE_COLD    (1u << 1)
+
+/* Benchmark */
+struct bench {
+    /* Name of the benchmark */
+    char name[32];
+    /* Runs one iteration, returns the number of bytes processed */
+    _u64 (*run)(struct bench *b);
+    /* Argument of the benchmark */
+    _u64 arg;
+    /* Path argument of the benchmark */
+    _u8 path[4 * BENCH_MAX_DEPTH + 8];
+};
+
+/* Result of a benchmark in one mode */
+struct bench_res {
+    struct ext2_hist h;
+    _u64 total_ns;
+    _u64 bytes;
+};
+
+/* Inode numbers resolved once for the benchmarks */
+static _u64 _flat_ino;
+static _u32 _flat_nb_files;
+/* Random state of the benchmarks */
+static _u64 _rand_state = 0x9e3779b97f4a7c15ull;
+
+/**
+ * @brief Returns the next pseudo random number (xorshift)
+ */
+static inline _u64 _bench_rand() {
+
+    _rand_state ^= _rand_state << 13;
+    _rand_state ^= _rand_state >> 7;
+    _rand_state ^= _rand_state << 17;
+
+    return _rand_state;
+}
+
+/**
+ * @brief Resolves the path without modifying it
+ * @param[in] path Absolute path
+ * @return Inode number
+ */
+static _u64 _bench_path_to_ino(_u8 *path) {
+
+    _u8 buf[sizeof(((struct bench *)0)->path)];
+
+    strcpy(buf, path);
+
+    return ext2_path_to_ino(buf);
+}
+
+/**
+ * @brief Drops the caches of the tool and the device pages of the page
+ *        cache, so the next iteration reads from the device
+ */
+static void _bench_drop_caches() {
+
+    _ext2_bcache_reset();
+    memset(_walk.buf_blk, 0, sizeof(_walk.buf_blk));
+    posix_fadvise(_fd, 0, 0, POSIX_FADV_DONTNEED);
+}
+
+/**
+ * @brief Fetches a random inode
+ */
+static _u64 _bench_ino_to_ino_st(struct bench *b) {
+
+    struct ext2_inode ino_st;
+
+    _ext2_ino_to_ino_st(EXT2_ROOT_INO + _bench_rand()
+                        % (_sb.s_inodes_count - EXT2_ROOT_INO), &ino_st);
+
+    return 0;
+}
+
+/**
+ * @brief Searches the flat directory for the name of the argument
+ */
+static _u64 _bench_dir_search(struct bench *b) {
+
+    _u8 name[32];
+
+    /* Build the name, zero for a missing one */
+    if (b->arg) {
+        snprintf(name, sizeof(name), "file_%08lu", b->arg);
+    }
+    else {
+        strcpy(name, "missing");
+    }
+
+    _ext2_nxt_ino(_flat_ino, name);
+
+    return 0;
+}
+
+/**
+ * @brief Walk visitor counting the blocks
+ */
+static int _bench_count_visit(struct ext2_walk *w, void *ctx,
+                              _u64 lblk, _u32 pblk, _u8 level) {
+
+    (*(_u64 *)ctx)++;
+
+    return EXT2_WALK_CONT;
+}
+
+/**
+ * @brief Walks the block tree of the file of the path
+ */
+static _u64 _bench_walk(struct bench *b) {
+
+    struct ext2_inode ino_st;
+    _u64 nb_blks = 0;
+
+    _ext2_ino_to_ino_st(b->arg, &ino_st);
+    _ext2_walk(&_walk, &ino_st, 0, _bench_count_visit, &nb_blks);
+
+    return 0;
+}
+
+/**
+ * @brief Maps the last block of the file of the path
+ */
+static _u64 _bench_bmap(struct bench *b) {
+
+    struct ext2_inode ino_st;
+
+    _ext2_ino_to_ino_st(b->arg, &ino_st);
+    _ext2_bmap(&_walk, &ino_st,
+               (EXT2_I_SIZE(&ino_st) - 1) / EXT2_BLOCK_SIZE(&_sb));
+
+    return 0;
+}
+
+/**
+ * @brief Resolves the path
+ */
+static _u64 _bench_path(struct bench *b) {
+
+    _bench_path_to_ino(b->path);
+
+    return 0;
+}
+
+/**
+ * @brief Streams the data of the file of the path
+ */
+static _u64 _bench_data(struct bench *b) {
+
+    struct ext2_inode ino_st;
+
+    _ext2_ino_to_ino_st(b->arg, &ino_st);
+    _ext2_print_ino_data(b->arg);
+    ext2_out_flush();
+
+    return EXT2_I_SIZE(&ino_st);
+}
+
+/**
+ * @brief Runs the benchmark
+ * @param[in] b Benchmark
+ * @param[in] mode Benchmark mode (one of BENCH_MODE_*)
+ * @param[in] min_time_ns Minimum time to run the benchmark for
+ * @param[out] res Result
+ */
+static void _bench_run(struct bench *b, _u32 mode, _u64 min_time_ns,
+                       struct bench_res *res) {
+
+    _u32 max_iters;
+    _u64 t;
+    _u64 ns;
+    int out_fd;
+    int null_fd;
+
+    /* Cold iterations are bounded lower, the drops are not timed */
+    max_iters = (mode == BENCH_MODE_COLD) ? BENCH_MAX_COLD_ITERS
+                                          : BENCH_MAX_ITERS;
+    memset(res, 0, sizeof(*res));
+
+    /* Send the output of the benchmark to the null device */
+    fflush(stdout);
+    out_fd = dup(STDOUT_FILENO);
+    null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+
+    /* Warm the caches up */
+    b->run(b);
+
+    /* Run until the minimum time is spent */
+    while ((res->total_ns < min_time_ns) && (res->h.count < max_iters)) {
+        /* Drop the caches in the cold mode */
+        if (mode == BENCH_MODE_COLD) {
+            _bench_drop_caches();
+        }
+
+        t = _ext2_now_ns();
+        res->bytes += b->run(b);
+        ns = _ext2_now_ns() - t;
+
+        _hist_add(&res->h, ns);
+        res->total_ns += ns;
+    }
+
+    /* Restore the output */
+    ext2_out_flush();
+    dup2(out_fd, STDOUT_FILENO);
+    close(out_fd);
+    close(null_fd);
+}
+
+/**
+ * @brief Prints the result of one mode as a JSON object
+ * @param[in] res Result
+ */
+static void _bench_res_print(struct bench_res *res) {
+
+    printf("{\"iters\":%lu,\"mean_ns\":%lu,\"min_ns\":%lu,\"p50_ns\":%lu,"
+           "\"p99_ns\":%lu,\"max_ns\":%lu", res->h.count,
+           res->total_ns / res->h.count, res->h.min,
+           _hist_quantile(&res->h, 0.5), _hist_quantile(&res->h, 0.99),
+           res->h.max);
+    if (res->bytes) {
+        printf(",\"bytes_per_sec\":%lu",
+               (_u64)((double)res->bytes * 1e9 / res->total_ns));
+    }
+    printf("}");
+}
+
+/**
+ * @brief Prints the results of the benchmark, the modes side by side
+ * @param[in] b Benchmark
+ * @param[in] modes Modes run
+ * @param[in] warm Warm result
+ * @param[in] cold Cold result
+ * @param[in] first Whether it is the first result printed
+ */
+static void _bench_print(struct bench *b, _u32 modes, struct bench_res *warm,
+                         struct bench_res *cold, _u8 first) {
+
+    printf("%s    {\"name\":\"%s\"", first ? "" : ",\n", b->name);
+    if (modes & BENCH_MODE_WARM) {
+        printf(",\"warm\":");
+        _bench_res_print(warm);
+    }
+    if (modes & BENCH_MODE_COLD) {
+        printf(",\"cold\":");
+        _bench_res_print(cold);
+    }
+    if (modes == (BENCH_MODE_WARM | BENCH_MODE_COLD)) {
+        printf(",\"cold_over_warm\":%.2f",
+               ((double)cold->total_ns / cold->h.count) /
+               ((double)warm->total_ns / warm->h.count));
+    }
+    printf("}");
+}
+
+/**
+ * @brief Builds the benchmark list
+ * @param[out] benchs Benchmarks
+ * @return Number of benchmarks
+ */
+static _u32 _bench_list(struct bench *benchs) {
+
+    static const char *levels[4] = {"direct", "single", "double", "triple"};
+    struct bench *b = benchs;
+    _u8 path[sizeof(b->path)];
+    _u64 ino;
+    _u32 depth;
+    _u32 i;
+
+    /* Inode fetch */
+    strcpy(b->name, "ino_to_ino_st");
+    b->run = _bench_ino_to_ino_st;
+    b++;
+
+    /* Directory search hits at the start and the end, and a miss */
+    strcpy(b->name, "dir_search_hit_first");
+    b->run = _bench_dir_search;
+    b->arg = 1;
+    b++;
+    strcpy(b->name, "dir_search_hit_last");
+    b->run = _bench_dir_search;
+    b->arg = _flat_nb_files;
+    b++;
+    strcpy(b->name, "dir_search_miss");
+    b->run = _bench_dir_search;
+    b->arg = 0;
+    b++;
+
+    /* Block tree walk and block map at each indirection level */
+    for (i = 0; i < 4; i++) {
+        snprintf(path, sizeof(path), "/tind/%s", levels[i]);
+        ino = _bench_path_to_ino(path);
+
+        snprintf(b->name, sizeof(b->name), "walk_%s", levels[i]);
+        b->run = _bench_walk;
+        b->arg = ino;
+        b++;
+        snprintf(b->name, sizeof(b->name), "bmap_%s", levels[i]);
+        b->run = _bench_bmap;
+        b->arg = ino;
+        b++;
+    }
+
+    /* Path resolution at depths 1 to 64 */
+    for (depth = 1; depth <= BENCH_MAX_DEPTH; depth *= 2) {
+        strcpy(path, "/deep");
+        for (i = 1; i < depth; i++) {
+            sprintf(path + strlen(path), "/d%u", i);
+        }
+
+        snprintf(b->name, sizeof(b->name), "path_depth_%u", depth);
+        b->run = _bench_path;
+        strcpy(b->path, path);
+        b++;
+    }
+
+    /* Data streaming */
+    strcpy(b->name, "data_stream");
+    b->run = _bench_data;
+    b->arg = _bench_path_to_ino("/sparse/dense");
+    b++;
+
+    return b - benchs;
+}
+
+/**
+ * @brief Replays the requests of a trace recorded with --trace and prints
+ *        the cost of the replay as JSON
+ * @param[in] path Path of the trace file
+ * @param[in] modes Benchmark mode, cold drops the caches before a request
+ */
+static void _bench_replay(_u8 *path, _u32 modes) {
+
+    struct ext2_hist h = {0};
+    struct stat st;
+    _u8 *trace;
+    _u8 *pos;
+    _u8 *end;
+    _u8 *args[64];
+    _u64 nb_args;
+    _u64 len;
+    _u64 nb_reqs = 0;
+    _u64 nb_skipped = 0;
+    _u64 rec_reads = 0;
+    _u64 rec_bytes = 0;
+    _u64 bytes = 0;
+    _u64 total_ns = 0;
+    _u64 ino;
+    _u64 t;
+    _u64 i;
+    _u8 status;
+    _u8 req;
+    int out_fd;
+    int null_fd;
+    int fd;
+
+    /* Read the whole trace */
+    fd = open(path, O_RDONLY);
+    if ((fd == -1) || fstat(fd, &st) || (st.st_size < 5)) {
+        exit_err("Failed to read the trace\n");
+    }
+    trace = malloc(st.st_size);
+    if (!trace || (read(fd, trace, st.st_size) != st.st_size)) {
+        exit_err("Failed to read the trace\n");
+    }
+    close(fd);
+
+    /* Check the header */
+    if (memcmp(trace, TRACE_MAGIC, 4) || (trace[4] != TRACE_VERSION)) {
+        exit_err("Not a trace file\n");
+    }
+    pos = trace + 5;
+    end = trace + st.st_size;
+
+    /* Send the output of the requests to the null device */
+    fflush(stdout);
+    out_fd = dup(STDOUT_FILENO);
+    null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    memset(&_stats, 0, sizeof(_stats));
+
+    /* For every record */
+    while (pos < end) {
+
+        /* If it is a read count it */
+        if ((*pos & 0xF0) == TRACE_REC_READ) {
+            pos++;
+            _trace_get_var(&pos, end);
+            _trace_get_var(&pos, end);
+            rec_bytes += _trace_get_var(&pos, end);
+            rec_reads++;
+            continue;
+        }
+
+        /* Anything else must be a request */
+        if (*pos++ != TRACE_REC_REQ) {
+            exit_err("Corrupt trace\n");
+        }
+
+        /* Parse the request */
+        status = *pos++;
+        _trace_get_var(&pos, end);
+        nb_args = _trace_get_var(&pos, end);
+        for (i = 0; i < nb_args; i++) {
+            len = _trace_get_var(&pos, end);
+            if ((pos + len > end) || (i >= 64)) {
+                exit_err("Corrupt trace\n");
+            }
+            args[i] = strndup(pos, len);
+            pos += len;
+        }
+
+        /* Replay the successful requests */
+        if (status && (nb_args >= 2)) {
+            if (modes == BENCH_MODE_COLD) {
+                _bench_drop_caches();
+            }
+
+            t = _ext2_now_ns();
+            req = _get_req_type(args[1]);
+            ino = ext2_path_to_ino(args[0]);
+            if (req != REQUEST_TYPE_EXPLAIN) {
+                ext2_print_ino(ino, req, nb_args - 2, (char **)args + 2);
+            }
+            ext2_out_flush();
+            t = _ext2_now_ns() - t;
+
+            _hist_add(&h, t);
+            total_ns += t;
+            nb_reqs++;
+        }
+        else {
+            nb_skipped++;
+        }
+
+        for (i = 0; i < nb_args; i++) {
+            free(args[i]);
+        }
+    }
+
+    /* Restore the output */
+    ext2_out_flush();
+    dup2(out_fd, STDOUT_FILENO);
+    close(out_fd);
+    close(null_fd);
+    free(trace);
+
+    /* Print the result */
+    for (i = 0; i < EXT2_CAT_MAX; i++) {
+        bytes += _stats.bytes[i];
+    }
+    printf("{\"trace\":\"%s\",\"mode\":\"%s\",\"cache_blocks\":%u,"
+           "\"direct\":%s,\"requests\":%lu,\"skipped\":%lu,"
+           "\"recorded\":{\"reads\":%lu,\"bytes\":%lu},"
+           "\"replayed\":{\"reads\":%lu,\"bytes\":%lu,\"cache_hits\":%lu,"
+           "\"cache_misses\":%lu}", path,
+           (modes == BENCH_MODE_COLD) ? "cold" : "warm", _bcache_nb_blks,
+           _io_direct ? "true" : "false", nb_reqs, nb_skipped, rec_reads,
+           rec_bytes, _stats.syscalls, bytes, _stats.cache_hits,
+           _stats.cache_misses);
+    if (nb_reqs) {
+        printf(",\"total_ns\":%lu,\"mean_ns\":%lu,\"p50_ns\":%lu,"
+               "\"p99_ns\":%lu,\"max_ns\":%lu", total_ns, total_ns / nb_reqs,
+               _hist_quantile(&h, 0.5), _hist_quantile(&h, 0.99), h.max);
+    }
+    printf("}\n");
+}
+
+/**
+ * @brief Main routine
+ */
+int main(int argc, char *argv[]) {
+
+    static const struct option opts[] = {
+        {"device", required_argument, NULL, 'd'},
+        {"filter", required_argument, NULL, 'f'},
+        {"min-time", required_argument, NULL, 't'},
+        {"mode", required_argument, NULL, 'm'},
+        {"direct", no_argument, NULL, 'D'},
+        {"replay", required_argument, NULL, 'r'},
+        {"cache-blocks", required_argument, NULL, 'b'},
+        {NULL, 0, NULL, 0}
+    };
+    struct bench benchs[64] = {0};
+    struct ext2_dir dir;
+    struct ext2_dirent ent;
+    struct bench_res warm;
+    struct bench_res cold;
+    _u8 *dev_path = DEVICE_FILE_PATH;
+    _u8 *filter = NULL;
+    _u8 *replay = NULL;
+    _u64 min_time_ns = BENCH_MIN_TIME_MS * 1000000ull;
+    _u32 modes = BENCH_MODE_WARM | BENCH_MODE_COLD;
+    _u32 nb_benchs;
+    _u32 i;
+    _u8 first = 1;
+    int opt;
+
+    /* Parse the options */
+    while ((opt = getopt_long(argc, argv, "", opts, NULL)) != -1) {
+        if (opt == 'd') {
+            dev_path = optarg;
+        }
+        else if (opt == 'f') {
+            filter = optarg;
+        }
+        else if (opt == 't') {
+            min_time_ns = strtoull(optarg, NULL, 10) * 1000000ull;
+        }
+        else if ((opt == 'm') && !strcmp(optarg, "warm")) {
+            modes = BENCH_MODE_WARM;
+        }
+        else if ((opt == 'm') && !strcmp(optarg, "cold")) {
+            modes = BENCH_MODE_COLD;
+        }
+        else if ((opt == 'm') && !strcmp(optarg, "both")) {
+            modes = BENCH_MODE_WARM | BENCH_MODE_COLD;
+        }
+        else if (opt == 'D') {
+            _io_direct = 1;
+        }
+        else if (opt == 'r') {
+            replay = optarg;
+        }
+        else if ((opt == 'b') && (_bcache_nb_blks = atoi(optarg)) > 0) {
+            continue;
+        }
+        else {
+            exit_err("usage: %s [--device image] [--filter name] "
+                     "[--min-time ms] [--mode warm|cold|both] [--direct] "
+                     "[--replay trace] [--cache-blocks n]\n", argv[0]);
+        }
+    }
+
+    /* Init the global vars */
+    ext2_init(dev_path);
+
+    /* If a trace is to be replayed */
+    if (replay) {
+        _bench_replay(replay, (modes == BENCH_MODE_COLD) ? BENCH_MODE_COLD
+                                                         : BENCH_MODE_WARM);
+        ext2_deinit();
+        exit(EXIT_SUCCESS);
+    }
+
+    /* Get the flat directory and count its files besides . and .. */
+    _flat_ino = _bench_path_to_ino("/flat");
+    ext2_opendir(_flat_ino, &dir);
+    while (ext2_readdir(&dir, &ent)) {
+        _flat_nb_files++;
+    }
+    ext2_closedir(&dir);
+    _flat_nb_files -= 2;
+
+    /* Build the benchmarks */
+    nb_benchs = _bench_list(benchs);
+
+    /* Print the header */
+    printf("{\"device\":\"%s\",\"block_size\":%u,\"direct\":%s,"
+           "\"results\":[\n", dev_path, EXT2_BLOCK_SIZE(&_sb),
+           _io_direct ? "true" : "false");
+
+    /* Run the benchmarks */
+    for (i = 0; i < nb_benchs; i++) {
+        /* Skip the benchmarks filtered out */
+        if (filter && !strstr(benchs[i].name, filter)) {
+            continue;
+        }
+
+        /* Run the requested modes and print them side by side */
+        if (modes & BENCH_MODE_WARM) {
+            _bench_run(&benchs[i], BENCH_MODE_WARM, min_time_ns, &warm);
+        }
+        if (modes & BENCH_MODE_COLD) {
+            _bench_run(&benchs[i], BENCH_MODE_COLD, min_time_ns, &cold);
+        }
+        _bench_print(&benchs[i], modes, &warm, &cold, first);
+        first = 0;
+    }
+
+    printf("\n]}\n");
+
+    /* Deinitialize the global vars */
+    ext2_deinit();
+
+    exit(EXIT_SUCCESS);
+}
@@ -5,6 +5,7 @@
  *        an ext2 formatted file system. The contents of only file and directory
  *        can be displayed.
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -16,6 +17,17 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <time.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <fnmatch.h>
+#include <regex.h>
+#include <sys/sysmacros.h>
+#include <sys/sendfile.h>
 
 /**
  * Program constraints
@@ -23,6 +35,15 @@
 
 #define DEVICE_FILE_PATH "/dev/sdb1"
 #define MAX_PATH_TOKS    (256)
+#define ITAB_BATCH_SIZE  (64u * 1024u)
+#define BCACHE_NB_BLKS   (256u)
+#define DIRECT_IO_ALIGN  (4096u)
+#define QUERY_CHUNK_ROWS (64u * 1024u)
+#define MAX_PATH_LEN     (4096u)
+#define MAX_THREADS      (64u)
+#define GREP_WIN_SIZE    (1024u * 1024u)
+#define COPY_BUF_SIZE    (1024u * 1024u)
+#define SEND_MIN_SIZE    (64u * 1024u)
 
 /**
  * Utility
@@ -35,6 +56,9 @@ typedef uint32_t _u32;
 typedef uint16_t _u16;
 typedef uint8_t  _u8;
 
+/* Adds to a counter shared by the worker threads */
+#define ATOMIC_ADD(var, val)  __atomic_fetch_add(&(var), (val), __ATOMIC_RELAXED)
+
 /* Error print and return macro */
 #define exit_err(...)                           \
     {                                           \
@@ -42,12 +66,67 @@ typedef uint8_t  _u8;
         exit(EXIT_FAILURE);                     \
     }
 
+/**
+ * Static tracepoints
+ *
+ * USDT probes of the provider ext2, compiled to a nop and a note section
+ * entry when <sys/sdt.h> (systemtap-sdt-dev) is available, to nothing
+ * otherwise or with -DEXT2_NO_USDT
+ */
+
+#if defined(__has_include) && !defined(EXT2_NO_USDT)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define EXT2_USDT
+#endif
+#endif
+
+#ifdef EXT2_USDT
+#define EXT2_PROBE2(name, a, b)          DTRACE_PROBE2(ext2, name, a, b)
+#define EXT2_PROBE3(name, a, b, c)       DTRACE_PROBE3(ext2, name, a, b, c)
+#define EXT2_PROBE4(name, a, b, c, d)    DTRACE_PROBE4(ext2, name, a, b, c, d)
+#else
+#define EXT2_PROBE2(name, a, b)
+#define EXT2_PROBE3(name, a, b, c)
+#define EXT2_PROBE4(name, a, b, c, d)
+#endif
+
 /* Request type - Inode */
 #define REQUEST_TYPE_INODE    (0)
 /* Request type - Data */
 #define REQUEST_TYPE_DATA     (1)
-/* Request type - Data */
-#define REQUEST_TYPE_INVALID  (2)
+/* Request type - List */
+#define REQUEST_TYPE_LIST     (2)
+/* Request type - Explain */
+#define REQUEST_TYPE_EXPLAIN  (3)
+/* Request type - Scan */
+#define REQUEST_TYPE_SCAN     (4)
+/* Request type - Filter */
+#define REQUEST_TYPE_FILTER   (5)
+/* Request type - Query */
+#define REQUEST_TYPE_QUERY    (6)
+/* Request type - Reverse path index */
+#define REQUEST_TYPE_RINDEX   (7)
+/* Request type - Paths of inode numbers */
+#define REQUEST_TYPE_IPATH    (8)
+/* Request type - Reverse block map */
+#define REQUEST_TYPE_RBMAP    (9)
+/* Request type - Owners of block numbers */
+#define REQUEST_TYPE_OWNER    (10)
+/* Request type - Layout */
+#define REQUEST_TYPE_LAYOUT   (11)
+/* Request type - Disk usage */
+#define REQUEST_TYPE_DU       (12)
+/* Request type - Find */
+#define REQUEST_TYPE_FIND     (13)
+/* Request type - Grep */
+#define REQUEST_TYPE_GREP     (14)
+/* Request type - Extract */
+#define REQUEST_TYPE_EXTRACT  (15)
+/* Request type - Tar */
+#define REQUEST_TYPE_TAR      (16)
+/* Request type - Invalid */
+#define REQUEST_TYPE_INVALID  (17)
 
 /**
  * @brief Returns the request type given the request string
@@ -64,6 +143,66 @@ static inline _u8 _get_req_type(_u8 *arg) {
     else if (!strcmp(arg, "data")) {
         return REQUEST_TYPE_DATA;
     }
+    /* If the argument is list */
+    else if (!strcmp(arg, "list")) {
+        return REQUEST_TYPE_LIST;
+    }
+    /* If the argument is explain */
+    else if (!strcmp(arg, "explain")) {
+        return REQUEST_TYPE_EXPLAIN;
+    }
+    /* If the argument is scan */
+    else if (!strcmp(arg, "scan")) {
+        return REQUEST_TYPE_SCAN;
+    }
+    /* If the argument is filter */
+    else if (!strcmp(arg, "filter")) {
+        return REQUEST_TYPE_FILTER;
+    }
+    /* If the argument is query */
+    else if (!strcmp(arg, "query")) {
+        return REQUEST_TYPE_QUERY;
+    }
+    /* If the argument is rindex */
+    else if (!strcmp(arg, "rindex")) {
+        return REQUEST_TYPE_RINDEX;
+    }
+    /* If the argument is ipath */
+    else if (!strcmp(arg, "ipath")) {
+        return REQUEST_TYPE_IPATH;
+    }
+    /* If the argument is rbmap */
+    else if (!strcmp(arg, "rbmap")) {
+        return REQUEST_TYPE_RBMAP;
+    }
+    /* If the argument is owner */
+    else if (!strcmp(arg, "owner")) {
+        return REQUEST_TYPE_OWNER;
+    }
+    /* If the argument is layout */
+    else if (!strcmp(arg, "layout")) {
+        return REQUEST_TYPE_LAYOUT;
+    }
+    /* If the argument is du */
+    else if (!strcmp(arg, "du")) {
+        return REQUEST_TYPE_DU;
+    }
+    /* If the argument is find */
+    else if (!strcmp(arg, "find")) {
+        return REQUEST_TYPE_FIND;
+    }
+    /* If the argument is grep */
+    else if (!strcmp(arg, "grep")) {
+        return REQUEST_TYPE_GREP;
+    }
+    /* If the argument is extract */
+    else if (!strcmp(arg, "extract")) {
+        return REQUEST_TYPE_EXTRACT;
+    }
+    /* If the argument is tar */
+    else if (!strcmp(arg, "tar")) {
+        return REQUEST_TYPE_TAR;
+    }
     /* If the argument is anything else */
     else {
         return REQUEST_TYPE_INVALID;
@@ -118,517 +257,8170 @@ char *_ft_to_str[EXT2_FT_MAX] = {"Unknown  ", "Regular  ", "Directory",
 
 /* File descriptor for the device file */
 static _u32 _fd;
+/* Path of the device file */
+static _u8 *_dev_path;
 /* Super block for the device */
 static struct ext2_super_block _sb;
+/* Group descriptor table of the device */
+static _u8 *_gdt;
+/* Number of block groups */
+static _u32 _nb_grps;
 
 /**
- * @brief Locates and reads the requested amount of data
- * @param[in] offset Offset number of bytes from the start of the device
- * @param[in] buff Starting address of the buffer
- * @param[in] size Number of bytes to be read from the #offset
+ * Output writer
  */
-static inline void _ext2_read(_u64 offset, void *buff, _u64 size) {
 
-    /* Locate the offset number of bytes */
-    lseek64(_fd, offset, SEEK_SET);
+/* Size of the output buffer */
+#define OUT_BUF_SIZE       (1u << 20)
 
-    /* Read the bytes into the buffer */
-    read(_fd, buff, size);
-}
+/* Output format - Text */
+#define OUT_FMT_TEXT       (0)
+/* Output format - One JSON object per line */
+#define OUT_FMT_NDJSON     (1)
+/* Output format - Tab separated values with a header line */
+#define OUT_FMT_TSV        (2)
+
+/* File type to name map of the structured formats */
+static const char *_ft_to_name[EXT2_FT_MAX] = {"unknown", "regular",
+                                               "directory", "character",
+                                               "block", "fifo", "socket",
+                                               "symlink"};
+
+/* Mode type bits of the entry file types */
+static const _u16 _ft_to_mode[EXT2_FT_MAX] = {0, 0x8000, 0x4000, 0x2000,
+                                              0x6000, 0x1000, 0xC000, 0xA000};
+
+/* Buffered output */
+struct ext2_out {
+    /* Buffer */
+    _u8 buf[OUT_BUF_SIZE];
+    /* Number of bytes buffered */
+    _u64 len;
+    /* Output format */
+    _u8 fmt;
+    /* Number of fields of the current record */
+    _u32 nb_fields;
+};
+
+/* Output of the program */
+static struct ext2_out _out;
 
 /**
- * @brief Sets the offset of the device file to the given value
- * @param[in] offset Offset (unsigned)
- * @note The offset is set with respect to the base offset
+ * @brief Returns the output format given the format string
+ * @param[in] arg String argument
+ * @return Output format (one of OUT_FMT_*)
  */
-static inline void _ext2_seek_set(_u64 offset) {
+static _u8 _get_out_fmt(const char *arg) {
 
-    /* Shift the head to the offset */
-    lseek64(_fd, offset, SEEK_SET);
+    /* If the format is text */
+    if (!strcmp(arg, "text")) {
+        return OUT_FMT_TEXT;
+    }
+    /* If the format is NDJSON */
+    else if (!strcmp(arg, "ndjson") || !strcmp(arg, "json")) {
+        return OUT_FMT_NDJSON;
+    }
+    /* If the format is TSV */
+    else if (!strcmp(arg, "tsv")) {
+        return OUT_FMT_TSV;
+    }
+
+    /* Exit with failure */
+    exit_err("Invalid output format\n");
 }
 
 /**
- * @brief Sets the offset of the device file to the given value
- * @param[in] offset Offset (signed)
- * @note The offset is set with respect to the current offset
+ * @brief Writes the buffered output to the standard output
  */
-static inline void _ext2_seek_cur(_s64 offset) {
+void ext2_out_flush() {
 
-    /* Shift the head to the offset */
-    lseek64(_fd, offset, SEEK_CUR);
+    _u64 off = 0;
+    ssize_t ret;
+
+    /* Write until the whole buffer is out */
+    while (off < _out.len) {
+        ret = write(STDOUT_FILENO, _out.buf + off, _out.len - off);
+
+        /* Retry if interrupted */
+        if ((ret == -1) && (errno == EINTR)) {
+            continue;
+        }
+
+        /* Check for failure */
+        if (ret <= 0) {
+            /* Drop the output so the exit handler does not retry */
+            _out.len = 0;
+            exit_err("Failed to write the output\n");
+        }
+
+        off += ret;
+    }
+    _out.len = 0;
 }
 
 /**
- * @brief Initialize globals
+ * @brief Makes room for bytes in the output buffer
+ * @param[in] len Number of bytes, at most OUT_BUF_SIZE
+ * @return Pointer to the free space
  */
-void ext2_init() {
+static inline _u8 *_out_reserve(_u64 len) {
 
-    /* Open the device file */
-    _fd = open(DEVICE_FILE_PATH, O_RDONLY);
-
-    /* Check for failure */
-    if (_fd == -1) {
-        /* Exit with failure */
-        exit_err("Failed to open the device file\n");
+    /* Flush if the bytes do not fit */
+    if (_out.len + len > OUT_BUF_SIZE) {
+        ext2_out_flush();
     }
 
-    /* Read the superblock */
-    _ext2_read(EXT2_SUPER_BLOCK_OFFSET, &_sb, EXT2_SUPER_BLOCK_SIZE);
+    return _out.buf + _out.len;
 }
 
 /**
- * @brief Denitialize globals
+ * @brief Outputs the bytes
+ * @param[in] data Bytes, NULL for zeros
+ * @param[in] len Number of bytes
  */
-void ext2_deinit() {
+static void _out_bytes(const void *data, _u64 len) {
 
-    /* Close the device file */
-    close(_fd);
+    _u64 chunk;
+
+    /* Copy the bytes a buffer at a time */
+    while (len) {
+        chunk = OUT_BUF_SIZE - _out.len;
+        if (!chunk) {
+            ext2_out_flush();
+            chunk = OUT_BUF_SIZE;
+        }
+        if (chunk > len) {
+            chunk = len;
+        }
+
+        /* Copy the bytes or zeros */
+        if (data) {
+            memcpy(_out.buf + _out.len, data, chunk);
+            data = (const _u8 *)data + chunk;
+        }
+        else {
+            memset(_out.buf + _out.len, 0, chunk);
+        }
+        _out.len += chunk;
+        len -= chunk;
+    }
 }
 
 /**
- * @brief Obtains the inode structure given the inode number
- * @param[in] ino Inode number
- * @param[out] p_ino_st Pointer to the inode structure
+ * @brief Outputs the character
+ * @param[in] c Character
  */
-static void _ext2_ino_to_ino_st(_u64 ino, struct ext2_inode *p_ino_st) {
+static inline void _out_chr(_u8 c) {
 
-    _u64 grp_nb;
-    _u64 grp_desc_off;
-    struct ext2_group_desc grp_desc;
-    _u64 ino_tab_off;
-    _u64 ino_idx;
-    _u64 ino_off;
+    *_out_reserve(1) = c;
+    _out.len++;
+}
 
-    /* Get the group number of the inode */
-    grp_nb = (ino - 1) / EXT2_INODES_PER_GROUP(&_sb);
-    /* Locate the group descriptor for the same */
-    grp_desc_off = EXT2_BLOCK_SIZE(&_sb) + grp_nb * EXT2_DESC_SIZE(&_sb);
-    /* Read the group descriptor */
-    _ext2_read(grp_desc_off, &grp_desc, EXT2_DESC_SIZE(&_sb));
+/**
+ * @brief Outputs the string
+ * @param[in] str String
+ */
+static inline void _out_str(const char *str) {
 
-    /* Get the inode table offset */
-    ino_tab_off = (_u64)grp_desc.bg_inode_table * EXT2_BLOCK_SIZE(&_sb);
-    /* Get the inode index in the table */
-    ino_idx = (ino - 1) % EXT2_INODES_PER_GROUP(&_sb);
-    /* Get the inode offset */
-    ino_off = ino_tab_off + ino_idx * EXT2_INODE_SIZE(&_sb);
-    /* Read the inode */
-    _ext2_read(ino_off, p_ino_st, sizeof(struct ext2_inode));
+    _out_bytes(str, strlen(str));
 }
 
 /**
- * @brief Searches the given directory data block directly
- *        for the argument string
- * @param[in] blk_addr Directory data block number
- * @param[in] nxt_arg Argument string to be searched
- * @return Inode number of the argument string
+ * @brief Outputs the number in the base
+ * @param[in] val Number
+ * @param[in] base Base, 8, 10 or 16
  */
-static _u64 _ext2_dir_search(_u32 blk_addr, _u8 *nxt_arg) {
+static void _out_num(_u64 val, _u32 base) {
 
-    struct ext2_dir_entry_2 dir_ent;
-    _u64 blk_off;
-    _u32 i = 0;
+    static const char digits[] = "0123456789abcdef";
+    _u8 tmp[24];
+    _u8 *p = tmp + sizeof(tmp);
 
-    /* Get the directory data block offset */
-    blk_off = (_u64)blk_addr * EXT2_BLOCK_SIZE(&_sb);
+    /* Convert the digits from the least significant */
+    do {
+        *--p = digits[val % base];
+        val /= base;
+    } while (val);
 
-    /* While the entire block is traversed */
-    while (i < EXT2_BLOCK_SIZE(&_sb)) {
-        /* Read the directory entry */
-        _ext2_read(blk_off + i, &dir_ent, EXT2_DIR_ENTRY_SIZE);
+    /* Output the digits */
+    _out_bytes(p, tmp + sizeof(tmp) - p);
+}
 
-        /* Compare the next argument string */
-        if (!memcmp(nxt_arg, dir_ent.name, dir_ent.name_len)) {
-            /* Return the inode number */
-            return dir_ent.inode;
-        }
+/**
+ * @brief Outputs the formatted string, for the lines off the hot paths
+ * @param[in] fmt Format string
+ */
+static void _out_printf(const char *fmt, ...) {
 
-        /* Update the total bytes read */
-        i += dir_ent.rec_len;
+    va_list ap;
+    int len;
+
+    /* Format in the free space, flush and retry if it did not fit */
+    va_start(ap, fmt);
+    len = vsnprintf(_out.buf + _out.len, OUT_BUF_SIZE - _out.len, fmt, ap);
+    va_end(ap);
+    if ((len > 0) && (_out.len + len >= OUT_BUF_SIZE)) {
+        ext2_out_flush();
+        va_start(ap, fmt);
+        len = vsnprintf(_out.buf, OUT_BUF_SIZE, fmt, ap);
+        va_end(ap);
     }
 
-    /* Return bad inode number */
-    return EXT2_BAD_INO;
+    /* Keep the formatted bytes */
+    if (len > 0) {
+        _out.len += (len < OUT_BUF_SIZE) ? len : OUT_BUF_SIZE - 1;
+    }
 }
 
+/* Unsigned decimal, hexadecimal and octal numbers */
+#define _out_u64(val)  _out_num((val), 10)
+#define _out_hex(val)  _out_num((val), 16)
+#define _out_oct(val)  _out_num((val), 8)
+
 /**
- * @brief Searches the given directory data block indirectly
- *        for the argument string
- * @param[in] blk_addr Directory data block number
- * @param[in] nxt_arg Argument string to be searched
- * @param[in] indir_level Indirection level of the current block
- * @return Inode number of the argument string
+ * @brief Outputs the string escaped for the format
+ * @param[in] str String
+ * @param[in] len Length of the string
+ * @note JSON strings get quoted, TSV fields get the tab, newline and
+ *       backslash escaped
  */
-static _u64 _ext2_indir_search(_u32 blk_addr, _u8 *nxt_arg, _u8 indir_level) {
+static void _out_esc(const _u8 *str, _u64 len) {
 
-    _u64 blk_off;
-    _u32 nxt_blk_addr;
-    _u64 nxt_ino;
-    _u32 i = 0;
+    static const char hex[] = "0123456789abcdef";
+    _u8 json = (_out.fmt == OUT_FMT_NDJSON);
+    _u64 start = 0;
+    _u64 i;
+    _u8 c;
 
-    /* Get the block offset */
-    blk_off = (_u64)blk_addr * EXT2_BLOCK_SIZE(&_sb);
+    /* Quote the JSON strings */
+    if (json) {
+        _out_chr('"');
+    }
 
-    /* For every 4 bytes of the block */
-    while (i < EXT2_ADDR_PER_BLOCK(&_sb)) {
+    /* For every character needing an escape */
+    for (i = 0; i < len; i++) {
+        c = str[i];
+        if ((c != '\\') && (c != '\t') && (c != '\n') &&
+            (!json || ((c != '"') && (c >= 0x20)))) {
+            continue;
+        }
 
-        /* Read the 4 byte block number */
-        _ext2_read(blk_off + 4 * i, &nxt_blk_addr, 4);
+        /* Output the run of characters preceding it */
+        _out_bytes(str + start, i - start);
+        start = i + 1;
 
-        /* If the block number is zero */
-        if (!nxt_blk_addr) {
-            /* Return not found */
-            return EXT2_BAD_INO;
+        /* Output the escape */
+        _out_chr('\\');
+        if (c == '\t') {
+            _out_chr('t');
         }
-
-        /* If the current block is single indirect one */
-        if (indir_level == 1) {
-            /* Get the next inode number */
-            nxt_ino = _ext2_dir_search(nxt_blk_addr, nxt_arg);
+        else if (c == '\n') {
+            _out_chr('n');
+        }
+        else if ((c == '\\') || (c == '"')) {
+            _out_chr(c);
         }
-        /* If the current block is single indirect one */
         else {
-            /* Get the next inode number */
-            nxt_ino = _ext2_indir_search(nxt_blk_addr, nxt_arg, indir_level - 1);
+            _out_bytes("u00", 3);
+            _out_chr(hex[c >> 4]);
+            _out_chr(hex[c & 0xF]);
         }
+    }
 
-        /* If inode number is valid */
-        if (nxt_ino > EXT2_BAD_INO) {
-            /* Then return the inode number */
-            return nxt_ino;
-        }
+    /* Output the remaining characters */
+    _out_bytes(str + start, len - start);
 
-        /* Update the pointer */
-        i++;
+    /* Quote the JSON strings */
+    if (json) {
+        _out_chr('"');
     }
+}
 
-    /* Return bad inode number */
-    return EXT2_BAD_INO;
+/**
+ * @brief Outputs the header line of the TSV format
+ * @param[in] cols Tab separated column names
+ */
+static inline void _out_header(const char *cols) {
+
+    /* Only the TSV format has a header */
+    if (_out.fmt == OUT_FMT_TSV) {
+        _out_str(cols);
+        _out_chr('\n');
+    }
 }
 
 /**
- * @brief Returns the inode number of the file which is child of the file
- *        pointed by given inode number
- * @param[in] ino Parent inode number
- * @param[in] nxt_arg Path name argument of the child file
- * @return Inode number of the child file
+ * @brief Starts a record of the structured formats
  */
-static _u64 _ext2_nxt_ino(_u64 ino, _u8 *nxt_arg) {
+static inline void _out_rec_begin() {
 
-    struct ext2_inode ino_st;
-    _u64 nxt_ino;
-    _u32 blk_addr;
-    _u32 i = 0;
+    _out.nb_fields = 0;
+    if (_out.fmt == OUT_FMT_NDJSON) {
+        _out_chr('{');
+    }
+}
 
-    /* Get the inode from the inode number */
-    _ext2_ino_to_ino_st(ino, &ino_st);
+/**
+ * @brief Starts a field of the record
+ * @param[in] key Name of the field
+ */
+static inline void _out_key(const char *key) {
 
-    /* Check if the inode is of type directory */
-    if (!EXT2_IS_INODE_DIR(&ino_st)) {
-        /* Exit with failure */
-        exit_err("The path consists of non-directory files\n");
+    /* Separate the fields */
+    if (_out.nb_fields++) {
+        _out_chr((_out.fmt == OUT_FMT_NDJSON) ? ',' : '\t');
     }
 
-    /* While the block addresses are non zero */
-    while ((i < EXT2_N_BLOCKS) && (blk_addr = ino_st.i_block[i])) {
-        /* If the current block is a direct block */
-        if (i < EXT2_NDIR_BLOCKS) {
+    /* Name the JSON fields */
+    if (_out.fmt == OUT_FMT_NDJSON) {
+        _out_chr('"');
+        _out_str(key);
+        _out_bytes("\":", 2);
+    }
+}
 
-            nxt_ino = _ext2_dir_search(blk_addr, nxt_arg);
-        }
-        /* If the current block is single indirect block */
-        else if (i == EXT2_IND_BLOCK) {
+/**
+ * @brief Outputs a number field
+ * @param[in] key Name of the field
+ * @param[in] val Number
+ */
+static inline void _out_field_u64(const char *key, _u64 val) {
 
-            nxt_ino = _ext2_indir_search(blk_addr, nxt_arg, 1);
-        }
-        /* If the current block is double indirect block */
-        else if (i == EXT2_DIND_BLOCK) {
+    _out_key(key);
+    _out_u64(val);
+}
 
-            nxt_ino = _ext2_indir_search(blk_addr, nxt_arg, 2);
-        }
-        /* If the current block is triple indirect block */
-        else if (i == EXT2_TIND_BLOCK) {
+/**
+ * @brief Outputs a string field
+ * @param[in] key Name of the field
+ * @param[in] str String
+ * @param[in] len Length of the string
+ */
+static inline void _out_field_str(const char *key, const _u8 *str,
+                                  _u64 len) {
 
-            nxt_ino = _ext2_indir_search(blk_addr, nxt_arg, 3);
-        }
+    _out_key(key);
+    _out_esc(str, len);
+}
 
-        /* If the inode number is valid */
-        if (nxt_ino > EXT2_BAD_INO) {
-            /* Return the inode number */
-            return nxt_ino;
-        }
+/**
+ * @brief Ends the record
+ */
+static inline void _out_rec_end() {
 
-        /* Update the block number */
-        i++;
+    if (_out.fmt == OUT_FMT_NDJSON) {
+        _out_chr('}');
     }
-
-    /* Return bad inode number */
-    return EXT2_BAD_INO;
+    _out_chr('\n');
 }
 
 /**
- * @brief Returns the inode number of a file given its absolute path
- * @param[in] path Absolute path of the file
- * @return Inode number
+ * I/O statistics
  */
-_u64 ext2_path_to_ino(_u8 *path) {
-
-    _u8 *toks[MAX_PATH_TOKS];
-    _u32 nb_toks;
-    _u32 i;
-    _u64 ino;
 
-    /* Tokenize the path to get seperate file names */
-    nb_toks = _get_toks(path, "/", toks);
+/* Read category - Superblock */
+#define EXT2_CAT_SUPER   (0)
+/* Read category - Group descriptor table */
+#define EXT2_CAT_GDT     (1)
+/* Read category - Inode table */
+#define EXT2_CAT_ITAB    (2)
+/* Read category - Directory data block */
+#define EXT2_CAT_DIR     (3)
+/* Read category - Indirect block */
+#define EXT2_CAT_IND     (4)
+/* Read category - Regular file data block */
+#define EXT2_CAT_DATA    (5)
+/* Read category - Inode bitmap */
+#define EXT2_CAT_BMAP    (6)
+/* Number of read categories */
+#define EXT2_CAT_MAX     (7)
 
-    /* Initialize the inode number to that of root */
-    ino = EXT2_ROOT_INO;
+/* Phase - Initialization */
+#define EXT2_PHASE_INIT  (0)
+/* Phase - Path resolution */
+#define EXT2_PHASE_PATH  (1)
+/* Phase - Output of the request */
+#define EXT2_PHASE_OUT   (2)
+/* Number of phases */
+#define EXT2_PHASE_MAX   (3)
 
-    /* For each token */
-    for (i = 0; i < nb_toks; i++) {
-        /* Get the next inode number */
-        ino = _ext2_nxt_ino(ino, toks[i]);
+/* Read category to string map */
+static const char *_cat_to_str[EXT2_CAT_MAX] = {"super", "gdt", "itab",
+                                                "dir", "ind", "data",
+                                                "bmap"};
 
-        /* Check if inode number is valid */
-        if (ino < EXT2_ROOT_INO) {
-            /* Exit with failure */
-            exit_err("File search failed\n");
-        }
-    }
+/* Phase to string map */
+static const char *_phase_to_str[EXT2_PHASE_MAX] = {"init", "path", "output"};
 
-    /* Free the tokens */
-    for (i = 0; i < nb_toks; i++) {
-        free(toks[i]);
-    }
+/* I/O and cache counters */
+struct ext2_stats {
+    _u64 syscalls;
+    _u64 reads[EXT2_CAT_MAX];
+    _u64 blks[EXT2_CAT_MAX];
+    _u64 bytes[EXT2_CAT_MAX];
+    _u64 cache_hits;
+    _u64 cache_misses;
+    _u64 phase_ns[EXT2_PHASE_MAX];
+};
 
-    /* Return the inode number of the file */
-    return ino;
-}
+/* Counters of the run */
+static struct ext2_stats _stats;
 
 /**
- * @brief Prints the inode structure contents given
- *        the inode number
- * @param[in] ino Inode number
+ * @brief Returns the monotonic time in nanoseconds
  */
-void _ext2_print_ino_st(_u64 ino) {
+static inline _u64 _ext2_now_ns() {
 
-    _u32 i = 0;
-    struct ext2_inode ino_st;
+    struct timespec ts;
 
-    /* Get the inode structure from the inode number */
-    _ext2_ino_to_ino_st(ino, &ino_st);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
 
-    /* Print the important inode structure fields */
-    printf("Inode: %u ", ino);
-    printf("Type: 0x%x ", ino_st.i_mode & 0xF000);
-    printf("Mode: 0%o ", ino_st.i_mode & 0x0FFF);
-    printf("Flags: 0x%x\n", ino_st.i_flags);
-    printf("Generation: %u\n", ino_st.i_generation);
-    printf("User: %u ", ino_st.i_uid);
-    printf("Group: %u ", ino_st.i_gid);
-    printf("Size: %u\n", ino_st.i_size);
-    printf("File ACL: %u\n", ino_st.i_file_acl);
-    printf("Links: %u ", ino_st.i_links_count);
-    printf("Blockcount: %u\n", ino_st.i_blocks);
-    printf("ctime: 0x%x\n", ino_st.i_ctime);
-    printf("atime: 0x%x\n", ino_st.i_atime);
-    printf("mtime: 0x%x\n", ino_st.i_mtime);
+    return (_u64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
 
-    /* Print the block addresses */
-    printf("BLOCKS:\n");
+/**
+ * @brief Prints the counters on stderr
+ * @param[in] json Print as a JSON object if non zero
+ */
+static void _ext2_stats_print(_u8 json) {
 
-    while ((i < EXT2_N_BLOCKS) && (ino_st.i_block[i])) {
+    _u64 bytes = 0;
+    _u32 i;
 
-        if (i < EXT2_NDIR_BLOCKS) {
-            printf("Direct data block (%u): %u\n", i, ino_st.i_block[i]);
-        }
-        else if (i == EXT2_IND_BLOCK) {
-            printf("Single indirect data block: %u\n", ino_st.i_block[i]);
-        }
-        else if (i == EXT2_DIND_BLOCK) {
-            printf("Double indirect data block: %u\n", ino_st.i_block[i]);
+    /* Get the total bytes read */
+    for (i = 0; i < EXT2_CAT_MAX; i++) {
+        bytes += _stats.bytes[i];
+    }
+
+    /* If JSON is requested */
+    if (json) {
+        fprintf(stderr, "{\"syscalls\":%lu,\"bytes\":%lu,\"categories\":{",
+                _stats.syscalls, bytes);
+        for (i = 0; i < EXT2_CAT_MAX; i++) {
+            fprintf(stderr, "%s\"%s\":{\"reads\":%lu,\"blocks\":%lu,"
+                    "\"bytes\":%lu}", i ? "," : "", _cat_to_str[i],
+                    _stats.reads[i], _stats.blks[i], _stats.bytes[i]);
         }
-        else if (i == EXT2_TIND_BLOCK) {
-            printf("Triple indirect data block: %u\n", ino_st.i_block[i]);
+        fprintf(stderr, "},\"cache\":{\"hits\":%lu,\"misses\":%lu},"
+                "\"phases_ns\":{", _stats.cache_hits, _stats.cache_misses);
+        for (i = 0; i < EXT2_PHASE_MAX; i++) {
+            fprintf(stderr, "%s\"%s\":%lu", i ? "," : "", _phase_to_str[i],
+                    _stats.phase_ns[i]);
         }
+        fprintf(stderr, "}}\n");
+        return;
+    }
 
-        /* Update the pointer */
-        i++;
+    /* Print the counters as text */
+    fprintf(stderr, "Syscalls: %lu Bytes: %lu\n", _stats.syscalls, bytes);
+    for (i = 0; i < EXT2_CAT_MAX; i++) {
+        fprintf(stderr, "%-6s reads: %lu blocks: %lu bytes: %lu\n",
+                _cat_to_str[i], _stats.reads[i], _stats.blks[i],
+                _stats.bytes[i]);
+    }
+    fprintf(stderr, "Cache hits: %lu misses: %lu\n",
+            _stats.cache_hits, _stats.cache_misses);
+    for (i = 0; i < EXT2_PHASE_MAX; i++) {
+        fprintf(stderr, "%-6s time: %lu ns\n", _phase_to_str[i],
+                _stats.phase_ns[i]);
     }
 }
 
 /**
- * @brief Prints the contents of the direct regular file data block
- * @param[in] block_addr Block address
+ * Latency histograms
  */
-void _ext2_dir_print_reg_file(_u32 blk_addr) {
 
-    _u64 blk_off;
-    _u32 i = 0;
-    _u8 data;
+/* Sub-buckets per power of two (log2), bounds the error to 1/16 */
+#define HIST_SUB_BITS    (4u)
+#define HIST_SUB         (1u << HIST_SUB_BITS)
+/* Number of buckets covering the whole 64 bit range */
+#define HIST_NB_BUCKETS  (HIST_SUB + (64u - HIST_SUB_BITS) * HIST_SUB)
 
-    /* Get the block offset */
-    blk_off = (_u64)blk_addr * EXT2_BLOCK_SIZE(&_sb);
+/* Histogram - Device read */
+#define EXT2_HIST_READ   (0)
+/* Histogram - Inode fetch */
+#define EXT2_HIST_INODE  (1)
+/* Histogram - Directory block scan */
+#define EXT2_HIST_SCAN   (2)
+/* Histogram - Full path lookup */
+#define EXT2_HIST_PATH   (3)
+/* Number of histograms */
+#define EXT2_HIST_MAX    (4)
 
-    /* Print the block */
-    while (i < EXT2_BLOCK_SIZE(&_sb)) {
-        /* Read the next byte */
-        _ext2_read(blk_off + i, &data, 1);
-        /* Print the byte */
-        printf("%c", data);
-        /* Update the pointer */
-        i++;
+/* Histogram to string map */
+static const char *_hist_to_str[EXT2_HIST_MAX] = {"read", "inode", "scan",
+                                                  "path"};
+
+/* Log bucketed latency histogram in nanoseconds */
+struct ext2_hist {
+    _u64 count;
+    _u64 min;
+    _u64 max;
+    _u64 buckets[HIST_NB_BUCKETS];
+};
+
+/* Histograms of the run */
+static struct ext2_hist _hists[EXT2_HIST_MAX];
+/* Whether the latencies are recorded */
+static _u8 _hist_on;
+/* Set by SIGUSR1 to dump the histograms */
+static volatile sig_atomic_t _hist_dump_req;
+
+/**
+ * @brief Returns the bucket of the value
+ * @param[in] val Value
+ * @return Bucket index
+ */
+static inline _u32 _hist_bucket(_u64 val) {
+
+    _u32 exp;
+
+    /* Small values have a bucket each */
+    if (val < HIST_SUB) {
+        return val;
     }
+
+    /* Bucket on the leading bit and the next HIST_SUB_BITS bits */
+    exp = 63 - __builtin_clzll(val) - HIST_SUB_BITS;
+
+    return HIST_SUB + exp * HIST_SUB + ((val >> exp) & (HIST_SUB - 1));
 }
 
 /**
- * @brief Prints the contents of the direct directory data block
- * @param[in] block_addr Block address
+ * @brief Returns the highest value falling in the bucket
+ * @param[in] idx Bucket index
+ * @return Value
  */
-void _ext2_dir_print_dir(_u32 blk_addr) {
-
-    _u64 blk_off;
-    _u32 i = 0;
-    struct ext2_dir_entry_2 dir_ent;
+static inline _u64 _hist_bucket_val(_u32 idx) {
 
-    /* Get the block offset */
-    blk_off = (_u64)blk_addr * EXT2_BLOCK_SIZE(&_sb);
+    _u32 exp;
 
-    /* Print the directory mappings in the block */
-    while (i < EXT2_BLOCK_SIZE(&_sb)) {
-        /* Read the directory entry */
-        _ext2_read(blk_off + i, &dir_ent, EXT2_DIR_ENTRY_SIZE);
-        /* Print the directory entry contents */
-        printf("%d\t", dir_ent.inode);
-        printf("%s\t", _ft_to_str[dir_ent.file_type]);
-        printf("%.*s\n", dir_ent.name_len, dir_ent.name);
-        /* Update the pointer */
-        i += dir_ent.rec_len;
+    /* Small values have a bucket each */
+    if (idx < HIST_SUB) {
+        return idx;
     }
+
+    exp = (idx - HIST_SUB) / HIST_SUB;
+
+    return (((_u64)HIST_SUB + (idx & (HIST_SUB - 1)) + 1) << exp) - 1;
 }
 
 /**
- * @brief Prints the contents of the direct data block
- * @param[in] block_addr Block address
- * @param[in] file_type File type
+ * @brief Adds the value to the histogram
+ * @param[in] h Histogram
+ * @param[in] ns Latency in nanoseconds
  */
-void _ext2_dir_print(
-        _u32 blk_addr,
-        _u8 file_type) {
+static inline void _hist_add(struct ext2_hist *h, _u64 ns) {
+
+    _u64 cur;
 
-    /* If the block belongs to a regular file */
-    if (file_type == EXT2_FT_REG_FILE) {
-        /* Print the regular file block */
-        _ext2_dir_print_reg_file(blk_addr);
+    ATOMIC_ADD(h->buckets[_hist_bucket(ns)], 1);
+
+    /* Lower the minimum (zero while empty) and raise the maximum */
+    cur = __atomic_load_n(&h->min, __ATOMIC_RELAXED);
+    while ((!cur || (ns < cur)) &&
+           !__atomic_compare_exchange_n(&h->min, &cur, ns ? ns : 1, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
     }
-    /* If the block belongs to a directory  */
-    else if (file_type == EXT2_FT_DIR) {
-        /* Print the directory */
-        _ext2_dir_print_dir(blk_addr);
+    cur = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    while ((ns > cur) &&
+           !__atomic_compare_exchange_n(&h->max, &cur, ns, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
     }
+    ATOMIC_ADD(h->count, 1);
 }
 
 /**
- * @brief Prints the contents of the indirect data block
- * @param[in] blk_addr Block address
- * @param[in] file_type File type
- * @param[in] indir_level Indirection level
+ * @brief Records the latency into the histogram
+ * @param[in] hist Histogram number
+ * @param[in] ns Latency in nanoseconds
  */
-void _ext2_indir_print(
-        _u32 blk_addr,
-        _u8 file_type,
-        _u8 indir_level) {
+static inline void _hist_record(_u8 hist, _u64 ns) {
 
-    _u64 blk_off;
-    _u32 nxt_blk_addr;
-    _u32 i = 0;
+    _hist_add(&_hists[hist], ns);
+}
 
-    /* Get the block offset */
-    blk_off = (_u64)blk_addr * EXT2_BLOCK_SIZE(&_sb);
+/**
+ * @brief Returns the value at the quantile of the histogram
+ * @param[in] h Histogram
+ * @param[in] q Quantile (0 to 1)
+ * @return Value
+ */
+static _u64 _hist_quantile(struct ext2_hist *h, double q) {
 
-   /* For all the addresses in the block */
-    while (i < EXT2_ADDR_PER_BLOCK(&_sb)) {
+    _u64 rank;
+    _u64 seen = 0;
+    _u32 i;
 
-        /* Read the next block address */
-        _ext2_read(blk_off + 4 * i, &nxt_blk_addr, 4);
+    /* Get the rank of the quantile */
+    rank = (_u64)(q * h->count);
+    if (rank >= h->count) {
+        rank = h->count - 1;
+    }
 
-        /* If the address is zero */
-        if (!nxt_blk_addr) {
-            return;
+    /* Find the bucket holding the rank */
+    for (i = 0; i < HIST_NB_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen > rank) {
+            break;
         }
+    }
 
-        /* If the current block is single indirect one */
-        if (indir_level == 1) {
-            /* Print the next direct block */
-            _ext2_dir_print(nxt_blk_addr, file_type);
-        }
-        /* If the current block is single indirect one */
+    /* Clamp to the recorded maximum */
+    return (_hist_bucket_val(i) < h->max) ? _hist_bucket_val(i) : h->max;
+}
+
+/**
+ * @brief Prints the histograms on stderr
+ * @param[in] json Print as a JSON object if non zero
+ */
+static void _hist_print(_u8 json) {
+
+    struct ext2_hist *h;
+    _u32 i;
+
+    /* Print the header */
+    if (json) {
+        fprintf(stderr, "{");
+    }
+    else {
+        fprintf(stderr, "%-6s %10s %10s %10s %10s %10s %10s (ns)\n",
+                "Hist", "count", "min", "p50", "p99", "p999", "max");
+    }
+
+    /* For each histogram */
+    for (i = 0; i < EXT2_HIST_MAX; i++) {
+        h = &_hists[i];
+
+        /* If JSON is requested */
+        if (json) {
+            fprintf(stderr, "%s\"%s\":{\"count\":%lu", i ? "," : "",
+                    _hist_to_str[i], h->count);
+            if (h->count) {
+                fprintf(stderr, ",\"min\":%lu,\"p50\":%lu,\"p99\":%lu,"
+                        "\"p999\":%lu,\"max\":%lu", h->min,
+                        _hist_quantile(h, 0.5), _hist_quantile(h, 0.99),
+                        _hist_quantile(h, 0.999), h->max);
+            }
+            fprintf(stderr, "}");
+        }
+        /* If the histogram has samples */
+        else if (h->count) {
+            fprintf(stderr, "%-6s %10lu %10lu %10lu %10lu %10lu %10lu\n",
+                    _hist_to_str[i], h->count, h->min,
+                    _hist_quantile(h, 0.5), _hist_quantile(h, 0.99),
+                    _hist_quantile(h, 0.999), h->max);
+        }
+        /* If the histogram is empty */
+        else {
+            fprintf(stderr, "%-6s %10u\n", _hist_to_str[i], 0);
+        }
+    }
+
+    if (json) {
+        fprintf(stderr, "}\n");
+    }
+}
+
+/**
+ * @brief SIGUSR1 handler requesting a dump of the histograms
+ */
+static void _hist_sig_handler(int sig) {
+
+    _hist_dump_req = 1;
+}
+
+/**
+ * Access trace
+ */
+
+/* Trace file magic and version */
+#define TRACE_MAGIC      "E2TR"
+#define TRACE_VERSION    (1u)
+/* Trace record - Request, followed by the reads it made */
+#define TRACE_REC_REQ    (0x10u)
+/* Trace record - Read, the low bits hold the read category */
+#define TRACE_REC_READ   (0x20u)
+
+/* Trace of the run, written to the trace file at exit */
+struct ext2_trace {
+    /* Path of the trace file, NULL unless tracing */
+    _u8 *path;
+    /* Records of the run */
+    _u8 *buf;
+    _u64 len;
+    _u64 max_len;
+    /* Time of the previous record */
+    _u64 t_prev;
+    /* Offset of the status byte of the request record */
+    _u64 status_off;
+    /* Serializes the records of the worker threads */
+    pthread_mutex_t lock;
+};
+
+/* Trace of the run */
+static struct ext2_trace _trace = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+/**
+ * @brief Appends bytes to the trace
+ * @param[in] data Bytes
+ * @param[in] len Number of bytes
+ */
+static void _trace_put(const void *data, _u64 len) {
+
+    /* Grow the trace if full */
+    if (_trace.len + len > _trace.max_len) {
+        _trace.max_len = 2 * _trace.max_len + len + 4096;
+        _trace.buf = realloc(_trace.buf, _trace.max_len);
+
+        /* Check for failure */
+        if (!_trace.buf) {
+            /* Exit with failure */
+            exit_err("Failed to allocate the trace\n");
+        }
+    }
+
+    memcpy(_trace.buf + _trace.len, data, len);
+    _trace.len += len;
+}
+
+/**
+ * @brief Appends an unsigned LEB128 varint to the trace
+ * @param[in] val Value
+ */
+static void _trace_put_var(_u64 val) {
+
+    _u8 bytes[10];
+    _u32 len = 0;
+
+    /* Seven bits per byte, the high bit marks a following byte */
+    do {
+        bytes[len++] = (val & 0x7F) | ((val > 0x7F) ? 0x80 : 0);
+        val >>= 7;
+    } while (val);
+
+    _trace_put(bytes, len);
+}
+
+/**
+ * @brief Appends the time since the previous record to the trace
+ */
+static void _trace_put_time() {
+
+    _u64 now = _ext2_now_ns();
+
+    _trace_put_var(now - _trace.t_prev);
+    _trace.t_prev = now;
+}
+
+/**
+ * @brief Records the read in the trace
+ * @param[in] offset Offset of the read
+ * @param[in] size Number of bytes
+ * @param[in] cat Read category
+ */
+static void _trace_read(_u64 offset, _u64 size, _u8 cat) {
+
+    _u8 type = TRACE_REC_READ | cat;
+
+    pthread_mutex_lock(&_trace.lock);
+    _trace_put(&type, 1);
+    _trace_put_time();
+    _trace_put_var(offset);
+    _trace_put_var(size);
+    pthread_mutex_unlock(&_trace.lock);
+}
+
+/**
+ * @brief Writes the trace of the run to the trace file
+ * @note Registered with atexit so that failed requests are traced too.
+ *       The run is appended with a single write.
+ */
+static void _trace_flush() {
+
+    struct stat st;
+    _u8 ver = TRACE_VERSION;
+    int fd;
+
+    /* If there is nothing to write */
+    if (!_trace.path || !_trace.len) {
+        return;
+    }
+
+    /* Open the trace file for appending */
+    fd = open(_trace.path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+
+    /* Check for failure */
+    if (fd == -1) {
+        fprintf(stderr, "Failed to open the trace file\n");
+        return;
+    }
+
+    /* Write the header if the file is new */
+    if (!fstat(fd, &st) && !st.st_size) {
+        write(fd, TRACE_MAGIC, 4);
+        write(fd, &ver, 1);
+    }
+
+    /* Write the run */
+    write(fd, _trace.buf, _trace.len);
+    close(fd);
+
+    free(_trace.buf);
+    _trace.buf = NULL;
+    _trace.len = 0;
+}
+
+/**
+ * @brief Starts the trace of the run with its request record
+ * @param[in] path Path of the trace file
+ * @param[in] nb_args Number of arguments (path, request and its arguments)
+ * @param[in] args Arguments
+ */
+void ext2_trace_start(_u8 *path, int nb_args, char **args) {
+
+    struct timespec ts;
+    _u8 type = TRACE_REC_REQ;
+    _u8 status = 0;
+    int i;
+
+    _trace.path = path;
+    _trace.t_prev = _ext2_now_ns();
+    atexit(_trace_flush);
+
+    /* Request record: type, status, wall clock start, arguments */
+    clock_gettime(CLOCK_REALTIME, &ts);
+    _trace_put(&type, 1);
+    _trace.status_off = _trace.len;
+    _trace_put(&status, 1);
+    _trace_put_var((_u64)ts.tv_sec * 1000000000ull + ts.tv_nsec);
+    _trace_put_var(nb_args);
+    for (i = 0; i < nb_args; i++) {
+        _trace_put_var(strlen(args[i]));
+        _trace_put(args[i], strlen(args[i]));
+    }
+}
+
+/**
+ * @brief Marks the traced request as successful
+ */
+void ext2_trace_done() {
+
+    if (_trace.path) {
+        _trace.buf[_trace.status_off] = 1;
+    }
+}
+
+#ifdef EXT2_NO_MAIN
+/**
+ * @brief Reads an unsigned LEB128 varint of a trace, for the replay of the
+ *        benchmark
+ * @param[in,out] pos Position in the trace, moved past the varint
+ * @param[in] end End of the trace
+ * @return Value
+ */
+static _u64 _trace_get_var(_u8 **pos, _u8 *end) {
+
+    _u64 val = 0;
+    _u32 shift = 0;
+
+    while ((*pos < end) && (shift < 64)) {
+        val |= (_u64)(**pos & 0x7F) << shift;
+        shift += 7;
+        if (!(*(*pos)++ & 0x80)) {
+            break;
+        }
+    }
+
+    return val;
+}
+#endif
+
+/* Whether the device is read with O_DIRECT, bypassing the page cache */
+static _u8 _io_direct;
+
+/**
+ * @brief Reads from the device, through an aligned bounce buffer when the
+ *        device is opened with O_DIRECT
+ * @param[out] buff Buffer
+ * @param[in] size Number of bytes
+ * @param[in] offset Offset from the start of the device
+ */
+static inline void _ext2_pread(void *buff, _u64 size, _u64 offset) {
+
+    static __thread _u8 *dio_buf;
+    static __thread _u64 dio_len;
+    _u64 done = 0;
+    ssize_t ret;
+    _u64 start;
+    _u64 len;
+
+    /* If the page cache is used read directly, until done */
+    if (!_io_direct) {
+        while (done < size) {
+            ret = pread64(_fd, (_u8 *)buff + done, size - done, offset + done);
+
+            /* Retry if interrupted */
+            if ((ret == -1) && (errno == EINTR)) {
+                continue;
+            }
+
+            /* Check for failure or the end of the device */
+            if (ret <= 0) {
+                /* Exit with failure */
+                exit_err("Failed to read %lu bytes at %lu of the device\n",
+                         size, offset);
+            }
+            done += ret;
+        }
+        return;
+    }
+
+    /* Get the aligned range covering the request */
+    start = offset & ~(_u64)(DIRECT_IO_ALIGN - 1);
+    len = (offset + size - start + DIRECT_IO_ALIGN - 1)
+        & ~(_u64)(DIRECT_IO_ALIGN - 1);
+
+    /* Grow the bounce buffer if needed */
+    if (len > dio_len) {
+        free(dio_buf);
+        dio_buf = aligned_alloc(DIRECT_IO_ALIGN, len);
+        dio_len = len;
+
+        /* Check for failure */
+        if (!dio_buf) {
+            /* Exit with failure */
+            exit_err("Failed to allocate the direct I/O buffer\n");
+        }
+    }
+
+    /* Read the aligned range, the device may end inside it past the
+     * request */
+    do {
+        ret = pread64(_fd, dio_buf, len, start);
+    } while ((ret == -1) && (errno == EINTR));
+
+    /* Check that the request was read, not left stale in the buffer */
+    if ((ret < 0) || ((_u64)ret < offset - start + size)) {
+        /* Exit with failure */
+        exit_err("Failed to read %lu bytes at %lu of the device\n", size,
+                 offset);
+    }
+
+    /* Copy the request out */
+    memcpy(buff, dio_buf + (offset - start), size);
+}
+
+/* Whether copy_file_range is used to copy out of the device */
+static _u8 _io_no_copy_range;
+/* Whether sendfile is used to send the device to the standard output */
+static _u8 _io_no_send;
+
+/**
+ * @brief Copies bytes of the device to a file, in the kernel with
+ *        copy_file_range when the device and the file allow it
+ * @param[in] offset Offset from the start of the device
+ * @param[in] fd_out File descriptor of the file
+ * @param[in] out_off Offset in the file
+ * @param[in] size Number of bytes
+ * @return Number of bytes copied, less than size if the device and the
+ *         file cannot copy in the kernel or on failure, the rest is left
+ *         to the caller
+ * @note Counted as data reads in the statistics
+ */
+static _u64 _ext2_copy(_u64 offset, int fd_out, _u64 out_off, _u64 size) {
+
+    loff_t in = offset;
+    loff_t out = out_off;
+    _u64 bs = EXT2_BLOCK_SIZE(&_sb);
+    _u64 done = 0;
+    ssize_t len;
+
+    /* If the copy is not possible in the kernel */
+    if (_io_direct || _io_no_copy_range) {
+        return 0;
+    }
+
+    /* Copy until done */
+    while (done < size) {
+        len = copy_file_range(_fd, &in, fd_out, &out, size - done, 0);
+        ATOMIC_ADD(_stats.syscalls, 1);
+        if (len > 0) {
+            done += len;
+            continue;
+        }
+
+        /* Retry if interrupted */
+        if ((len == -1) && (errno == EINTR)) {
+            continue;
+        }
+
+        /* Stop using it if the device and the file do not support it */
+        if ((len == -1) && !done && ((errno == EXDEV) || (errno == EINVAL) ||
+            (errno == ENOSYS) || (errno == EOPNOTSUPP))) {
+            _io_no_copy_range = 1;
+        }
+        break;
+    }
+
+    /* Update the counters */
+    if (done) {
+        ATOMIC_ADD(_stats.reads[EXT2_CAT_DATA], 1);
+        ATOMIC_ADD(_stats.blks[EXT2_CAT_DATA],
+                   (offset + done + bs - 1) / bs - offset / bs);
+        ATOMIC_ADD(_stats.bytes[EXT2_CAT_DATA], done);
+
+        /* Record the read if tracing */
+        if (_trace.path) {
+            _trace_read(offset, done, EXT2_CAT_DATA);
+        }
+    }
+
+    return done;
+}
+
+/**
+ * @brief Sends bytes of the device to the standard output, in the kernel
+ *        with sendfile when the device and the output allow it
+ * @param[in] offset Offset from the start of the device
+ * @param[in] size Number of bytes
+ * @return Number of bytes sent, less than size if the device and the output
+ *         cannot send in the kernel or on failure, the rest is left to the
+ *         caller
+ * @note The buffered output must be flushed first. Counted as data reads
+ *       in the statistics
+ */
+static _u64 _ext2_send(_u64 offset, _u64 size) {
+
+    off64_t in = offset;
+    _u64 bs = EXT2_BLOCK_SIZE(&_sb);
+    _u64 done = 0;
+    ssize_t len;
+
+    /* If the send is not possible in the kernel */
+    if (_io_direct || _io_no_send) {
+        return 0;
+    }
+
+    /* Send until done */
+    while (done < size) {
+        len = sendfile64(STDOUT_FILENO, _fd, &in, size - done);
+        ATOMIC_ADD(_stats.syscalls, 1);
+        if (len > 0) {
+            done += len;
+            continue;
+        }
+
+        /* Retry if interrupted */
+        if ((len == -1) && (errno == EINTR)) {
+            continue;
+        }
+
+        /* Stop using it if the device and the output do not support it */
+        if ((len == -1) && !done && ((errno == EINVAL) || (errno == ENOSYS) ||
+            (errno == EOPNOTSUPP))) {
+            _io_no_send = 1;
+        }
+        break;
+    }
+
+    /* Update the counters */
+    if (done) {
+        ATOMIC_ADD(_stats.reads[EXT2_CAT_DATA], 1);
+        ATOMIC_ADD(_stats.blks[EXT2_CAT_DATA],
+                   (offset + done + bs - 1) / bs - offset / bs);
+        ATOMIC_ADD(_stats.bytes[EXT2_CAT_DATA], done);
+
+        /* Record the read if tracing */
+        if (_trace.path) {
+            _trace_read(offset, done, EXT2_CAT_DATA);
+        }
+    }
+
+    return done;
+}
+
+/**
+ * @brief Drops the pages of the device from the page cache
+ * @param[in] dev_path Path of the device file (or image)
+ */
+void ext2_drop_page_cache(_u8 *dev_path) {
+
+    int fd;
+
+    /* Open the device file */
+    fd = open(dev_path, O_RDONLY);
+
+    /* Check for failure */
+    if (fd == -1) {
+        /* Exit with failure */
+        exit_err("Failed to open the device file\n");
+    }
+
+    /* Drop its pages */
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+/**
+ * @brief Locates and reads the requested amount of data
+ * @param[in] offset Offset number of bytes from the start of the device
+ * @param[in] buff Starting address of the buffer
+ * @param[in] size Number of bytes to be read from the #offset
+ * @param[in] cat Read category, for the statistics
+ */
+static inline void _ext2_read(_u64 offset, void *buff, _u64 size, _u8 cat) {
+
+    _u64 bs = EXT2_BLOCK_SIZE(&_sb);
+    _u64 t;
+
+    /* Fire the read start probe */
+    EXT2_PROBE3(read__start, offset, size, cat);
+
+    /* If the latencies are recorded */
+    if (_hist_on) {
+        /* Dump the histograms if requested by the signal */
+        if (_hist_dump_req) {
+            _hist_dump_req = 0;
+            _hist_print(0);
+        }
+
+        /* Read and record the latency */
+        t = _ext2_now_ns();
+        _ext2_pread(buff, size, offset);
+        _hist_record(EXT2_HIST_READ, _ext2_now_ns() - t);
+    }
+    /* Read the bytes at the offset into the buffer */
+    else {
+        _ext2_pread(buff, size, offset);
+    }
+
+    /* Update the counters */
+    ATOMIC_ADD(_stats.syscalls, 1);
+    ATOMIC_ADD(_stats.reads[cat], 1);
+    ATOMIC_ADD(_stats.blks[cat], (offset + size + bs - 1) / bs - offset / bs);
+    ATOMIC_ADD(_stats.bytes[cat], size);
+
+    /* Record the read if tracing */
+    if (_trace.path) {
+        _trace_read(offset, size, cat);
+    }
+
+    /* Fire the read done probe */
+    EXT2_PROBE3(read__done, offset, size, cat);
+}
+
+/**
+ * @brief Sets the offset of the device file to the given value
+ * @param[in] offset Offset (unsigned)
+ * @note The offset is set with respect to the base offset
+ */
+static inline void _ext2_seek_set(_u64 offset) {
+
+    /* Shift the head to the offset */
+    lseek64(_fd, offset, SEEK_SET);
+}
+
+/**
+ * @brief Sets the offset of the device file to the given value
+ * @param[in] offset Offset (signed)
+ * @note The offset is set with respect to the current offset
+ */
+static inline void _ext2_seek_cur(_s64 offset) {
+
+    /* Shift the head to the offset */
+    lseek64(_fd, offset, SEEK_CUR);
+}
+
+/**
+ * Metadata block cache
+ */
+
+/* Direct mapped cache of directory and indirect blocks */
+struct ext2_bcache {
+    /* Number of slots */
+    _u32 nb_slots;
+    /* Block number held by each slot (zero if empty) */
+    _u32 *slot_blk;
+    /* Block data of all the slots */
+    _u8 *data;
+    /* Guards the slots against the worker threads */
+    pthread_mutex_t lock;
+};
+
+/* Block cache of the device */
+static struct ext2_bcache _bcache = {.lock = PTHREAD_MUTEX_INITIALIZER};
+/* Number of blocks of the block cache */
+static _u32 _bcache_nb_blks = BCACHE_NB_BLKS;
+
+/**
+ * @brief Allocates the block cache
+ * @param[in] nb_slots Number of blocks the cache holds
+ */
+static void _ext2_bcache_init(_u32 nb_slots) {
+
+    _bcache.nb_slots = nb_slots;
+    _bcache.slot_blk = calloc(nb_slots, sizeof(_u32));
+    _bcache.data = malloc((_u64)nb_slots * EXT2_BLOCK_SIZE(&_sb));
+
+    /* Check for failure */
+    if (!_bcache.slot_blk || !_bcache.data) {
+        /* Exit with failure */
+        exit_err("Failed to allocate the block cache\n");
+    }
+}
+
+/**
+ * @brief Frees the block cache
+ */
+static void _ext2_bcache_deinit() {
+
+    free(_bcache.slot_blk);
+    free(_bcache.data);
+}
+
+#ifdef EXT2_NO_MAIN
+/**
+ * @brief Empties the block cache, for the cold runs of the benchmark
+ */
+static void _ext2_bcache_reset() {
+
+    memset(_bcache.slot_blk, 0, _bcache.nb_slots * sizeof(_u32));
+}
+#endif
+
+/**
+ * @brief Checks if the block is held by the block cache
+ * @param[in] blk_addr Block number
+ * @return Non zero if the block is cached
+ */
+static inline _u8 _ext2_bcache_has(_u32 blk_addr) {
+
+    return _bcache.slot_blk[blk_addr % _bcache.nb_slots] == blk_addr;
+}
+
+/**
+ * @brief Reads the metadata block through the block cache
+ * @param[in] blk_addr Block number
+ * @param[out] buff Buffer of a block size
+ * @param[in] cat Read category
+ */
+static void _ext2_blk_read(_u32 blk_addr, void *buff, _u8 cat) {
+
+    _u64 bs = EXT2_BLOCK_SIZE(&_sb);
+    _u32 slot = blk_addr % _bcache.nb_slots;
+    _u8 *slot_data = _bcache.data + slot * bs;
+
+    /* If the block is cached copy it out of its slot */
+    pthread_mutex_lock(&_bcache.lock);
+    if (_bcache.slot_blk[slot] == blk_addr) {
+        memcpy(buff, slot_data, bs);
+        pthread_mutex_unlock(&_bcache.lock);
+        ATOMIC_ADD(_stats.cache_hits, 1);
+        return;
+    }
+    pthread_mutex_unlock(&_bcache.lock);
+
+    /* Read the block, unlocked so that the workers read in parallel */
+    _ext2_read((_u64)blk_addr * bs, buff, bs, cat);
+    ATOMIC_ADD(_stats.cache_misses, 1);
+
+    /* Copy it into its slot */
+    pthread_mutex_lock(&_bcache.lock);
+    memcpy(slot_data, buff, bs);
+    _bcache.slot_blk[slot] = blk_addr;
+    pthread_mutex_unlock(&_bcache.lock);
+}
+
+/**
+ * Block tree walker
+ */
+
+/* Visitor return value - Continue the walk */
+#define EXT2_WALK_CONT   (0)
+/* Visitor return value - Stop the walk */
+#define EXT2_WALK_STOP   (1)
+
+/* Walk flag - Report holes to the visitor (skipped by default) */
+#define EXT2_WALK_HOLES  (1u << 0)
+
+/* Walker state, the buffers are allocated once and reused across walks */
+struct ext2_walk {
+    /* Data block buffer for the visitors, indirect block buffer per level */
+    _u8 *buf[4];
+    /* Block number currently held by each indirect level buffer */
+    _u32 buf_blk[4];
+};
+
+/**
+ * @brief Visitor called by the walker for every block of the tree
+ * @param[in] w Walker state
+ * @param[in] ctx Visitor context
+ * @param[in] lblk First logical block covered by the block
+ * @param[in] pblk Physical block number (zero for a hole)
+ * @param[in] level Zero for a data block, indirection level otherwise
+ * @return EXT2_WALK_CONT or EXT2_WALK_STOP
+ * @note An indirect block is visited before the blocks it maps. A hole
+ *       at a given level spans all the data blocks that level maps.
+ */
+typedef int (*ext2_visit_t)(struct ext2_walk *w, void *ctx,
+                            _u64 lblk, _u32 pblk, _u8 level);
+
+/* Walker state of the main thread */
+static struct ext2_walk _walk;
+
+/**
+ * @brief Allocates the walker buffers if not done already
+ * @param[in] w Walker state
+ */
+static void _ext2_walk_init(struct ext2_walk *w) {
+
+    _u32 i;
+
+    /* If the buffers are already there */
+    if (w->buf[0]) {
+        return;
+    }
+
+    /* Allocate a block per level */
+    for (i = 0; i < 4; i++) {
+        w->buf[i] = malloc(EXT2_BLOCK_SIZE(&_sb));
+        w->buf_blk[i] = 0;
+
+        /* Check for failure */
+        if (!w->buf[i]) {
+            /* Exit with failure */
+            exit_err("Failed to allocate the walker buffers\n");
+        }
+    }
+}
+
+/**
+ * @brief Frees the walker buffers
+ * @param[in] w Walker state
+ */
+static void _ext2_walk_deinit(struct ext2_walk *w) {
+
+    _u32 i;
+
+    for (i = 0; i < 4; i++) {
+        free(w->buf[i]);
+        w->buf[i] = NULL;
+    }
+}
+
+/**
+ * @brief Hints the kernel that the given block will be read soon
+ * @param[in] blk_addr Block number
+ */
+static inline void _ext2_prefetch(_u32 blk_addr) {
+
+    posix_fadvise(_fd, (_u64)blk_addr * EXT2_BLOCK_SIZE(&_sb),
+                  EXT2_BLOCK_SIZE(&_sb), POSIX_FADV_WILLNEED);
+    ATOMIC_ADD(_stats.syscalls, 1);
+}
+
+/**
+ * @brief Walks the block tree of the inode up to its size
+ * @param[in] w Walker state
+ * @param[in] ino_st Inode structure
+ * @param[in] flags Walk flags
+ * @param[in] visit Visitor
+ * @param[in] ctx Visitor context
+ * @return EXT2_WALK_STOP if the visitor stopped the walk,
+ *         EXT2_WALK_CONT otherwise
+ * @note The walk is iterative, the indirect blocks of the current path
+ *       are held in the per level buffers. It is always inlined so that
+ *       a constant visitor is inlined into the loop.
+ */
+static inline __attribute__((always_inline))
+int _ext2_walk(struct ext2_walk *w, struct ext2_inode *ino_st, _u32 flags,
+               ext2_visit_t visit, void *ctx) {
+
+    _u64 bs = EXT2_BLOCK_SIZE(&_sb);
+    _u64 apb = EXT2_ADDR_PER_BLOCK(&_sb);
+    _u64 span[4];
+    _u32 idx[4];
+    _u64 nb_lblks;
+    _u64 lblk = 0;
+    _u32 blk_addr;
+    _u32 lvl;
+    _u32 top;
+    _u32 i;
+
+    /* Get the number of logical blocks in the file */
+    nb_lblks = (EXT2_I_SIZE(ino_st) + bs - 1) / bs;
+
+    /* Get the data blocks mapped by a block of each level */
+    span[0] = 1;
+    for (i = 1; i < 4; i++) {
+        span[i] = span[i - 1] * apb;
+    }
+
+    /* For the direct blocks */
+    for (i = 0; (i < EXT2_NDIR_BLOCKS) && (lblk < nb_lblks); i++, lblk++) {
+        blk_addr = ino_st->i_block[i];
+
+        /* Visit the block unless it is a skipped hole */
+        if ((blk_addr || (flags & EXT2_WALK_HOLES)) &&
+            visit(w, ctx, lblk, blk_addr, 0)) {
+            return EXT2_WALK_STOP;
+        }
+    }
+
+    /* For the single, double and triple indirect blocks */
+    for (lvl = 1; (lvl < 4) && (lblk < nb_lblks); lvl++) {
+        blk_addr = ino_st->i_block[EXT2_NDIR_BLOCKS + lvl - 1];
+
+        /* If the whole level is a hole */
+        if (!blk_addr) {
+            if ((flags & EXT2_WALK_HOLES) && visit(w, ctx, lblk, 0, lvl)) {
+                return EXT2_WALK_STOP;
+            }
+            lblk += span[lvl];
+            continue;
+        }
+
+        /* Visit the root indirect block */
+        if (visit(w, ctx, lblk, blk_addr, lvl)) {
+            return EXT2_WALK_STOP;
+        }
+
+        /* Push the root indirect block */
+        top = lvl;
+        idx[top] = 0;
+        if (w->buf_blk[top] != blk_addr) {
+            _ext2_blk_read(blk_addr, w->buf[top], EXT2_CAT_IND);
+            w->buf_blk[top] = blk_addr;
+        }
+
+        /* While the stack is not empty */
+        while ((top <= lvl) && (lblk < nb_lblks)) {
+
+            /* If the block on top is done pop it */
+            if (idx[top] == apb) {
+                top++;
+                continue;
+            }
+
+            /* Get the next address in the block on top */
+            blk_addr = ((_u32 *)w->buf[top])[idx[top]++];
+
+            /* If it maps a hole */
+            if (!blk_addr) {
+                if ((flags & EXT2_WALK_HOLES) &&
+                    visit(w, ctx, lblk, 0, top - 1)) {
+                    return EXT2_WALK_STOP;
+                }
+                lblk += span[top - 1];
+                continue;
+            }
+
+            /* Visit the block it maps */
+            if (visit(w, ctx, lblk, blk_addr, top - 1)) {
+                return EXT2_WALK_STOP;
+            }
+
+            /* If it is a data block move to the next one */
+            if (top == 1) {
+                lblk++;
+                continue;
+            }
+
+            /* Prefetch the sibling indirect block */
+            if ((idx[top] < apb) && ((_u32 *)w->buf[top])[idx[top]]) {
+                _ext2_prefetch(((_u32 *)w->buf[top])[idx[top]]);
+            }
+
+            /* Push the indirect block */
+            top--;
+            idx[top] = 0;
+            if (w->buf_blk[top] != blk_addr) {
+                _ext2_blk_read(blk_addr, w->buf[top], EXT2_CAT_IND);
+                w->buf_blk[top] = blk_addr;
+            }
+        }
+    }
+
+    return EXT2_WALK_CONT;
+}
+
+/**
+ * @brief Reads the data block into the walker data buffer
+ * @param[in] w Walker state
+ * @param[in] blk_addr Block number
+ * @return Pointer to the block
+ */
+static inline _u8 *_ext2_walk_read(struct ext2_walk *w, _u32 blk_addr) {
+
+    /* Read the whole block */
+    _ext2_read((_u64)blk_addr * EXT2_BLOCK_SIZE(&_sb), w->buf[0],
+               EXT2_BLOCK_SIZE(&_sb), EXT2_CAT_DATA);
+
+    return w->buf[0];
+}
+
+/**
+ * @brief Reads the directory block into the walker data buffer through
+ *        the block cache
+ * @param[in] w Walker state
+ * @param[in] blk_addr Block number
+ * @return Pointer to the block
+ */
+static inline _u8 *_ext2_walk_read_dir(struct ext2_walk *w, _u32 blk_addr) {
+
+    /* Read the cached block */
+    _ext2_blk_read(blk_addr, w->buf[0], EXT2_CAT_DIR);
+
+    return w->buf[0];
+}
+
+/**
+ * @brief Returns if the inode has a block tree to walk, a fast symbolic
+ *        link keeps its target in the block array instead
+ * @param[in] ino_st Inode structure
+ */
+static inline _u8 _ext2_ino_has_tree(struct ext2_inode *ino_st) {
+
+    _u32 acl_blks = ino_st->i_file_acl ? EXT2_BLOCK_SIZE(&_sb) / 512 : 0;
+
+    return ino_st->i_blocks > acl_blks;
+}
+
+/**
+ * @brief Initialize globals
+ * @param[in] dev_path Path of the device file (or image)
+ * @note The device is opened with O_DIRECT if #_io_direct is set
+ */
+void ext2_init(_u8 *dev_path) {
+
+    /* Open the device file */
+    _dev_path = dev_path;
+    _fd = open(dev_path, O_RDONLY | (_io_direct ? O_DIRECT : 0));
+
+    /* Check for failure */
+    if (_fd == -1) {
+        /* Exit with failure */
+        exit_err("Failed to open the device file\n");
+    }
+
+    /* Read the superblock */
+    _ext2_read(EXT2_SUPER_BLOCK_OFFSET, &_sb, EXT2_SUPER_BLOCK_SIZE,
+               EXT2_CAT_SUPER);
+
+    /* Check if the device holds an ext2 file system */
+    if (_sb.s_magic != EXT2_SUPER_MAGIC) {
+        /* Exit with failure */
+        exit_err("The device does not hold an ext2 file system\n");
+    }
+
+    /* Get the number of block groups */
+    _nb_grps = (_sb.s_inodes_count + EXT2_INODES_PER_GROUP(&_sb) - 1)
+        / EXT2_INODES_PER_GROUP(&_sb);
+
+    /* Allocate the group descriptor table */
+    _gdt = malloc((_u64)_nb_grps * EXT2_DESC_SIZE(&_sb));
+
+    /* Check for failure */
+    if (!_gdt) {
+        /* Exit with failure */
+        exit_err("Failed to allocate the group descriptor table\n");
+    }
+
+    /* Read the table at once, it follows the superblock's block */
+    _ext2_read((_u64)(_sb.s_first_data_block + 1) * EXT2_BLOCK_SIZE(&_sb),
+               _gdt, (_u64)_nb_grps * EXT2_DESC_SIZE(&_sb), EXT2_CAT_GDT);
+
+    /* Allocate the block cache */
+    _ext2_bcache_init(_bcache_nb_blks);
+}
+
+/**
+ * @brief Denitialize globals
+ */
+void ext2_deinit() {
+
+    /* Free the walker buffers */
+    _ext2_walk_deinit(&_walk);
+
+    /* Free the block cache */
+    _ext2_bcache_deinit();
+
+    /* Free the group descriptor table */
+    free(_gdt);
+
+    /* Close the device file */
+    close(_fd);
+}
+
+/**
+ * @brief Returns the cached group descriptor of the given group
+ * @param[in] grp_nb Group number
+ * @return Pointer to the group descriptor
+ */
+static inline struct ext2_group_desc *_ext2_grp_desc(_u64 grp_nb) {
+
+    return (struct ext2_group_desc *)(_gdt + grp_nb * EXT2_DESC_SIZE(&_sb));
+}
+
+/**
+ * @brief Returns the device offset of the inode given the inode number
+ * @param[in] ino Inode number
+ * @return Offset of the inode in bytes
+ */
+static inline _u64 _ext2_ino_off(_u64 ino) {
+
+    _u64 grp_nb;
+    _u64 ino_tab_off;
+    _u64 ino_idx;
+
+    /* Get the group number of the inode */
+    grp_nb = (ino - 1) / EXT2_INODES_PER_GROUP(&_sb);
+    /* Get the inode table offset */
+    ino_tab_off = (_u64)_ext2_grp_desc(grp_nb)->bg_inode_table
+        * EXT2_BLOCK_SIZE(&_sb);
+    /* Get the inode index in the table */
+    ino_idx = (ino - 1) % EXT2_INODES_PER_GROUP(&_sb);
+
+    /* Return the inode offset */
+    return ino_tab_off + ino_idx * EXT2_INODE_SIZE(&_sb);
+}
+
+/**
+ * @brief Obtains the inode structure given the inode number
+ * @param[in] ino Inode number
+ * @param[out] p_ino_st Pointer to the inode structure
+ */
+static void _ext2_ino_to_ino_st(_u64 ino, struct ext2_inode *p_ino_st) {
+
+    _u64 t = _hist_on ? _ext2_now_ns() : 0;
+
+    /* Fire the inode probe */
+    EXT2_PROBE3(inode, ino, _ext2_ino_off(ino), EXT2_CAT_ITAB);
+
+    /* Read the inode */
+    _ext2_read(_ext2_ino_off(ino), p_ino_st, sizeof(struct ext2_inode),
+               EXT2_CAT_ITAB);
+
+    /* Record the latency */
+    if (_hist_on) {
+        _hist_record(EXT2_HIST_INODE, _ext2_now_ns() - t);
+    }
+}
+
+/* Inode fetch slot, orders a batch by its position on the device */
+struct ext2_ino_slot {
+    _u64 off;
+    _u32 idx;
+};
+
+/**
+ * @brief Compares two inode fetch slots by their device offset
+ */
+static int _ext2_ino_slot_cmp(const void *a, const void *b) {
+
+    const struct ext2_ino_slot *sa = a;
+    const struct ext2_ino_slot *sb = b;
+
+    return (sa->off > sb->off) - (sa->off < sb->off);
+}
+
+/**
+ * @brief Obtains the inode structures of a batch of inode numbers
+ * @param[in] inos Array of inode numbers
+ * @param[in] nb_inos Number of inode numbers
+ * @param[out] ino_sts Array of inode structures (same order as #inos)
+ * @note The inodes are fetched in inode table order, every read covers
+ *       up to ITAB_BATCH_SIZE bytes of the table so that neighbouring
+ *       inodes are served from the same read
+ */
+static void _ext2_inos_to_ino_sts(_u64 *inos, _u32 nb_inos,
+                                  struct ext2_inode *ino_sts) {
+
+    struct ext2_ino_slot *slots;
+    _u8 *win;
+    _u64 win_off = 0;
+    _u64 win_len = 0;
+    _u64 tab_end;
+    _u64 grp_nb;
+    _u32 i;
+
+    /* Allocate the slots and the table window */
+    slots = malloc((_u64)nb_inos * sizeof(*slots));
+    win = malloc(ITAB_BATCH_SIZE);
+
+    /* Check for failure */
+    if (!slots || !win) {
+        /* Exit with failure */
+        exit_err("Failed to allocate the inode batch\n");
+    }
+
+    /* Locate every inode and sort them by their offset */
+    for (i = 0; i < nb_inos; i++) {
+        slots[i].off = _ext2_ino_off(inos[i]);
+        slots[i].idx = i;
+    }
+    qsort(slots, nb_inos, sizeof(*slots), _ext2_ino_slot_cmp);
+
+    /* For each inode in the table order */
+    for (i = 0; i < nb_inos; i++) {
+
+        /* If the inode is not inside the current window */
+        if ((slots[i].off < win_off) ||
+            (slots[i].off + sizeof(struct ext2_inode) > win_off + win_len)) {
+
+            /* Get the end of the inode table holding the inode */
+            grp_nb = (inos[slots[i].idx] - 1) / EXT2_INODES_PER_GROUP(&_sb);
+            tab_end = (_u64)_ext2_grp_desc(grp_nb)->bg_inode_table
+                * EXT2_BLOCK_SIZE(&_sb)
+                + (_u64)EXT2_INODES_PER_GROUP(&_sb) * EXT2_INODE_SIZE(&_sb);
+
+            /* Start the window at the table block of the inode */
+            win_off = slots[i].off
+                - (slots[i].off % EXT2_BLOCK_SIZE(&_sb));
+            win_len = tab_end - win_off;
+            if (win_len > ITAB_BATCH_SIZE) {
+                win_len = ITAB_BATCH_SIZE;
+            }
+
+            /* Read the window */
+            _ext2_read(win_off, win, win_len, EXT2_CAT_ITAB);
+        }
+
+        /* Copy the inode out of the window */
+        memcpy(&ino_sts[slots[i].idx], win + (slots[i].off - win_off),
+               sizeof(struct ext2_inode));
+    }
+
+    /* Free the slots and the window */
+    free(slots);
+    free(win);
+}
+
+/**
+ * Inode table scan
+ */
+
+/* Scan visitor, called with every inode in use in the inode number order */
+typedef void (*ext2_scan_visit_t)(void *ctx, _u64 ino,
+                                  struct ext2_inode *ino_st);
+
+/**
+ * @brief Returns if the inode is marked in use in the group inode bitmap
+ * @param[in] bmap Inode bitmap of the group
+ * @param[in] idx Index of the inode in the group
+ */
+static inline _u8 _ext2_bmap_test(_u8 *bmap, _u32 idx) {
+
+    return (bmap[idx >> 3] >> (idx & 7)) & 1;
+}
+
+/**
+ * @brief Visits every inode in use of the file system
+ * @param[in] visit Visitor
+ * @param[in] ctx Context passed to the visitor
+ * @note The inode bitmaps guide the scan: groups without inodes in use are
+ *       skipped, the table is read in windows of up to ITAB_BATCH_SIZE
+ *       bytes starting at the next inode in use and ending at the last
+ *       one. The reserved inodes other than the root are not visited.
+ */
+void ext2_scan(ext2_scan_visit_t visit, void *ctx) {
+
+    _u64 bs = EXT2_BLOCK_SIZE(&_sb);
+    _u32 ipg = EXT2_INODES_PER_GROUP(&_sb);
+    _u32 isz = EXT2_INODE_SIZE(&_sb);
+    _u32 win_max = ITAB_BATCH_SIZE / isz;
+    struct ext2_group_desc *gd;
+    _u8 *bmap;
+    _u8 *win;
+    _u64 tab_off;
+    _u64 ino;
+    _u32 win_first;
+    _u32 win_nb;
+    _u32 last;
+    _u32 grp;
+    _u32 idx;
+
+    /* Allocate the bitmap and the table window */
+    bmap = malloc(bs);
+    win = malloc(ITAB_BATCH_SIZE);
+
+    /* Check for failure */
+    if (!bmap || !win) {
+        /* Exit with failure */
+        exit_err("Failed to allocate the scan buffers\n");
+    }
+
+    /* For each group holding inodes in use */
+    for (grp = 0; grp < _nb_grps; grp++) {
+        gd = _ext2_grp_desc(grp);
+        if (gd->bg_free_inodes_count >= ipg) {
+            continue;
+        }
+
+        /* Read the inode bitmap */
+        _ext2_read((_u64)gd->bg_inode_bitmap * bs, bmap, (ipg + 7) / 8,
+                   EXT2_CAT_BMAP);
+
+        /* Get the end of the inodes in use */
+        last = ipg;
+        while (last && !_ext2_bmap_test(bmap, last - 1)) {
+            last--;
+        }
+
+        /* Visit the inodes in use */
+        tab_off = (_u64)gd->bg_inode_table * bs;
+        win_first = 0;
+        win_nb = 0;
+        for (idx = 0; idx < last; idx++) {
+            ino = (_u64)grp * ipg + idx + 1;
+
+            /* Skip the free and the reserved inodes */
+            if (!_ext2_bmap_test(bmap, idx) ||
+                ((ino < EXT2_FIRST_INO(&_sb)) && (ino != EXT2_ROOT_INO))) {
+                continue;
+            }
+
+            /* If the inode is not inside the current window */
+            if (idx >= win_first + win_nb) {
+                /* Start the window at the table block of the inode */
+                win_first = idx - idx % (bs / isz);
+                win_nb = last - win_first;
+                if (win_nb > win_max) {
+                    win_nb = win_max;
+                }
+
+                /* Read the window */
+                _ext2_read(tab_off + (_u64)win_first * isz, win,
+                           (_u64)win_nb * isz, EXT2_CAT_ITAB);
+            }
+
+            /* Visit the inode */
+            visit(ctx, ino,
+                  (struct ext2_inode *)(win + (_u64)(idx - win_first) * isz));
+        }
+    }
+
+    /* Free the buffers */
+    free(bmap);
+    free(win);
+}
+
+/**
+ * Inode snapshot
+ */
+
+/* Inodes in use held as one array per field */
+struct ext2_snap {
+    _u64 nb_inos;
+    _u64 cap;
+    /* Mapped scan file holding the columns, NULL if allocated */
+    void *map;
+    _u64 map_len;
+    _u32 *ino;
+    _u16 *mode;
+    _u16 *links;
+    _u32 *uid;
+    _u32 *gid;
+    _u64 *size;
+    _u64 *blocks;
+    _u32 *atime;
+    _u32 *ctime;
+    _u32 *mtime;
+};
+
+/* Scan file magic */
+#define SCAN_MAGIC    "E2SC"
+/* Scan file version */
+#define SCAN_VERSION  (1)
+/* Alignment of the columns in the scan file */
+#define SCAN_ALIGN    (64u)
+
+/* Scan file header */
+struct ext2_scan_hdr {
+    char magic[4];
+    _u32 version;
+    _u64 nb_rows;
+    _u32 nb_cols;
+    _u32 reserved[3];
+};
+
+/* Scan file column directory entry */
+struct ext2_scan_col {
+    char name[16];
+    _u32 width;
+    _u32 reserved;
+    _u64 off;
+};
+
+/* Column of the snapshot */
+struct ext2_snap_col {
+    const char *name;
+    /* Width of a value in bytes */
+    _u8 width;
+    /* Offset of the array pointer in the snapshot */
+    _u32 off;
+};
+
+/* Columns of the snapshot, in the order of the scan output */
+static const struct ext2_snap_col _snap_cols[] = {
+    {"ino", 4, offsetof(struct ext2_snap, ino)},
+    {"mode", 2, offsetof(struct ext2_snap, mode)},
+    {"uid", 4, offsetof(struct ext2_snap, uid)},
+    {"gid", 4, offsetof(struct ext2_snap, gid)},
+    {"size", 8, offsetof(struct ext2_snap, size)},
+    {"blocks", 8, offsetof(struct ext2_snap, blocks)},
+    {"atime", 4, offsetof(struct ext2_snap, atime)},
+    {"ctime", 4, offsetof(struct ext2_snap, ctime)},
+    {"mtime", 4, offsetof(struct ext2_snap, mtime)},
+    {"links", 2, offsetof(struct ext2_snap, links)},
+};
+
+/* Number of columns of the snapshot */
+#define SNAP_NB_COLS  (sizeof(_snap_cols) / sizeof(_snap_cols[0]))
+
+/* Array of the column of the snapshot */
+#define SNAP_COL(snap, col)  (*(void **)((_u8 *)(snap) + _snap_cols[col].off))
+
+/**
+ * @brief Returns the value of the row of the column
+ * @param[in] snap Snapshot
+ * @param[in] col Column index
+ * @param[in] row Row index
+ */
+static inline _u64 _ext2_snap_get(struct ext2_snap *snap, _u32 col,
+                                  _u64 row) {
+
+    void *arr = SNAP_COL(snap, col);
+
+    /* Read the value at its width */
+    switch (_snap_cols[col].width) {
+        case 2:
+            return ((_u16 *)arr)[row];
+        case 4:
+            return ((_u32 *)arr)[row];
+        default:
+            return ((_u64 *)arr)[row];
+    }
+}
+
+/**
+ * @brief Resizes the columns of the snapshot
+ * @param[in] snap Snapshot
+ * @param[in] cap Number of rows to hold
+ */
+static void _ext2_snap_resize(struct ext2_snap *snap, _u64 cap) {
+
+    void *arr;
+    _u32 col;
+
+    /* Resize every column */
+    for (col = 0; col < SNAP_NB_COLS; col++) {
+        arr = realloc(SNAP_COL(snap, col), cap * _snap_cols[col].width);
+
+        /* Check for failure */
+        if (!arr) {
+            /* Exit with failure */
+            exit_err("Failed to allocate the snapshot\n");
+        }
+        SNAP_COL(snap, col) = arr;
+    }
+    snap->cap = cap;
+}
+
+/**
+ * @brief Scan visitor appending the inode to the snapshot
+ */
+static void _ext2_snap_visit(void *ctx, _u64 ino, struct ext2_inode *ino_st) {
+
+    struct ext2_snap *snap = ctx;
+    _u64 row = snap->nb_inos;
+
+    /* Grow the columns if full */
+    if (row == snap->cap) {
+        _ext2_snap_resize(snap, snap->cap * 2);
+    }
+
+    /* Append the fields */
+    snap->ino[row] = ino;
+    snap->mode[row] = ino_st->i_mode;
+    snap->uid[row] = inode_uid(*ino_st);
+    snap->gid[row] = inode_gid(*ino_st);
+    snap->size[row] = EXT2_I_SIZE(ino_st);
+    snap->blocks[row] = ino_st->i_blocks;
+    snap->atime[row] = ino_st->i_atime;
+    snap->ctime[row] = ino_st->i_ctime;
+    snap->mtime[row] = ino_st->i_mtime;
+    snap->links[row] = ino_st->i_links_count;
+    snap->nb_inos++;
+}
+
+/**
+ * @brief Appends the row of a snapshot to another
+ * @param[in] dst Snapshot appended to
+ * @param[in] src Snapshot holding the row
+ * @param[in] row Row index
+ */
+static void _ext2_snap_append(struct ext2_snap *dst, struct ext2_snap *src,
+                              _u64 row) {
+
+    _u32 width;
+    _u32 col;
+
+    /* Grow the columns if full */
+    if (dst->nb_inos == dst->cap) {
+        _ext2_snap_resize(dst, dst->cap ? dst->cap * 2 : 64);
+    }
+
+    /* Copy the value of every column */
+    for (col = 0; col < SNAP_NB_COLS; col++) {
+        width = _snap_cols[col].width;
+        memcpy((_u8 *)SNAP_COL(dst, col) + dst->nb_inos * width,
+               (_u8 *)SNAP_COL(src, col) + row * width, width);
+    }
+    dst->nb_inos++;
+}
+
+/**
+ * @brief Loads the inodes in use into the snapshot
+ * @param[out] snap Snapshot
+ */
+void ext2_snap_load(struct ext2_snap *snap) {
+
+    /* Size the columns on the inodes in use of the superblock */
+    memset(snap, 0, sizeof(*snap));
+    _ext2_snap_resize(snap, _sb.s_inodes_count - _sb.s_free_inodes_count + 1);
+
+    /* Scan the inode tables */
+    ext2_scan(_ext2_snap_visit, snap);
+}
+
+/**
+ * @brief Maps the columns of a scan file as the snapshot
+ * @param[out] snap Snapshot
+ * @param[in] path Path of the scan file
+ * @note The columns are used in place, the file must hold every column of
+ *       the snapshot at its width
+ */
+void ext2_snap_map(struct ext2_snap *snap, const char *path) {
+
+    struct ext2_scan_hdr *hdr;
+    struct ext2_scan_col *dir;
+    struct stat st;
+    _u32 col;
+    _u32 i;
+    int fd;
+
+    /* Map the file */
+    memset(snap, 0, sizeof(*snap));
+    fd = open(path, O_RDONLY);
+    if ((fd == -1) || fstat(fd, &st) || (st.st_size < sizeof(*hdr))) {
+        exit_err("Failed to open the scan file\n");
+    }
+    snap->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (snap->map == MAP_FAILED) {
+        exit_err("Failed to map the scan file\n");
+    }
+    snap->map_len = st.st_size;
+
+    /* Check the header */
+    hdr = snap->map;
+    dir = (struct ext2_scan_col *)(hdr + 1);
+    if (memcmp(hdr->magic, SCAN_MAGIC, 4) || (hdr->version != SCAN_VERSION) ||
+        (sizeof(*hdr) + (_u64)hdr->nb_cols * sizeof(*dir) > snap->map_len)) {
+        exit_err("Not a scan file\n");
+    }
+    snap->nb_inos = hdr->nb_rows;
+    snap->cap = hdr->nb_rows;
+
+    /* Point every column of the snapshot into the file */
+    for (col = 0; col < SNAP_NB_COLS; col++) {
+        for (i = 0; i < hdr->nb_cols; i++) {
+            if (!strncmp(dir[i].name, _snap_cols[col].name,
+                         sizeof(dir[i].name))) {
+                break;
+            }
+        }
+        if ((i == hdr->nb_cols) || (dir[i].width != _snap_cols[col].width) ||
+            (dir[i].off + snap->nb_inos * dir[i].width > snap->map_len)) {
+            exit_err("Scan file lacks the column %s\n", _snap_cols[col].name);
+        }
+        SNAP_COL(snap, col) = (_u8 *)snap->map + dir[i].off;
+    }
+}
+
+/**
+ * @brief Frees the columns of the snapshot
+ * @param[in] snap Snapshot
+ */
+void ext2_snap_free(struct ext2_snap *snap) {
+
+    _u32 col;
+
+    /* If the columns are mapped unmap the file */
+    if (snap->map) {
+        munmap(snap->map, snap->map_len);
+    }
+    /* Free the columns otherwise */
+    else {
+        for (col = 0; col < SNAP_NB_COLS; col++) {
+            free(SNAP_COL(snap, col));
+        }
+    }
+    memset(snap, 0, sizeof(*snap));
+}
+
+/**
+ * Snapshot filters
+ */
+
+/* Maximum number of conditions of a filter */
+#define FILTER_MAX_CONDS  (32)
+
+/* Condition on a column: lo <= (value & mask) <= hi */
+struct ext2_cond {
+    _u32 col;
+    _u64 mask;
+    _u64 lo;
+    _u64 hi;
+};
+
+/* Conjunction of conditions */
+struct ext2_filter {
+    _u32 nb_conds;
+    struct ext2_cond conds[FILTER_MAX_CONDS];
+};
+
+/**
+ * @brief Parses a number with an optional K, M, G or T suffix, or a date
+ *        (YYYY-MM-DD[THH:MM[:SS]], local time) into seconds since the epoch
+ * @param[in] arg String argument
+ * @param[out] val Number
+ * @return 0 on success, -1 otherwise
+ */
+static int _ext2_parse_val(const char *arg, _u64 *val) {
+
+    struct tm tm = {0};
+    _u32 shift = 0;
+    time_t t;
+    char *end;
+
+    /* If the value is a date */
+    if (strchr(arg, '-')) {
+        end = strptime(arg, "%Y-%m-%d", &tm);
+        if (end && (*end == 'T')) {
+            end = strptime(end + 1, "%H:%M", &tm);
+            if (end && (*end == ':')) {
+                end = strptime(end + 1, "%S", &tm);
+            }
+        }
+        if (!end || *end) {
+            return -1;
+        }
+        tm.tm_isdst = -1;
+        t = mktime(&tm);
+
+        /* Reject the failures and the dates before the epoch */
+        if (t < 0) {
+            return -1;
+        }
+        *val = t;
+        return 0;
+    }
+
+    /* Parse the number and its suffix */
+    errno = 0;
+    *val = strtoull(arg, &end, 10);
+    if ((end == arg) || errno) {
+        return -1;
+    }
+    switch (*end) {
+        case 'T':
+            shift += 10;
+            /* Fall through */
+        case 'G':
+            shift += 10;
+            /* Fall through */
+        case 'M':
+            shift += 10;
+            /* Fall through */
+        case 'K':
+            shift += 10;
+            end++;
+            break;
+        default:
+            break;
+    }
+
+    /* Reject the values the suffix makes overflow */
+    if (*val > (UINT64_MAX >> shift)) {
+        return -1;
+    }
+    *val <<= shift;
+
+    return *end ? -1 : 0;
+}
+
+/**
+ * @brief Returns the index of the snapshot column given its name
+ * @param[in] name Name of the column
+ * @param[in] len Length of the name
+ * @return Column index, SNAP_NB_COLS if there is none
+ */
+static _u32 _ext2_snap_col(const char *name, _u32 len) {
+
+    _u32 col;
+
+    for (col = 0; col < SNAP_NB_COLS; col++) {
+        if ((strlen(_snap_cols[col].name) == len) &&
+            !strncmp(name, _snap_cols[col].name, len)) {
+            break;
+        }
+    }
+
+    return col;
+}
+
+/**
+ * @brief Parses a condition of the form <field><op><value> into the filter
+ * @param[in] arg String argument
+ * @param[in,out] filter Filter
+ * @note The field is a snapshot column or type (reg, dir, lnk, chr, blk,
+ *       fifo, sock), the op one of =, <, <=, > and >=
+ */
+static void _ext2_parse_cond(const char *arg, struct ext2_filter *filter) {
+
+    static const char *types[] = {"fifo", "chr", "dir", "blk", "reg", "lnk",
+                                  "sock"};
+    static const _u16 type_bits[] = {0x1000, 0x2000, 0x4000, 0x6000, 0x8000,
+                                     0xA000, 0xC000};
+    struct ext2_cond *cond;
+    const char *val_str;
+    _u32 name_len;
+    _u64 val;
+    char op;
+    _u8 eq;
+    _u32 i;
+
+    /* Check the room left */
+    if (filter->nb_conds == FILTER_MAX_CONDS) {
+        exit_err("Too many conditions\n");
+    }
+    cond = &filter->conds[filter->nb_conds++];
+    cond->mask = UINT64_MAX;
+
+    /* Split the field, the op and the value */
+    name_len = strcspn(arg, "=<>");
+    op = arg[name_len];
+    eq = op && (op != '=') && (arg[name_len + 1] == '=');
+    val_str = arg + name_len + 1 + eq;
+    if (!op) {
+        exit_err("Invalid condition %s\n", arg);
+    }
+
+    /* If the field is the file type */
+    if ((name_len == 4) && !strncmp(arg, "type", 4)) {
+        for (i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+            if (!strcmp(val_str, types[i])) {
+                break;
+            }
+        }
+        if ((op != '=') || (i == sizeof(types) / sizeof(types[0]))) {
+            exit_err("Invalid condition %s\n", arg);
+        }
+        cond->col = _ext2_snap_col("mode", 4);
+        cond->mask = 0xF000;
+        cond->lo = type_bits[i];
+        cond->hi = type_bits[i];
+        return;
+    }
+
+    /* Get the column and the value */
+    cond->col = _ext2_snap_col(arg, name_len);
+    if ((cond->col == SNAP_NB_COLS) || _ext2_parse_val(val_str, &val)) {
+        exit_err("Invalid condition %s\n", arg);
+    }
+
+    /* Turn the op into an inclusive range, empty if lo > hi */
+    cond->lo = 0;
+    cond->hi = UINT64_MAX;
+    if (op == '=') {
+        cond->lo = val;
+        cond->hi = val;
+    }
+    else if ((op == '<') && (eq || val)) {
+        cond->hi = eq ? val : val - 1;
+    }
+    else if ((op == '>') && (eq || (val != UINT64_MAX))) {
+        cond->lo = eq ? val : val + 1;
+    }
+    /* Nothing is below 0 or above the maximum */
+    else {
+        cond->lo = 1;
+        cond->hi = 0;
+    }
+}
+
+/* Narrows the selection on a column of the given type, written without
+ * branches so that the compiler vectorizes it */
+#define FILTER_LOOP(type)                                               \
+    {                                                                   \
+        const type *restrict v = arr;                                   \
+        type m = cond->mask;                                            \
+        type lo = cond->lo;                                             \
+        type hi = (cond->hi > (type)-1) ? (type)-1 : cond->hi;          \
+        for (i = 0; i < nb; i++) {                                      \
+            sel[i] &= ((type)(v[i] & m) >= lo) & ((type)(v[i] & m) <= hi); \
+        }                                                               \
+    }
+
+/**
+ * @brief Selects the rows of the snapshot matching the filter
+ * @param[in] snap Snapshot
+ * @param[in] filter Filter
+ * @param[out] sel Selection, one byte per row set to 1 if it matches
+ * @return Number of rows matching
+ * @note Each condition narrows the selection a column at a time, the
+ *       loops are vectorized from -O2 on, not only with -O3
+ */
+__attribute__((optimize("tree-vectorize", "vect-cost-model=dynamic")))
+_u64 ext2_snap_filter(struct ext2_snap *snap, struct ext2_filter *filter,
+                      _u8 *restrict sel) {
+
+    struct ext2_cond *cond;
+    _u64 nb = snap->nb_inos;
+    _u64 nb_sel = 0;
+    const void *arr;
+    _u64 i;
+    _u32 c;
+
+    /* Select every row */
+    memset(sel, 1, nb);
+
+    /* Narrow the selection by every condition */
+    for (c = 0; c < filter->nb_conds; c++) {
+        cond = &filter->conds[c];
+        arr = SNAP_COL(snap, cond->col);
+
+        /* If the range is empty or starts past the values of the column */
+        if ((cond->lo > cond->hi) || ((_snap_cols[cond->col].width < 8) &&
+            (cond->lo >> (_snap_cols[cond->col].width * 8)))) {
+            memset(sel, 0, nb);
+            break;
+        }
+
+        /* Compare at the width of the column */
+        switch (_snap_cols[cond->col].width) {
+            case 2:
+                FILTER_LOOP(_u16);
+                break;
+            case 4:
+                FILTER_LOOP(_u32);
+                break;
+            default:
+                FILTER_LOOP(_u64);
+                break;
+        }
+    }
+
+    /* Count the rows selected */
+    for (i = 0; i < nb; i++) {
+        nb_sel += sel[i];
+    }
+
+    return nb_sel;
+}
+
+/**
+ * Path resolution explain records
+ */
+
+/* Block visited while resolving a path component */
+struct ext2_explain_blk {
+    _u64 lblk;
+    _u32 pblk;
+    /* Zero for a directory block, indirection level otherwise */
+    _u8 level;
+    /* Whether the block was held by the cache or the walker */
+    _u8 hit;
+    /* Number of entries compared in the directory block */
+    _u32 nb_cmps;
+};
+
+/* Path component resolution record */
+struct ext2_explain_comp {
+    _u8 *name;
+    _u64 ino;
+    _u64 ns;
+    /* Range of the blocks of the component in the block records */
+    _u32 first_blk;
+    _u32 nb_blks;
+};
+
+/* Explain records of a path resolution */
+struct ext2_explain {
+    struct ext2_explain_comp comps[MAX_PATH_TOKS];
+    _u32 nb_comps;
+    struct ext2_explain_blk *blks;
+    _u32 nb_blks;
+    _u32 max_blks;
+};
+
+/* Explain records being filled, NULL unless explaining */
+static struct ext2_explain *_explain;
+
+/**
+ * @brief Appends a block record to the current component
+ * @param[in] lblk Logical block number
+ * @param[in] pblk Physical block number
+ * @param[in] level Indirection level
+ * @param[in] hit Whether the block was cached
+ * @return Pointer to the block record
+ */
+static struct ext2_explain_blk *_ext2_explain_blk(_u64 lblk, _u32 pblk,
+                                                  _u8 level, _u8 hit) {
+
+    struct ext2_explain_blk *blk;
+
+    /* Grow the block records if full */
+    if (_explain->nb_blks == _explain->max_blks) {
+        _explain->max_blks = _explain->max_blks ? 2 * _explain->max_blks : 64;
+        _explain->blks = realloc(_explain->blks, _explain->max_blks
+                                 * sizeof(struct ext2_explain_blk));
+
+        /* Check for failure */
+        if (!_explain->blks) {
+            /* Exit with failure */
+            exit_err("Failed to allocate the explain records\n");
+        }
+    }
+
+    /* Fill the record */
+    blk = &_explain->blks[_explain->nb_blks++];
+    blk->lblk = lblk;
+    blk->pblk = pblk;
+    blk->level = level;
+    blk->hit = hit;
+    blk->nb_cmps = 0;
+    _explain->comps[_explain->nb_comps].nb_blks++;
+
+    return blk;
+}
+
+/**
+ * @brief Returns the indirection level mapping the logical block
+ * @param[in] lblk Logical block number
+ * @return Zero for a direct block, indirection level otherwise
+ */
+static _u8 _ext2_lblk_level(_u64 lblk) {
+
+    _u64 apb = EXT2_ADDR_PER_BLOCK(&_sb);
+
+    if (lblk < EXT2_NDIR_BLOCKS) {
+        return 0;
+    }
+    lblk -= EXT2_NDIR_BLOCKS;
+    if (lblk < apb) {
+        return 1;
+    }
+    lblk -= apb;
+
+    return (lblk < apb * apb) ? 2 : 3;
+}
+
+/**
+ * @brief Prints the explain records of the path resolution
+ * @param[in] ex Explain records
+ */
+static void _ext2_explain_print(struct ext2_explain *ex) {
+
+    static const char *lvl_to_str[4] = {"direct", "single", "double",
+                                        "triple"};
+    struct ext2_explain_comp *comp;
+    struct ext2_explain_blk *blk;
+    _u64 nb_cmps;
+    _u32 i;
+    _u32 j;
+
+    /* For each resolved component */
+    for (i = 0; i < ex->nb_comps; i++) {
+        comp = &ex->comps[i];
+
+        /* Get the total entries compared */
+        nb_cmps = 0;
+        for (j = 0; j < comp->nb_blks; j++) {
+            nb_cmps += ex->blks[comp->first_blk + j].nb_cmps;
+        }
+
+        /* Print the component summary */
+        _out_printf("Component %u: %s -> %lu\n", i + 1, comp->name,
+                    comp->ino);
+        _out_printf("Time: %lu ns Blocks: %u Compared: %lu\n",
+                    comp->ns, comp->nb_blks, nb_cmps);
+
+        /* Print the blocks of the component */
+        for (j = 0; j < comp->nb_blks; j++) {
+            blk = &ex->blks[comp->first_blk + j];
+
+            /* If the block is an indirect block */
+            if (blk->level) {
+                _out_printf("  %s indirect block: %u (from logical %lu) %s\n",
+                            lvl_to_str[blk->level], blk->pblk, blk->lblk,
+                            blk->hit ? "hit" : "miss");
+            }
+            /* If the block is a directory block */
+            else {
+                _out_printf("  %s dir block (%lu): %u compared: %u %s\n",
+                            lvl_to_str[_ext2_lblk_level(blk->lblk)],
+                            blk->lblk, blk->pblk, blk->nb_cmps,
+                            blk->hit ? "hit" : "miss");
+            }
+        }
+    }
+}
+
+/**
+ * @brief Checks that the directory record lies within its block
+ * @param[in] blk Directory data block
+ * @param[in] off Offset of the record in the block
+ * @return 1 if the header, the record length and the name fit in the
+ *         block, 0 if the rest of the block is corrupt
+ */
+static inline _u8 _ext2_dir_rec_is_valid(_u8 *blk, _u32 off) {
+
+    struct ext2_dir_entry_2 *dir_ent = (struct ext2_dir_entry_2 *)(blk + off);
+    _u32 bs = EXT2_BLOCK_SIZE(&_sb);
+
+    return (off + 8 <= bs) && (dir_ent->rec_len >= 8) &&
+           (dir_ent->rec_len <= bs - off) &&
+           (8u + dir_ent->name_len <= dir_ent->rec_len);
+}
+
+/**
+ * @brief Searches the given directory data block for the argument string
+ * @param[in] blk Directory data block
+ * @param[in] nxt_arg Argument string to be searched
+ * @param[in] nxt_arg_len Length of the argument string
+ * @param[out] nb_cmps Number of entries compared
+ * @return Inode number of the argument string
+ */
+static _u64 _ext2_dir_search(_u8 *blk, _u8 *nxt_arg, _u32 nxt_arg_len,
+                             _u32 *nb_cmps) {
+
+    struct ext2_dir_entry_2 *dir_ent;
+    _u32 i = 0;
+
+    /* While the entire block is traversed */
+    while (i < EXT2_BLOCK_SIZE(&_sb)) {
+        dir_ent = (struct ext2_dir_entry_2 *)(blk + i);
+
+        /* Stop on a corrupt record */
+        if (!_ext2_dir_rec_is_valid(blk, i)) {
+            break;
+        }
+
+        /* Compare the next argument string */
+        (*nb_cmps)++;
+        if (dir_ent->inode && (dir_ent->name_len == nxt_arg_len) &&
+            !memcmp(nxt_arg, dir_ent->name, nxt_arg_len)) {
+            /* Return the inode number */
+            return dir_ent->inode;
+        }
+
+        /* Update the total bytes read */
+        i += dir_ent->rec_len;
+    }
+
+    /* Return bad inode number */
+    return EXT2_BAD_INO;
+}
+
+/* Directory search context */
+struct ext2_search_ctx {
+    _u8 *name;
+    _u32 name_len;
+    _u64 ino;
+};
+
+/**
+ * @brief Walk visitor searching the directory data blocks
+ */
+static int _ext2_search_visit(struct ext2_walk *w, void *ctx,
+                              _u64 lblk, _u32 pblk, _u8 level) {
+
+    struct ext2_search_ctx *sctx = ctx;
+    struct ext2_explain_blk *ex_blk = NULL;
+    _u32 nb_cmps = 0;
+    _u8 *blk;
+    _u64 t;
+
+    /* If explaining record the block */
+    if (_explain) {
+        ex_blk = _ext2_explain_blk(lblk, pblk, level,
+                                   _ext2_bcache_has(pblk) ||
+                                   (level && (w->buf_blk[level] == pblk)));
+    }
+
+    /* Skip the indirect blocks */
+    if (level) {
+        return EXT2_WALK_CONT;
+    }
+
+    /* Read the block */
+    blk = _ext2_walk_read_dir(w, pblk);
+
+    /* Search the block, recording the scan latency */
+    t = _hist_on ? _ext2_now_ns() : 0;
+    sctx->ino = _ext2_dir_search(blk, sctx->name, sctx->name_len, &nb_cmps);
+    if (_hist_on) {
+        _hist_record(EXT2_HIST_SCAN, _ext2_now_ns() - t);
+    }
+
+    /* If explaining record the entries compared */
+    if (ex_blk) {
+        ex_blk->nb_cmps = nb_cmps;
+    }
+
+    return (sctx->ino > EXT2_BAD_INO) ? EXT2_WALK_STOP : EXT2_WALK_CONT;
+}
+
+/**
+ * @brief Returns the inode number of the file which is child of the file
+ *        pointed by given inode number
+ * @param[in] ino Parent inode number
+ * @param[in] nxt_arg Path name argument of the child file
+ * @return Inode number of the child file
+ */
+static _u64 _ext2_nxt_ino(_u64 ino, _u8 *nxt_arg) {
+
+    struct ext2_inode ino_st;
+    struct ext2_search_ctx sctx;
+
+    /* Fire the lookup start probe */
+    EXT2_PROBE2(lookup__start, ino, nxt_arg);
+
+    /* Get the inode from the inode number */
+    _ext2_ino_to_ino_st(ino, &ino_st);
+
+    /* Check if the inode is of type directory */
+    if (!EXT2_IS_INODE_DIR(&ino_st)) {
+        /* Exit with failure */
+        exit_err("The path consists of non-directory files\n");
+    }
+
+    /* Search the directory blocks */
+    sctx.name = nxt_arg;
+    sctx.name_len = strlen(nxt_arg);
+    sctx.ino = EXT2_BAD_INO;
+    _ext2_walk_init(&_walk);
+    _ext2_walk(&_walk, &ino_st, 0, _ext2_search_visit, &sctx);
+
+    /* Fire the lookup done probe */
+    EXT2_PROBE3(lookup__done, ino, nxt_arg, sctx.ino);
+
+    /* Return the inode number */
+    return sctx.ino;
+}
+
+/**
+ * @brief Maps the logical block of the inode to its physical block
+ * @param[in] w Walker state holding the indirect blocks
+ * @param[in] ino_st Inode structure
+ * @param[in] lblk Logical block number
+ * @return Physical block number, zero for a hole
+ * @note The indirect blocks on the path stay in the walker buffers, so
+ *       consecutive lookups read nothing but the data block
+ */
+static _u32 _ext2_bmap(struct ext2_walk *w, struct ext2_inode *ino_st,
+                       _u64 lblk) {
+
+    _u64 apb = EXT2_ADDR_PER_BLOCK(&_sb);
+    _u64 span = 1;
+    _u32 blk_addr;
+    _u32 lvl;
+
+    /* If the block is a direct block */
+    if (lblk < EXT2_NDIR_BLOCKS) {
+        return ino_st->i_block[lblk];
+    }
+    lblk -= EXT2_NDIR_BLOCKS;
+
+    /* Find the indirection level mapping the block */
+    for (lvl = 1; lvl < 4; lvl++) {
+        span *= apb;
+        if (lblk < span) {
+            break;
+        }
+        lblk -= span;
+    }
+
+    /* If the block is beyond the triple indirect block */
+    if (lvl == 4) {
+        return 0;
+    }
+
+    /* Descend from the root indirect block */
+    blk_addr = ino_st->i_block[EXT2_NDIR_BLOCKS + lvl - 1];
+    while (lvl && blk_addr) {
+        span /= apb;
+
+        /* Read the indirect block unless it is held already */
+        if (w->buf_blk[lvl] != blk_addr) {
+            _ext2_blk_read(blk_addr, w->buf[lvl], EXT2_CAT_IND);
+            w->buf_blk[lvl] = blk_addr;
+        }
+
+        /* Get the address of the next level */
+        blk_addr = ((_u32 *)w->buf[lvl])[lblk / span];
+        lblk %= span;
+        lvl--;
+    }
+
+    return blk_addr;
+}
+
+/**
+ * Directory iterator
+ */
+
+/* Directory entry yielded by the iterator */
+struct ext2_dirent {
+    _u64 ino;
+    _u8 type;
+    _u8 name_len;
+    /* Name (not NUL terminated), valid until the next read */
+    const _u8 *name;
+};
+
+/* Directory iterator */
+struct ext2_dir {
+    struct ext2_inode ino_st;
+    /* Number of blocks in the directory */
+    _u64 nb_blks;
+    /* Logical block and offset of the next entry */
+    _u64 lblk;
+    _u32 off;
+    /* Whether the walker data buffer holds the block #lblk */
+    _u8 blk_valid;
+    /* Walker state holding the current blocks */
+    struct ext2_walk w;
+};
+
+/* Resume cookie of a position in the directory */
+#define EXT2_DIR_COOKIE(lblk, off)   (((_u64)(lblk) << 32) | (off))
+#define EXT2_DIR_COOKIE_LBLK(cookie) ((cookie) >> 32)
+#define EXT2_DIR_COOKIE_OFF(cookie)  ((_u32)(cookie))
+
+/**
+ * @brief Opens the directory for iteration
+ * @param[in] ino Inode number of the directory
+ * @param[out] dir Directory iterator
+ * @return 0 on success, -1 if the inode is not a directory
+ */
+int ext2_opendir(_u64 ino, struct ext2_dir *dir) {
+
+    /* Get the inode structure */
+    _ext2_ino_to_ino_st(ino, &dir->ino_st);
+
+    /* Check if the inode is of type directory */
+    if (!EXT2_IS_INODE_DIR(&dir->ino_st)) {
+        return -1;
+    }
+
+    /* Start from the first entry */
+    dir->nb_blks = (EXT2_I_SIZE(&dir->ino_st) + EXT2_BLOCK_SIZE(&_sb) - 1)
+        / EXT2_BLOCK_SIZE(&_sb);
+    dir->lblk = 0;
+    dir->off = 0;
+    dir->blk_valid = 0;
+    memset(&dir->w, 0, sizeof(dir->w));
+    _ext2_walk_init(&dir->w);
+
+    return 0;
+}
+
+/**
+ * @brief Closes the directory iterator
+ * @param[in] dir Directory iterator
+ */
+void ext2_closedir(struct ext2_dir *dir) {
+
+    _ext2_walk_deinit(&dir->w);
+}
+
+/**
+ * @brief Loads the current block of the directory iterator
+ * @param[in] dir Directory iterator
+ * @return 1 if the block is loaded, 0 if it is a hole
+ */
+static int _ext2_dir_load(struct ext2_dir *dir) {
+
+    _u32 blk_addr;
+
+    /* If the block is loaded already */
+    if (dir->blk_valid) {
+        return 1;
+    }
+
+    /* Map the block */
+    blk_addr = _ext2_bmap(&dir->w, &dir->ino_st, dir->lblk);
+
+    /* If the block is a hole */
+    if (!blk_addr) {
+        return 0;
+    }
+
+    /* Read the cached block */
+    _ext2_blk_read(blk_addr, dir->w.buf[0], EXT2_CAT_DIR);
+    dir->blk_valid = 1;
+
+    return 1;
+}
+
+/**
+ * @brief Reads the next entry of the directory
+ * @param[in] dir Directory iterator
+ * @param[out] ent Directory entry
+ * @return 1 if an entry is read, 0 at the end of the directory
+ */
+int ext2_readdir(struct ext2_dir *dir, struct ext2_dirent *ent) {
+
+    struct ext2_dir_entry_2 *dir_ent;
+    _u32 bs = EXT2_BLOCK_SIZE(&_sb);
+
+    /* While there are blocks left */
+    while (dir->lblk < dir->nb_blks) {
+
+        /* If the block is loaded */
+        if (_ext2_dir_load(dir)) {
+
+            /* While there are entries left in the block */
+            while (dir->off < bs) {
+                dir_ent = (struct ext2_dir_entry_2 *)(dir->w.buf[0] + dir->off);
+
+                /* Skip the rest of the block on a corrupt record */
+                if (!_ext2_dir_rec_is_valid(dir->w.buf[0], dir->off)) {
+                    break;
+                }
+
+                /* Move past the entry */
+                dir->off += dir_ent->rec_len;
+
+                /* Return the entry if it is in use */
+                if (dir_ent->inode) {
+                    ent->ino = dir_ent->inode;
+                    ent->type = dir_ent->file_type;
+                    ent->name_len = dir_ent->name_len;
+                    ent->name = dir_ent->name;
+                    return 1;
+                }
+            }
+        }
+
+        /* Move to the next block */
+        dir->lblk++;
+        dir->off = 0;
+        dir->blk_valid = 0;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Returns the resume cookie of the next entry to be read
+ * @param[in] dir Directory iterator
+ * @return Resume cookie
+ */
+_u64 ext2_telldir(struct ext2_dir *dir) {
+
+    return EXT2_DIR_COOKIE(dir->lblk, dir->off);
+}
+
+/**
+ * @brief Moves the iterator to the position of the resume cookie
+ * @param[in] dir Directory iterator
+ * @param[in] cookie Resume cookie
+ * @note Only the block of the cookie is read, an offset which is not
+ *       at an entry is moved forward to the next entry of the block
+ */
+void ext2_seekdir(struct ext2_dir *dir, _u64 cookie) {
+
+    struct ext2_dir_entry_2 *dir_ent;
+    _u32 off = 0;
+
+    /* Move to the block of the cookie */
+    dir->lblk = EXT2_DIR_COOKIE_LBLK(cookie);
+    dir->off = EXT2_DIR_COOKIE_OFF(cookie);
+    dir->blk_valid = 0;
+
+    /* If the offset is not at the start of a block align it */
+    if (dir->off && (dir->lblk < dir->nb_blks) && _ext2_dir_load(dir)) {
+
+        /* Walk the records of the block up to the offset */
+        while (off < dir->off) {
+            dir_ent = (struct ext2_dir_entry_2 *)(dir->w.buf[0] + off);
+
+            /* Stop on a corrupt record */
+            if (!_ext2_dir_rec_is_valid(dir->w.buf[0], off)) {
+                off = EXT2_BLOCK_SIZE(&_sb);
+                break;
+            }
+            off += dir_ent->rec_len;
+        }
+        dir->off = off;
+    }
+}
+
+/**
+ * Parallel namespace walk
+ */
+
+/**
+ * @brief Returns the entry file type of the inode mode
+ * @param[in] mode Inode mode
+ * @return File type (one of EXT2_FT_*), EXT2_FT_UNKNOWN if none matches
+ */
+static _u8 _ext2_mode_to_ft(_u16 mode) {
+
+    _u8 ft;
+
+    for (ft = EXT2_FT_REG_FILE; ft < EXT2_FT_MAX; ft++) {
+        if (_ft_to_mode[ft] == (mode & 0xF000)) {
+            return ft;
+        }
+    }
+
+    return EXT2_FT_UNKNOWN;
+}
+
+/**
+ * @brief Visitor called by the workers for every entry of a directory but
+ *        the self and parent entries
+ * @param[in] ctx Visitor context
+ * @param[in] tid Index of the worker thread, below _nb_threads
+ * @param[in] dir_data Data of the directory holding the entry
+ * @param[in] ent Entry, its type resolved if the file system has none
+ * @return Data of the directory to be walked for a directory entry, NULL
+ *         to prune it (the directory and the tree under it are not walked),
+ *         ignored otherwise
+ * @note The entries out of the inode tables are not visited, nor a
+ *       directory already reached through another entry (a corrupt file
+ *       system may link an ancestor), so every directory is walked once
+ */
+typedef void *(*ext2_pwalk_visit_t)(void *ctx, _u32 tid, void *dir_data,
+                                    struct ext2_dirent *ent);
+
+/**
+ * @brief Visitor called by the worker once the entries of a directory are
+ *        all visited (its sub directories may still be walked)
+ * @param[in] ctx Visitor context
+ * @param[in] tid Index of the worker thread
+ * @param[in] dir_data Data of the directory
+ */
+typedef void (*ext2_pwalk_done_t)(void *ctx, _u32 tid, void *dir_data);
+
+/* Number of worker threads of the parallel requests */
+static _u32 _nb_threads = 1;
+
+/* Directory waiting to be walked */
+struct ext2_pwalk_dir {
+    _u64 ino;
+    void *data;
+};
+
+/* Parallel namespace walk, the workers share a stack of directories */
+struct ext2_pwalk {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct ext2_pwalk_dir *dirs;
+    _u64 nb_dirs;
+    _u64 max_dirs;
+    /* Number of workers walking a directory */
+    _u32 nb_busy;
+    /* Bitmap of the directory inodes reached */
+    _u8 *seen;
+    ext2_pwalk_visit_t visit;
+    ext2_pwalk_done_t done;
+    void *ctx;
+};
+
+/* Worker argument */
+struct ext2_pwalk_arg {
+    struct ext2_pwalk *pw;
+    _u32 tid;
+};
+
+/**
+ * @brief Pushes the directory on the stack, the lock held
+ * @param[in] pw Parallel walk
+ * @param[in] ino Inode number of the directory
+ * @param[in] data Data of the directory
+ */
+static void _ext2_pwalk_push(struct ext2_pwalk *pw, _u64 ino, void *data) {
+
+    /* Grow the stack if full */
+    if (pw->nb_dirs == pw->max_dirs) {
+        pw->max_dirs = pw->max_dirs ? 2 * pw->max_dirs : 1024;
+        pw->dirs = realloc(pw->dirs, pw->max_dirs * sizeof(*pw->dirs));
+
+        /* Check for failure */
+        if (!pw->dirs) {
+            /* Exit with failure */
+            exit_err("Failed to allocate the walk stack\n");
+        }
+    }
+
+    pw->dirs[pw->nb_dirs].ino = ino;
+    pw->dirs[pw->nb_dirs].data = data;
+    pw->nb_dirs++;
+}
+
+/**
+ * @brief Walks the entries of the directory
+ * @param[in] pw Parallel walk
+ * @param[in] tid Index of the worker thread
+ * @param[in] dir_ent Directory
+ */
+static void _ext2_pwalk_dir(struct ext2_pwalk *pw, _u32 tid,
+                            struct ext2_pwalk_dir *dir_ent) {
+
+    struct ext2_dir dir;
+    struct ext2_dirent ent;
+    struct ext2_inode ino_st;
+    void *data;
+    _u8 bit;
+
+    /* Open the directory */
+    if (ext2_opendir(dir_ent->ino, &dir)) {
+        return;
+    }
+
+    /* For each entry */
+    while (ext2_readdir(&dir, &ent)) {
+
+        /* Skip the self and parent entries */
+        if ((ent.name[0] == '.') && ((ent.name_len == 1) ||
+            ((ent.name_len == 2) && (ent.name[1] == '.')))) {
+            continue;
+        }
+
+        /* Skip the entries out of the inode tables */
+        if (!ent.ino || (ent.ino > _sb.s_inodes_count)) {
+            continue;
+        }
+
+        /* Get the type from the inode if the entry has none */
+        if (ent.type == EXT2_FT_UNKNOWN) {
+            _ext2_ino_to_ino_st(ent.ino, &ino_st);
+            ent.type = _ext2_mode_to_ft(ino_st.i_mode);
+        }
+
+        /* Skip a directory already reached, the walk would loop */
+        bit = 1u << (ent.ino & 7);
+        if ((ent.type == EXT2_FT_DIR) &&
+            (__atomic_fetch_or(&pw->seen[ent.ino >> 3], bit, __ATOMIC_RELAXED)
+             & bit)) {
+            continue;
+        }
+
+        /* Visit the entry */
+        data = pw->visit(pw->ctx, tid, dir_ent->data, &ent);
+
+        /* Queue the sub directories not pruned */
+        if ((ent.type == EXT2_FT_DIR) && data) {
+            pthread_mutex_lock(&pw->lock);
+            _ext2_pwalk_push(pw, ent.ino, data);
+            pthread_cond_signal(&pw->cond);
+            pthread_mutex_unlock(&pw->lock);
+        }
+    }
+
+    /* Close the directory */
+    ext2_closedir(&dir);
+
+    /* The entries are all visited */
+    if (pw->done) {
+        pw->done(pw->ctx, tid, dir_ent->data);
+    }
+}
+
+/**
+ * @brief Worker thread, walks directories until none is left and every
+ *        worker is idle
+ * @param[in] arg Worker argument
+ */
+static void *_ext2_pwalk_worker(void *arg) {
+
+    struct ext2_pwalk_arg *wa = arg;
+    struct ext2_pwalk *pw = wa->pw;
+    struct ext2_pwalk_dir dir_ent;
+
+    pthread_mutex_lock(&pw->lock);
+    while (1) {
+        /* Wait for a directory while some worker may still queue one */
+        while (!pw->nb_dirs && pw->nb_busy) {
+            pthread_cond_wait(&pw->cond, &pw->lock);
+        }
+
+        /* If the walk is over wake the other workers up and leave */
+        if (!pw->nb_dirs) {
+            pthread_cond_broadcast(&pw->cond);
+            break;
+        }
+
+        /* Pop a directory and walk it */
+        dir_ent = pw->dirs[--pw->nb_dirs];
+        pw->nb_busy++;
+        pthread_mutex_unlock(&pw->lock);
+
+        _ext2_pwalk_dir(pw, wa->tid, &dir_ent);
+
+        pthread_mutex_lock(&pw->lock);
+        pw->nb_busy--;
+    }
+    pthread_mutex_unlock(&pw->lock);
+
+    return NULL;
+}
+
+/**
+ * @brief Walks the directory tree with _nb_threads workers
+ * @param[in] ino Inode number of the root directory of the walk
+ * @param[in] data Data of the root directory
+ * @param[in] visit Entry visitor
+ * @param[in] done Directory visitor, NULL if none
+ * @param[in] ctx Visitor context
+ * @note The calling thread is worker 0. The directories are taken from a
+ *       shared stack, so the walk goes deep first and the order in which
+ *       the entries are visited is not defined
+ */
+void ext2_pwalk(_u64 ino, void *data, ext2_pwalk_visit_t visit,
+                ext2_pwalk_done_t done, void *ctx) {
+
+    struct ext2_pwalk pw = {0};
+    struct ext2_pwalk_arg args[MAX_THREADS];
+    pthread_t threads[MAX_THREADS];
+    _u32 i;
+
+    /* Queue the root directory */
+    pthread_mutex_init(&pw.lock, NULL);
+    pthread_cond_init(&pw.cond, NULL);
+    pw.visit = visit;
+    pw.done = done;
+    pw.ctx = ctx;
+    pw.seen = calloc(_sb.s_inodes_count / 8 + 1, 1);
+
+    /* Check for failure */
+    if (!pw.seen) {
+        /* Exit with failure */
+        exit_err("Failed to allocate the walk bitmap\n");
+    }
+
+    /* The root directory is reached first */
+    if (ino <= _sb.s_inodes_count) {
+        pw.seen[ino >> 3] |= 1u << (ino & 7);
+    }
+    _ext2_pwalk_push(&pw, ino, data);
+
+    /* Start the workers */
+    for (i = 0; i < _nb_threads; i++) {
+        args[i].pw = &pw;
+        args[i].tid = i;
+        if (i && pthread_create(&threads[i], NULL, _ext2_pwalk_worker,
+                                &args[i])) {
+            /* Exit with failure */
+            exit_err("Failed to start the worker threads\n");
+        }
+    }
+
+    /* Work along and wait for the others */
+    _ext2_pwalk_worker(&args[0]);
+    for (i = 1; i < _nb_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    /* Free the walk */
+    free(pw.dirs);
+    free(pw.seen);
+    pthread_mutex_destroy(&pw.lock);
+    pthread_cond_destroy(&pw.cond);
+}
+
+/**
+ * Parallel loop
+ */
+
+/* Iterations claimed at once by a worker of the parallel loop, for the
+ * short bodies (a body taking a whole file claims one at a time) */
+#define PFOR_GRAIN  (64u)
+
+/**
+ * @brief Body of the parallel loop
+ * @param[in] ctx Loop context
+ * @param[in] tid Index of the worker thread
+ * @param[in] idx Index of the iteration
+ */
+typedef void (*ext2_pfor_body_t)(void *ctx, _u32 tid, _u64 idx);
+
+/* Parallel loop, the workers claim the iterations from a shared counter */
+struct ext2_pfor {
+    _u64 nxt;
+    _u64 nb;
+    _u64 grain;
+    ext2_pfor_body_t body;
+    void *ctx;
+};
+
+/* Worker argument */
+struct ext2_pfor_arg {
+    struct ext2_pfor *pf;
+    _u32 tid;
+};
+
+/**
+ * @brief Worker thread, runs iterations until none is left
+ * @param[in] arg Worker argument
+ */
+static void *_ext2_pfor_worker(void *arg) {
+
+    struct ext2_pfor_arg *fa = arg;
+    struct ext2_pfor *pf = fa->pf;
+    _u64 idx;
+    _u64 end;
+
+    /* While there are iterations left claim the next ones */
+    while ((idx = ATOMIC_ADD(pf->nxt, pf->grain)) < pf->nb) {
+        end = (idx + pf->grain < pf->nb) ? idx + pf->grain : pf->nb;
+        for (; idx < end; idx++) {
+            pf->body(pf->ctx, fa->tid, idx);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Runs the iterations 0 to nb - 1 of the body with _nb_threads
+ *        workers
+ * @param[in] nb Number of iterations
+ * @param[in] grain Number of iterations claimed at once, at least 1
+ * @param[in] body Loop body
+ * @param[in] ctx Loop context
+ * @note The calling thread is worker 0, the order of the iterations is
+ *       not defined
+ */
+void ext2_pfor(_u64 nb, _u64 grain, ext2_pfor_body_t body, void *ctx) {
+
+    struct ext2_pfor pf = {0, nb, grain, body, ctx};
+    struct ext2_pfor_arg args[MAX_THREADS];
+    pthread_t threads[MAX_THREADS];
+    _u64 nb_grains = (nb + grain - 1) / grain;
+    _u32 nb_workers;
+    _u32 i;
+
+    /* No more workers than grains of work */
+    nb_workers = (nb_grains < _nb_threads) ? nb_grains : _nb_threads;
+
+    /* Start the workers */
+    for (i = 0; i < nb_workers; i++) {
+        args[i].pf = &pf;
+        args[i].tid = i;
+        if (i && pthread_create(&threads[i], NULL, _ext2_pfor_worker,
+                                &args[i])) {
+            /* Exit with failure */
+            exit_err("Failed to start the worker threads\n");
+        }
+    }
+
+    /* Work along and wait for the others */
+    if (nb_workers) {
+        _ext2_pfor_worker(&args[0]);
+    }
+    for (i = 1; i < nb_workers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+/**
+ * Parallel inode scan
+ */
+
+/* Inodes read by the scan before they are handed to the workers */
+#define PSCAN_CHUNK_INOS  (64u * 1024u)
+
+/**
+ * @brief Body of the parallel scan, called by a worker for an inode
+ * @param[in] ctx Scan context
+ * @param[in] tid Index of the worker thread
+ * @param[in] idx Index of the inode in its chunk
+ * @param[in] ino Inode number
+ * @param[in] ino_st Inode structure
+ */
+typedef void (*ext2_pscan_body_t)(void *ctx, _u32 tid, _u64 idx, _u32 ino,
+                                  struct ext2_inode *ino_st);
+
+/**
+ * @brief Called by the calling thread once every inode of a chunk is done
+ * @param[in] ctx Scan context
+ * @param[in] inos Inode numbers of the chunk, in the scan order
+ * @param[in] nb Number of inodes in the chunk
+ */
+typedef void (*ext2_pscan_done_t)(void *ctx, _u32 *inos, _u64 nb);
+
+/* Parallel scan state */
+struct ext2_pscan {
+    /* Chunk of inodes waiting for the workers */
+    _u32 *inos;
+    struct ext2_inode *ino_sts;
+    _u32 nb_inos;
+    ext2_pscan_body_t body;
+    ext2_pscan_done_t done;
+    void *ctx;
+};
+
+/**
+ * @brief Parallel loop body handing an inode of the chunk to the scan body
+ */
+static void _ext2_pscan_body(void *ctx, _u32 tid, _u64 idx) {
+
+    struct ext2_pscan *ps = ctx;
+
+    ps->body(ps->ctx, tid, idx, ps->inos[idx], &ps->ino_sts[idx]);
+}
+
+/**
+ * @brief Runs the workers over the chunk and empties it
+ * @param[in] ps Parallel scan
+ */
+static void _ext2_pscan_flush(struct ext2_pscan *ps) {
+
+    ext2_pfor(ps->nb_inos, PFOR_GRAIN, _ext2_pscan_body, ps);
+    if (ps->done && ps->nb_inos) {
+        ps->done(ps->ctx, ps->inos, ps->nb_inos);
+    }
+    ps->nb_inos = 0;
+}
+
+/**
+ * @brief Scan visitor queuing the inode, flushing the chunk once full
+ */
+static void _ext2_pscan_visit(void *ctx, _u64 ino, struct ext2_inode *ino_st) {
+
+    struct ext2_pscan *ps = ctx;
+
+    /* Queue the inode */
+    ps->inos[ps->nb_inos] = ino;
+    memcpy(&ps->ino_sts[ps->nb_inos], ino_st, sizeof(*ino_st));
+
+    /* If the chunk is full hand it to the workers */
+    if (++ps->nb_inos == PSCAN_CHUNK_INOS) {
+        _ext2_pscan_flush(ps);
+    }
+}
+
+/**
+ * @brief Hands every inode in use to the body with _nb_threads workers
+ * @param[in] reserved Whether the reserved inodes are handed too
+ * @param[in] body Inode body
+ * @param[in] done Chunk visitor, NULL if none
+ * @param[in] ctx Scan context
+ * @note The inode tables are read by the bitmap guided scan on the calling
+ *       thread a chunk at a time and every chunk is worked on by a parallel
+ *       loop, the reserved inodes first if asked for
+ */
+void ext2_pscan(_u8 reserved, ext2_pscan_body_t body, ext2_pscan_done_t done,
+                void *ctx) {
+
+    struct ext2_pscan ps = {0};
+    struct ext2_inode ino_st;
+    _u32 ino;
+
+    /* Allocate the chunk */
+    ps.inos = malloc(PSCAN_CHUNK_INOS * sizeof(*ps.inos));
+    ps.ino_sts = malloc(PSCAN_CHUNK_INOS * sizeof(*ps.ino_sts));
+
+    /* Check for failure */
+    if (!ps.inos || !ps.ino_sts) {
+        /* Exit with failure */
+        exit_err("Failed to allocate the scan chunk\n");
+    }
+    ps.body = body;
+    ps.done = done;
+    ps.ctx = ctx;
+
+    /* Queue the reserved inodes the scan skips */
+    for (ino = 1; reserved && (ino < EXT2_FIRST_INO(&_sb)); ino++) {
+        if (ino != EXT2_ROOT_INO) {
+            _ext2_ino_to_ino_st(ino, &ino_st);
+            _ext2_pscan_visit(&ps, ino, &ino_st);
+        }
+    }
+
+    /* Scan the inodes in use, the last chunk included */
+    ext2_scan(_ext2_pscan_visit, &ps);
+    _ext2_pscan_flush(&ps);
+
+    /* Free the chunk */
+    free(ps.inos);
+    free(ps.ino_sts);
+}
+
+/**
+ * Sidecar files
+ */
+
+/* Identity of the state of the file system a sidecar file was built for */
+struct ext2_fs_id {
+    _u8 uuid[16];
+    _u32 mtime;
+    _u32 wtime;
+};
+
+/**
+ * @brief Gets the identity of the current state of the file system
+ * @param[out] id Identity
+ */
+static void _ext2_fs_id(struct ext2_fs_id *id) {
+
+    memcpy(id->uuid, _sb.s_uuid, sizeof(id->uuid));
+    id->mtime = _sb.s_mtime;
+    id->wtime = _sb.s_wtime;
+}
+
+/**
+ * @brief Checks if the identity is the one of the current state of the
+ *        file system
+ * @param[in] id Identity
+ * @return Non zero if it is
+ */
+static int _ext2_fs_id_is_cur(const struct ext2_fs_id *id) {
+
+    struct ext2_fs_id cur;
+
+    _ext2_fs_id(&cur);
+
+    return !memcmp(id, &cur, sizeof(cur));
+}
+
+/**
+ * @brief Returns the default path of a sidecar file, the device path
+ *        followed by the suffix
+ * @param[out] path Path buffer of MAX_PATH_LEN bytes
+ * @param[in] suffix Suffix
+ */
+static void _ext2_sidecar_path(char path[MAX_PATH_LEN], const char *suffix) {
+
+    snprintf(path, MAX_PATH_LEN, "%s%s", _dev_path, suffix);
+}
+
+/**
+ * @brief Writes the bytes to the file, replacing it
+ * @param[in] path Path of the file
+ * @param[in] data Bytes
+ * @param[in] len Number of bytes
+ * @return 0 on success, -1 otherwise
+ */
+static int _ext2_file_write(const char *path, const void *data, _u64 len) {
+
+    _u64 off = 0;
+    ssize_t ret;
+    int fd;
+
+    /* Create the file */
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        return -1;
+    }
+
+    /* Write all the bytes */
+    while (off < len) {
+        ret = write(fd, (const _u8 *)data + off, len - off);
+        if ((ret == -1) && (errno == EINTR)) {
+            continue;
+        }
+        if (ret <= 0) {
+            close(fd);
+            unlink(path);
+            return -1;
+        }
+        off += ret;
+    }
+
+    return close(fd);
+}
+
+/**
+ * @brief Maps the file read only
+ * @param[in] path Path of the file
+ * @param[in] min_len Minimum length of the file
+ * @param[out] len Length of the file
+ * @return Mapping, NULL if the file cannot be mapped or is too short
+ */
+static void *_ext2_file_map(const char *path, _u64 min_len, _u64 *len) {
+
+    struct stat st;
+    void *map;
+    int fd;
+
+    /* Open the file and check its length */
+    fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+    if (fstat(fd, &st) || (st.st_size < min_len)) {
+        close(fd);
+        return NULL;
+    }
+
+    /* Map it */
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    *len = st.st_size;
+
+    return map;
+}
+
+/**
+ * Reverse path index
+ */
+
+/* Reverse path index file magic */
+#define RINDEX_MAGIC    "E2RI"
+/* Reverse path index file version */
+#define RINDEX_VERSION  (1)
+
+/* Reverse path index header, followed by the offsets of the names of
+ * every inode number (nb_inos + 2 of them, the names of the inode i are
+ * the bytes offs[i] to offs[i + 1] of the names) and the names, each a
+ * 32 bit parent inode number, a length byte and the name */
+struct ext2_rindex_hdr {
+    char magic[4];
+    _u32 version;
+    /* Identity of the file system indexed */
+    struct ext2_fs_id id;
+    _u32 nb_inos;
+    _u32 reserved;
+    _u64 nb_names;
+    _u64 names_len;
+};
+
+/* Reverse path index */
+struct ext2_rindex {
+    struct ext2_rindex_hdr *hdr;
+    _u64 *offs;
+    _u8 *names;
+    /* Whether the index is mapped from its file */
+    _u8 mapped;
+    _u64 len;
+};
+
+/* Names found by a worker of the index build */
+struct ext2_rindex_buf {
+    /* Records of an inode number followed by its name record */
+    _u8 *recs;
+    _u64 len;
+    _u64 max_len;
+};
+
+/**
+ * @brief Parallel walk visitor recording the name of the entry
+ */
+static void *_ext2_rindex_visit(void *ctx, _u32 tid, void *dir_data,
+                                struct ext2_dirent *ent) {
+
+    struct ext2_rindex_buf *buf = (struct ext2_rindex_buf *)ctx + tid;
+    _u32 parent = (_u32)(uintptr_t)dir_data;
+    _u32 ino = ent->ino;
+    _u8 *rec;
+
+    /* Grow the records if full */
+    if (buf->len + 9 + ent->name_len > buf->max_len) {
+        buf->max_len = 2 * buf->max_len + 4096;
+        buf->recs = realloc(buf->recs, buf->max_len);
+
+        /* Check for failure */
+        if (!buf->recs) {
+            /* Exit with failure */
+            exit_err("Failed to allocate the index\n");
+        }
+    }
+
+    /* Record the inode number, the parent and the name */
+    rec = buf->recs + buf->len;
+    memcpy(rec, &ino, 4);
+    memcpy(rec + 4, &parent, 4);
+    rec[8] = ent->name_len;
+    memcpy(rec + 9, ent->name, ent->name_len);
+    buf->len += 9 + ent->name_len;
+
+    /* The directories pass their number down */
+    return (void *)(uintptr_t)ino;
+}
+
+/**
+ * @brief Builds the reverse path index of the whole file system
+ * @param[out] ri Index
+ * @note The names are gathered by a parallel walk, one record buffer per
+ *       worker, then grouped by inode number with a counting sort
+ */
+void ext2_rindex_build(struct ext2_rindex *ri) {
+
+    struct ext2_rindex_buf bufs[MAX_THREADS] = {0};
+    _u32 nb_inos = _sb.s_inodes_count;
+    _u64 *pos;
+    _u8 *rec;
+    _u8 *end;
+    _u64 names_len = 0;
+    _u64 nb_names = 0;
+    _u32 ino;
+    _u32 i;
+
+    /* Gather the names */
+    ext2_pwalk(EXT2_ROOT_INO, (void *)(uintptr_t)EXT2_ROOT_INO,
+               _ext2_rindex_visit, NULL, bufs);
+
+    /* Lay the index out in one buffer */
+    for (i = 0; i < _nb_threads; i++) {
+        for (rec = bufs[i].recs, end = rec + bufs[i].len; rec < end;
+             rec += 9 + rec[8]) {
+            names_len += 5 + rec[8];
+            nb_names++;
+        }
+    }
+    ri->len = sizeof(*ri->hdr) + ((_u64)nb_inos + 2) * sizeof(_u64)
+        + names_len;
+    ri->hdr = calloc(1, ri->len);
+    pos = calloc((_u64)nb_inos + 2, sizeof(_u64));
+
+    /* Check for failure */
+    if (!ri->hdr || !pos) {
+        /* Exit with failure */
+        exit_err("Failed to allocate the index\n");
+    }
+    ri->offs = (_u64 *)(ri->hdr + 1);
+    ri->names = (_u8 *)(ri->offs + nb_inos + 2);
+    ri->mapped = 0;
+
+    /* Fill the header */
+    memcpy(ri->hdr->magic, RINDEX_MAGIC, 4);
+    ri->hdr->version = RINDEX_VERSION;
+    _ext2_fs_id(&ri->hdr->id);
+    ri->hdr->nb_inos = nb_inos;
+    ri->hdr->nb_names = nb_names;
+    ri->hdr->names_len = names_len;
+
+    /* Count the bytes of the names of every inode */
+    for (i = 0; i < _nb_threads; i++) {
+        for (rec = bufs[i].recs, end = rec + bufs[i].len; rec < end;
+             rec += 9 + rec[8]) {
+            memcpy(&ino, rec, 4);
+            if (ino <= nb_inos) {
+                ri->offs[ino + 1] += 5 + rec[8];
+            }
+        }
+    }
+
+    /* Turn the counts into offsets */
+    for (ino = 1; ino < nb_inos + 2; ino++) {
+        ri->offs[ino] += ri->offs[ino - 1];
+    }
+    memcpy(pos, ri->offs, ((_u64)nb_inos + 2) * sizeof(_u64));
+
+    /* Place the names */
+    for (i = 0; i < _nb_threads; i++) {
+        for (rec = bufs[i].recs, end = rec + bufs[i].len; rec < end;
+             rec += 9 + rec[8]) {
+            memcpy(&ino, rec, 4);
+            if (ino <= nb_inos) {
+                memcpy(ri->names + pos[ino], rec + 4, 5 + rec[8]);
+                pos[ino] += 5 + rec[8];
+            }
+        }
+        free(bufs[i].recs);
+    }
+    free(pos);
+}
+
+/**
+ * @brief Writes the reverse path index to its file
+ * @param[in] ri Index
+ * @param[in] path Path of the file
+ * @return 0 on success, -1 otherwise
+ */
+int ext2_rindex_write(struct ext2_rindex *ri, const char *path) {
+
+    return _ext2_file_write(path, ri->hdr, ri->len);
+}
+
+/**
+ * @brief Maps the reverse path index from its file
+ * @param[out] ri Index
+ * @param[in] path Path of the file
+ * @return 0 on success, -1 if there is no index of the file system as it
+ *         is now
+ */
+int ext2_rindex_map(struct ext2_rindex *ri, const char *path) {
+
+    struct ext2_rindex_hdr *hdr;
+    _u64 len;
+
+    /* Map the file */
+    hdr = _ext2_file_map(path, sizeof(*hdr), &len);
+    if (!hdr) {
+        return -1;
+    }
+
+    /* Check that it indexes the file system as it is now */
+    if (memcmp(hdr->magic, RINDEX_MAGIC, 4) ||
+        (hdr->version != RINDEX_VERSION) || !_ext2_fs_id_is_cur(&hdr->id) ||
+        (hdr->nb_inos != _sb.s_inodes_count) ||
+        (sizeof(*hdr) + ((_u64)hdr->nb_inos + 2) * sizeof(_u64)
+         + hdr->names_len != len)) {
+        munmap(hdr, len);
+        return -1;
+    }
+
+    ri->hdr = hdr;
+    ri->offs = (_u64 *)(hdr + 1);
+    ri->names = (_u8 *)(ri->offs + hdr->nb_inos + 2);
+    ri->mapped = 1;
+    ri->len = len;
+
+    return 0;
+}
+
+/**
+ * @brief Frees the reverse path index
+ * @param[in] ri Index
+ */
+void ext2_rindex_free(struct ext2_rindex *ri) {
+
+    /* Unmap or free the index */
+    if (ri->mapped) {
+        munmap(ri->hdr, ri->len);
+    }
+    else {
+        free(ri->hdr);
+    }
+    memset(ri, 0, sizeof(*ri));
+}
+
+/**
+ * @brief Builds the path of a name of the inode out of the index
+ * @param[in] ri Index
+ * @param[in] rec Name record of the inode
+ * @param[out] path Path buffer of MAX_PATH_LEN bytes
+ * @return Length of the path, 0 if the path is broken or too long
+ * @note The path is built from its end, chasing the first name of every
+ *       parent up to the root directory
+ */
+static _u32 _ext2_rindex_path(struct ext2_rindex *ri, const _u8 *rec,
+                              _u8 path[MAX_PATH_LEN]) {
+
+    _u32 pos = MAX_PATH_LEN;
+    _u32 parent;
+    _u32 depth;
+
+    /* Prepend the names up to the root directory */
+    for (depth = 0; depth < MAX_PATH_LEN / 2; depth++) {
+        if (pos < 1 + rec[4]) {
+            return 0;
+        }
+        pos -= rec[4];
+        memcpy(path + pos, rec + 5, rec[4]);
+        path[--pos] = '/';
+
+        /* Go up to the parent */
+        memcpy(&parent, rec, 4);
+        if (parent == EXT2_ROOT_INO) {
+            break;
+        }
+        if ((parent > ri->hdr->nb_inos) ||
+            (ri->offs[parent] == ri->offs[parent + 1])) {
+            return 0;
+        }
+        rec = ri->names + ri->offs[parent];
+    }
+
+    /* Move the path to the start of the buffer */
+    memmove(path, path + pos, MAX_PATH_LEN - pos);
+
+    return MAX_PATH_LEN - pos;
+}
+/**
+ * @brief Builds the path of the first name of the inode out of the index
+ * @param[in] ri Index
+ * @param[in] ino Inode number
+ * @param[out] path Path buffer of MAX_PATH_LEN bytes
+ * @return Length of the path, 0 if the inode has no name
+ */
+static _u32 _ext2_rindex_ino_path(struct ext2_rindex *ri, _u32 ino,
+                                  _u8 path[MAX_PATH_LEN]) {
+
+    /* The root directory has no name */
+    if (ino == EXT2_ROOT_INO) {
+        path[0] = '/';
+        return 1;
+    }
+
+    /* Check that the inode has a name */
+    if (!ino || (ino > ri->hdr->nb_inos) ||
+        (ri->offs[ino] == ri->offs[ino + 1])) {
+        return 0;
+    }
+
+    return _ext2_rindex_path(ri, ri->names + ri->offs[ino], path);
+}
+
+
+/**
+ * Reverse block map
+ */
+
+/* Reverse block map file magic */
+#define RBMAP_MAGIC       "E2RB"
+/* Reverse block map file version */
+#define RBMAP_VERSION     (1)
+/* Bits of the length of an extent, the kind takes the bits above */
+#define RBMAP_LEN_BITS    (28u)
+/* Longest extent */
+#define RBMAP_LEN_MAX     ((1u << RBMAP_LEN_BITS) - 1)
+/* Extent kind - Data blocks */
+#define RBMAP_KIND_DATA   (0)
+/* Extent kind - Indirect block of the level (1 to 3) */
+#define RBMAP_KIND_IND    (1)
+/* Extent kind - Extended attribute block */
+#define RBMAP_KIND_XATTR  (4)
+
+/* Length and kind of an extent */
+#define RBMAP_EXT_LEN(ext)   ((ext)->len_kind & RBMAP_LEN_MAX)
+#define RBMAP_EXT_KIND(ext)  ((ext)->len_kind >> RBMAP_LEN_BITS)
+
+/* Extent kind names */
+static const char *_rbmap_kind_to_str[] = {"data", "ind", "dind", "tind",
+                                           "xattr"};
+
+/* Physical blocks owned by an inode, a run of data blocks contiguous both
+ * physically and logically or a single metadata block */
+struct ext2_rbmap_ext {
+    _u32 pblk;
+    _u32 len_kind;
+    _u32 ino;
+    /* First logical block mapped, zero for an extended attribute block */
+    _u32 lblk;
+};
+
+/* Reverse block map header, followed by the extents sorted by physical
+ * block */
+struct ext2_rbmap_hdr {
+    char magic[4];
+    _u32 version;
+    /* Identity of the file system mapped */
+    struct ext2_fs_id id;
+    _u32 nb_blks;
+    _u32 reserved;
+    _u64 nb_exts;
+};
+
+/* Reverse block map */
+struct ext2_rbmap {
+    struct ext2_rbmap_hdr *hdr;
+    struct ext2_rbmap_ext *exts;
+    /* Whether the map is mapped from its file */
+    _u8 mapped;
+    _u64 len;
+};
+
+/* Extents found by a worker of the map build */
+struct ext2_rbmap_buf {
+    struct ext2_rbmap_ext *exts;
+    _u64 nb_exts;
+    _u64 max_exts;
+    /* Walker state of the worker and inode being walked */
+    struct ext2_walk w;
+    _u32 ino;
+};
+
+/**
+ * @brief Adds the blocks to the extents of the worker, extending the last
+ *        extent if they continue it
+ * @param[in] buf Extents of the worker
+ * @param[in] pblk First physical block
+ * @param[in] lblk First logical block
+ * @param[in] kind Extent kind
+ */
+static void _ext2_rbmap_add(struct ext2_rbmap_buf *buf, _u32 pblk,
+                            _u32 lblk, _u32 kind) {
+
+    struct ext2_rbmap_ext *ext;
+
+    /* If the data block continues the last extent extend it */
+    if (buf->nb_exts && (kind == RBMAP_KIND_DATA)) {
+        ext = &buf->exts[buf->nb_exts - 1];
+        if ((ext->ino == buf->ino) && (RBMAP_EXT_KIND(ext) == kind) &&
+            (RBMAP_EXT_LEN(ext) < RBMAP_LEN_MAX) &&
+            (ext->pblk + RBMAP_EXT_LEN(ext) == pblk) &&
+            (ext->lblk + RBMAP_EXT_LEN(ext) == lblk)) {
+            ext->len_kind++;
+            return;
+        }
+    }
+
+    /* Grow the extents if full */
+    if (buf->nb_exts == buf->max_exts) {
+        buf->max_exts = buf->max_exts ? 2 * buf->max_exts : 4096;
+        buf->exts = realloc(buf->exts, buf->max_exts * sizeof(*buf->exts));
+
+        /* Check for failure */
+        if (!buf->exts) {
+            /* Exit with failure */
+            exit_err("Failed to allocate the block map\n");
+        }
+    }
+
+    /* Start a new extent */
+    ext = &buf->exts[buf->nb_exts++];
+    ext->pblk = pblk;
+    ext->len_kind = (kind << RBMAP_LEN_BITS) | 1;
+    ext->ino = buf->ino;
+    ext->lblk = lblk;
+}
+
+/**
+ * @brief Walker visitor recording the block
+ */
+static int _ext2_rbmap_visit(struct ext2_walk *w, void *ctx, _u64 lblk,
+                             _u32 pblk, _u8 level) {
+
+    _ext2_rbmap_add(ctx, pblk, lblk, level ? RBMAP_KIND_IND + level - 1
+                                           : RBMAP_KIND_DATA);
+
+    return EXT2_WALK_CONT;
+}
+
+/**
+ * @brief Parallel scan body walking the block tree of the inode
+ */
+static void _ext2_rbmap_ino(void *ctx, _u32 tid, _u64 idx, _u32 ino,
+                            struct ext2_inode *ino_st) {
+
+    struct ext2_rbmap_buf *buf = (struct ext2_rbmap_buf *)ctx + tid;
+
+    buf->ino = ino;
+
+    /* Walk the block tree if the inode has one */
+    if (_ext2_ino_has_tree(ino_st)) {
+        _ext2_walk_init(&buf->w);
+        _ext2_walk(&buf->w, ino_st, 0, _ext2_rbmap_visit, buf);
+    }
+
+    /* Add the extended attribute block */
+    if (ino_st->i_file_acl) {
+        _ext2_rbmap_add(buf, ino_st->i_file_acl, 0, RBMAP_KIND_XATTR);
+    }
+}
+
+/**
+ * @brief Orders the extents by physical block, then inode and logical
+ *        block so that the map does not depend on the worker count
+ */
+static int _ext2_rbmap_ext_cmp(const void *a, const void *b) {
+
+    const struct ext2_rbmap_ext *ea = a;
+    const struct ext2_rbmap_ext *eb = b;
+
+    if (ea->pblk != eb->pblk) {
+        return (ea->pblk < eb->pblk) ? -1 : 1;
+    }
+    if (ea->ino != eb->ino) {
+        return (ea->ino < eb->ino) ? -1 : 1;
+    }
+
+    return (ea->lblk < eb->lblk) ? -1 : (ea->lblk > eb->lblk);
+}
+
+/**
+ * @brief Builds the reverse block map of the whole file system
+ * @param[out] rb Map
+ * @note The block trees of the inodes in use, the reserved ones included,
+ *       are walked by a parallel scan, every indirect block is recorded along
+ *       with the data blocks. The extents of the workers are then joined
+ *       and sorted.
+ */
+void ext2_rbmap_build(struct ext2_rbmap *rb) {
+
+    struct ext2_rbmap_buf bufs[MAX_THREADS] = {0};
+    _u64 nb_exts = 0;
+    _u32 i;
+
+    /* Walk the inodes, the reserved ones included */
+    ext2_pscan(1, _ext2_rbmap_ino, NULL, bufs);
+
+    /* Lay the map out in one buffer */
+    for (i = 0; i < _nb_threads; i++) {
+        nb_exts += bufs[i].nb_exts;
+    }
+    rb->len = sizeof(*rb->hdr) + nb_exts * sizeof(*rb->exts);
+    rb->hdr = calloc(1, rb->len);
+
+    /* Check for failure */
+    if (!rb->hdr) {
+        /* Exit with failure */
+        exit_err("Failed to allocate the block map\n");
+    }
+    rb->exts = (struct ext2_rbmap_ext *)(rb->hdr + 1);
+    rb->mapped = 0;
+
+    /* Fill the header */
+    memcpy(rb->hdr->magic, RBMAP_MAGIC, 4);
+    rb->hdr->version = RBMAP_VERSION;
+    _ext2_fs_id(&rb->hdr->id);
+    rb->hdr->nb_blks = _sb.s_blocks_count;
+    rb->hdr->nb_exts = nb_exts;
+
+    /* Join the extents of the workers */
+    nb_exts = 0;
+    for (i = 0; i < _nb_threads; i++) {
+        if (bufs[i].nb_exts) {
+            memcpy(rb->exts + nb_exts, bufs[i].exts,
+                   bufs[i].nb_exts * sizeof(*rb->exts));
+            nb_exts += bufs[i].nb_exts;
+        }
+        free(bufs[i].exts);
+        _ext2_walk_deinit(&bufs[i].w);
+    }
+
+    /* Sort them */
+    qsort(rb->exts, nb_exts, sizeof(*rb->exts), _ext2_rbmap_ext_cmp);
+}
+
+/**
+ * @brief Writes the reverse block map to its file
+ * @param[in] rb Map
+ * @param[in] path Path of the file
+ * @return 0 on success, -1 otherwise
+ */
+int ext2_rbmap_write(struct ext2_rbmap *rb, const char *path) {
+
+    return _ext2_file_write(path, rb->hdr, rb->len);
+}
+
+/**
+ * @brief Maps the reverse block map from its file
+ * @param[out] rb Map
+ * @param[in] path Path of the file
+ * @return 0 on success, -1 if there is no map of the file system as it is
+ *         now
+ */
+int ext2_rbmap_map(struct ext2_rbmap *rb, const char *path) {
+
+    struct ext2_rbmap_hdr *hdr;
+    _u64 len;
+
+    /* Map the file */
+    hdr = _ext2_file_map(path, sizeof(*hdr), &len);
+    if (!hdr) {
+        return -1;
+    }
+
+    /* Check that it maps the file system as it is now */
+    if (memcmp(hdr->magic, RBMAP_MAGIC, 4) ||
+        (hdr->version != RBMAP_VERSION) || !_ext2_fs_id_is_cur(&hdr->id) ||
+        (hdr->nb_blks != _sb.s_blocks_count) ||
+        (sizeof(*hdr) + hdr->nb_exts * sizeof(struct ext2_rbmap_ext)
+         != len)) {
+        munmap(hdr, len);
+        return -1;
+    }
+
+    rb->hdr = hdr;
+    rb->exts = (struct ext2_rbmap_ext *)(hdr + 1);
+    rb->mapped = 1;
+    rb->len = len;
+
+    return 0;
+}
+
+/**
+ * @brief Frees the reverse block map
+ * @param[in] rb Map
+ */
+void ext2_rbmap_free(struct ext2_rbmap *rb) {
+
+    /* Unmap or free the map */
+    if (rb->mapped) {
+        munmap(rb->hdr, rb->len);
+    }
+    else {
+        free(rb->hdr);
+    }
+    memset(rb, 0, sizeof(*rb));
+}
+
+/**
+ * @brief Finds the extents that may hold the block
+ * @param[in] rb Map
+ * @param[in] blk Physical block number
+ * @param[out] first Index of the first of them
+ * @return Number of extents starting at the last start before the block,
+ *         the ones holding the block are the ones long enough
+ * @note The extents of the inodes do not overlap, they only share a start
+ *       for a shared extended attribute block
+ */
+_u64 ext2_rbmap_find(struct ext2_rbmap *rb, _u32 blk, _u64 *first) {
+
+    struct ext2_rbmap_ext *exts = rb->exts;
+    _u64 lo = 0;
+    _u64 hi = rb->hdr->nb_exts;
+    _u64 mid;
+
+    /* Find the first extent starting after the block */
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (exts[mid].pblk <= blk) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+
+    /* Go back over the extents sharing the last start */
+    *first = hi;
+    while (*first && (exts[*first - 1].pblk == exts[hi - 1].pblk)) {
+        (*first)--;
+    }
+
+    return hi - *first;
+}
+
+/**
+ * File layout
+ */
+
+/* Block run of the layout of a file, data blocks contiguous both
+ * physically and logically or an indirect block */
+struct ext2_layout_rec {
+    _u64 lblk;
+    _u32 pblk;
+    _u32 len;
+    /* Zero for data blocks, indirection level otherwise */
+    _u8 level;
+};
+
+/* Layout of a file */
+struct ext2_layout {
+    _u64 nb_blks;
+    _u64 nb_exts;
+    _u64 nb_ind;
+    /* Blocks not following the previous one in the read order */
+    _u64 nb_seeks;
+    _u32 prev_pblk;
+    /* Current data extent */
+    _u64 ext_lblk;
+    _u32 ext_pblk;
+    _u32 ext_len;
+    /* Block runs in the read order, only kept if asked for */
+    _u8 keep;
+    struct ext2_layout_rec *recs;
+    _u64 nb_recs;
+    _u64 max_recs;
+};
+
+/**
+ * @brief Appends a block run to the layout
+ * @param[in] l Layout
+ * @param[in] lblk First logical block
+ * @param[in] pblk Physical block
+ * @param[in] level Indirection level
+ */
+static void _ext2_layout_add(struct ext2_layout *l, _u64 lblk, _u32 pblk,
+                             _u8 level) {
+
+    /* Grow the runs if full */
+    if (l->nb_recs == l->max_recs) {
+        l->max_recs = l->max_recs ? 2 * l->max_recs : 256;
+        l->recs = realloc(l->recs, l->max_recs * sizeof(*l->recs));
+
+        /* Check for failure */
+        if (!l->recs) {
+            /* Exit with failure */
+            exit_err("Failed to allocate the layout\n");
+        }
+    }
+
+    l->recs[l->nb_recs].lblk = lblk;
+    l->recs[l->nb_recs].pblk = pblk;
+    l->recs[l->nb_recs].len = 1;
+    l->recs[l->nb_recs].level = level;
+    l->nb_recs++;
+}
+
+/**
+ * @brief Walker visitor accounting the block in the layout
+ */
+static int _ext2_layout_visit(struct ext2_walk *w, void *ctx, _u64 lblk,
+                              _u32 pblk, _u8 level) {
+
+    struct ext2_layout *l = ctx;
+    _u64 i;
+
+    /* Count a seek if the block does not follow the previous one read */
+    if ((l->nb_blks + l->nb_ind) && (pblk != l->prev_pblk + 1)) {
+        l->nb_seeks++;
+    }
+    l->prev_pblk = pblk;
+
+    /* If it is an indirect block */
+    if (level) {
+        l->nb_ind++;
+        if (l->keep) {
+            _ext2_layout_add(l, lblk, pblk, level);
+        }
+        return EXT2_WALK_CONT;
+    }
+
+    /* If the data block continues the current extent extend it, the
+     * indirect blocks read in between do not break it */
+    l->nb_blks++;
+    if (l->nb_exts && (l->ext_pblk + l->ext_len == pblk) &&
+        (l->ext_lblk + l->ext_len == lblk)) {
+        l->ext_len++;
+        if (l->keep) {
+            for (i = l->nb_recs; l->recs[i - 1].level; i--);
+            l->recs[i - 1].len++;
+        }
+        return EXT2_WALK_CONT;
+    }
+
+    /* Otherwise start a new extent */
+    l->nb_exts++;
+    l->ext_lblk = lblk;
+    l->ext_pblk = pblk;
+    l->ext_len = 1;
+    if (l->keep) {
+        _ext2_layout_add(l, lblk, pblk, 0);
+    }
+
+    return EXT2_WALK_CONT;
+}
+
+/**
+ * @brief Gets the layout of the inode
+ * @param[in] w Walker state
+ * @param[in] ino_st Inode structure
+ * @param[in,out] l Layout, the runs are kept if keep is set
+ */
+void ext2_layout(struct ext2_walk *w, struct ext2_inode *ino_st,
+                 struct ext2_layout *l) {
+
+    /* Reset the counts */
+    l->nb_blks = 0;
+    l->nb_exts = 0;
+    l->nb_ind = 0;
+    l->nb_seeks = 0;
+    l->nb_recs = 0;
+
+    /* Walk the block tree if the inode has one */
+    if (_ext2_ino_has_tree(ino_st)) {
+        _ext2_walk_init(w);
+        _ext2_walk(w, ino_st, 0, _ext2_layout_visit, l);
+    }
+}
+
+/**
+ * @brief Returns the fragmentation score of the layout
+ * @param[in] l Layout
+ * @return Percentage of the blocks, in the read order, not following the
+ *         previous block read, 0 for a contiguous file
+ */
+static inline double _ext2_layout_score(struct ext2_layout *l) {
+
+    _u64 nb_reads = l->nb_blks + l->nb_ind;
+
+    return (nb_reads > 1) ? 100.0 * l->nb_seeks / (nb_reads - 1) : 0.0;
+}
+
+/**
+ * @brief Returns the inode number of a file given its absolute path
+ * @param[in] path Absolute path of the file
+ * @return Inode number
+ */
+_u64 ext2_path_to_ino(_u8 *path) {
+
+    _u8 *toks[MAX_PATH_TOKS];
+    _u32 nb_toks;
+    _u32 i;
+    _u64 ino;
+    _u64 t = _hist_on ? _ext2_now_ns() : 0;
+
+    /* Tokenize the path to get seperate file names */
+    nb_toks = _get_toks(path, "/", toks);
+
+    /* Initialize the inode number to that of root */
+    ino = EXT2_ROOT_INO;
+
+    /* For each token */
+    for (i = 0; i < nb_toks; i++) {
+        /* If explaining start the component record */
+        if (_explain) {
+            _explain->comps[i].name = toks[i];
+            _explain->comps[i].first_blk = _explain->nb_blks;
+            _explain->comps[i].nb_blks = 0;
+            _explain->comps[i].ns = _ext2_now_ns();
+        }
+
+        /* Get the next inode number */
+        ino = _ext2_nxt_ino(ino, toks[i]);
+
+        /* If explaining finish the component record */
+        if (_explain) {
+            _explain->comps[i].ino = ino;
+            _explain->comps[i].ns = _ext2_now_ns() - _explain->comps[i].ns;
+            _explain->nb_comps++;
+        }
+
+        /* Check if inode number is valid */
+        if (ino < EXT2_ROOT_INO) {
+            /* Print what was resolved when explaining */
+            if (_explain) {
+                _ext2_explain_print(_explain);
+            }
+
+            /* Exit with failure */
+            exit_err("File search failed\n");
+        }
+    }
+
+    /* Print the records when explaining */
+    if (_explain) {
+        _ext2_explain_print(_explain);
+    }
+
+    /* Record the lookup latency */
+    if (_hist_on) {
+        _hist_record(EXT2_HIST_PATH, _ext2_now_ns() - t);
+    }
+
+    /* Free the tokens */
+    for (i = 0; i < nb_toks; i++) {
+        free(toks[i]);
+    }
+
+    /* Return the inode number of the file */
+    return ino;
+}
+
+/**
+ * @brief Prints the inode structure contents given
+ *        the inode number
+ * @param[in] ino Inode number
+ */
+void _ext2_print_ino_st(_u64 ino) {
+
+    _u32 i = 0;
+    struct ext2_inode ino_st;
+
+    /* Get the inode structure from the inode number */
+    _ext2_ino_to_ino_st(ino, &ino_st);
+
+    /* If a structured format is requested */
+    if (_out.fmt != OUT_FMT_TEXT) {
+        /* Print the fields as one record */
+        _out_header("ino\ttype\tmode\tflags\tgeneration\tuid\tgid\tsize"
+                    "\tfile_acl\tlinks\tblockcount\tctime\tatime\tmtime"
+                    "\tblocks");
+        _out_rec_begin();
+        _out_field_u64("ino", ino);
+        _out_field_u64("type", ino_st.i_mode & 0xF000);
+        _out_field_u64("mode", ino_st.i_mode & 0x0FFF);
+        _out_field_u64("flags", ino_st.i_flags);
+        _out_field_u64("generation", ino_st.i_generation);
+        _out_field_u64("uid", ino_st.i_uid);
+        _out_field_u64("gid", ino_st.i_gid);
+        _out_field_u64("size", EXT2_I_SIZE(&ino_st));
+        _out_field_u64("file_acl", ino_st.i_file_acl);
+        _out_field_u64("links", ino_st.i_links_count);
+        _out_field_u64("blockcount", ino_st.i_blocks);
+        _out_field_u64("ctime", ino_st.i_ctime);
+        _out_field_u64("atime", ino_st.i_atime);
+        _out_field_u64("mtime", ino_st.i_mtime);
+
+        /* Print the block addresses as an array (a list in TSV) */
+        _out_key("blocks");
+        if (_out.fmt == OUT_FMT_NDJSON) {
+            _out_chr('[');
+        }
+        for (i = 0; i < EXT2_N_BLOCKS; i++) {
+            if (i) {
+                _out_chr(',');
+            }
+            _out_u64(ino_st.i_block[i]);
+        }
+        if (_out.fmt == OUT_FMT_NDJSON) {
+            _out_chr(']');
+        }
+        _out_rec_end();
+        return;
+    }
+
+    /* Print the important inode structure fields */
+    _out_str("Inode: ");
+    _out_u64(ino);
+    _out_str(" Type: 0x");
+    _out_hex(ino_st.i_mode & 0xF000);
+    _out_str(" Mode: 0");
+    _out_oct(ino_st.i_mode & 0x0FFF);
+    _out_str(" Flags: 0x");
+    _out_hex(ino_st.i_flags);
+    _out_str("\nGeneration: ");
+    _out_u64(ino_st.i_generation);
+    _out_str("\nUser: ");
+    _out_u64(ino_st.i_uid);
+    _out_str(" Group: ");
+    _out_u64(ino_st.i_gid);
+    _out_str(" Size: ");
+    _out_u64(ino_st.i_size);
+    _out_str("\nFile ACL: ");
+    _out_u64(ino_st.i_file_acl);
+    _out_str("\nLinks: ");
+    _out_u64(ino_st.i_links_count);
+    _out_str(" Blockcount: ");
+    _out_u64(ino_st.i_blocks);
+    _out_str("\nctime: 0x");
+    _out_hex(ino_st.i_ctime);
+    _out_str("\natime: 0x");
+    _out_hex(ino_st.i_atime);
+    _out_str("\nmtime: 0x");
+    _out_hex(ino_st.i_mtime);
+
+    /* Print the block addresses */
+    _out_str("\nBLOCKS:\n");
+
+    while ((i < EXT2_N_BLOCKS) && (ino_st.i_block[i])) {
+
+        if (i < EXT2_NDIR_BLOCKS) {
+            _out_str("Direct data block (");
+            _out_u64(i);
+            _out_str("): ");
+        }
+        else if (i == EXT2_IND_BLOCK) {
+            _out_str("Single indirect data block: ");
+        }
+        else if (i == EXT2_DIND_BLOCK) {
+            _out_str("Double indirect data block: ");
+        }
+        else if (i == EXT2_TIND_BLOCK) {
+            _out_str("Triple indirect data block: ");
+        }
+        _out_u64(ino_st.i_block[i]);
+        _out_chr('\n');
+
+        /* Update the pointer */
+        i++;
+    }
+}
+
+/**
+ * @brief Prints the contents of the regular file data block
+ * @param[in] blk Block, NULL for a hole
+ * @param[in] len Number of bytes to be printed
+ */
+void _ext2_dir_print_reg_file(_u8 *blk, _u64 len) {
+
+    /* Print the block, zeros for a hole */
+    _out_bytes(blk, len);
+}
+
+/**
+ * @brief Prints the entries of the directory
+ * @param[in] ino Inode number of the directory
+ */
+void _ext2_dir_print_dir(_u64 ino) {
+
+    struct ext2_dir dir;
+    struct ext2_dirent ent;
+
+    /* Open the directory */
+    if (ext2_opendir(ino, &dir)) {
+        /* Exit with failure */
+        exit_err("Not a directory\n");
+    }
+
+    /* Print the directory mappings */
+    _out_header("ino\ttype\tname");
+    while (ext2_readdir(&dir, &ent)) {
+        /* If a structured format is requested */
+        if (_out.fmt != OUT_FMT_TEXT) {
+            _out_rec_begin();
+            _out_field_u64("ino", ent.ino);
+            _out_key("type");
+            _out_esc(_ft_to_name[ent.type % EXT2_FT_MAX],
+                     strlen(_ft_to_name[ent.type % EXT2_FT_MAX]));
+            _out_field_str("name", ent.name, ent.name_len);
+            _out_rec_end();
+            continue;
+        }
+
+        _out_u64(ent.ino);
+        _out_chr('\t');
+        _out_str(_ft_to_str[ent.type % EXT2_FT_MAX]);
+        _out_chr('\t');
+        _out_bytes(ent.name, ent.name_len);
+        _out_chr('\n');
+    }
+
+    /* Close the directory */
+    ext2_closedir(&dir);
+}
+
+/* Data print context */
+struct ext2_print_ctx {
+    _u64 ino;
+    _u64 size;
+};
+
+/**
+ * @brief Walk visitor printing the regular file data blocks
+ */
+static int _ext2_print_visit(struct ext2_walk *w, void *ctx,
+                             _u64 lblk, _u32 pblk, _u8 level) {
+
+    struct ext2_print_ctx *pctx = ctx;
+    _u64 bs = EXT2_BLOCK_SIZE(&_sb);
+    _u64 start;
+    _u64 len;
+    _u32 i;
+
+    /* Skip the indirect blocks */
+    if (level && pblk) {
+        return EXT2_WALK_CONT;
+    }
+
+    /* Get the bytes of the file the block (or hole) covers */
+    start = lblk * bs;
+    len = bs;
+    for (i = 0; i < level; i++) {
+        len *= EXT2_ADDR_PER_BLOCK(&_sb);
+    }
+    if (start + len > pctx->size) {
+        len = pctx->size - start;
+    }
+
+    /* Fire the data block probe, a hole has the block number 0 */
+    EXT2_PROBE4(data__block, pctx->ino, lblk, pblk, len);
+
+    /* Print the regular file block */
+    _ext2_dir_print_reg_file(pblk ? _ext2_walk_read(w, pblk) : NULL, len);
+
+    return EXT2_WALK_CONT;
+}
+
+/**
+ * @brief Prints the data blocks of the inode
+ * @param[in] ino Inode number
+ */
+void _ext2_print_ino_data(_u64 ino) {
+
+    struct ext2_inode ino_st;
+    struct ext2_print_ctx pctx;
+
+    /* Get the inode structure */
+    _ext2_ino_to_ino_st(ino, &ino_st);
+
+    /* If the inode is a regular file */
+    if (EXT2_IS_INODE_REG_FILE(&ino_st)) {
+        /* Print the blocks, holes read as zeros */
+        pctx.ino = ino;
+        pctx.size = EXT2_I_SIZE(&ino_st);
+        _ext2_walk_init(&_walk);
+        _ext2_walk(&_walk, &ino_st, EXT2_WALK_HOLES, _ext2_print_visit, &pctx);
+    }
+    /* If the inode is a directory file */
+    else if (EXT2_IS_INODE_DIR(&ino_st)) {
+        /* Print the directory entries */
+        _ext2_dir_print_dir(ino);
+    }
+    /* If we encountered any other file type */
+    else {
+        /* Exit with error */
+        exit_err("File type not supported\n");
+    }
+}
+
+/* Directory listing, entries with their names in a shared pool */
+struct ext2_list {
+    _u64 *inos;
+    _u8 *types;
+    _u32 *name_offs;
+    _u8 *name_lens;
+    _u8 *names;
+    _u32 nb_ents;
+    _u32 max_ents;
+    _u32 names_len;
+    _u32 max_names_len;
+};
+
+/**
+ * @brief Appends a directory entry to the listing
+ * @param[in] list Listing
+ * @param[in] ent Directory entry
+ */
+static void _ext2_list_add(struct ext2_list *list, struct ext2_dirent *ent) {
+
+    /* Grow the entry arrays if full */
+    if (list->nb_ents == list->max_ents) {
+        list->max_ents = list->max_ents ? 2 * list->max_ents : 256;
+        list->inos = realloc(list->inos, list->max_ents * sizeof(_u64));
+        list->types = realloc(list->types, list->max_ents);
+        list->name_offs = realloc(list->name_offs,
+                                  list->max_ents * sizeof(_u32));
+        list->name_lens = realloc(list->name_lens, list->max_ents);
+    }
+
+    /* Grow the name pool if full */
+    if (list->names_len + ent->name_len > list->max_names_len) {
+        list->max_names_len = 2 * list->max_names_len + EXT2_NAME_LEN;
+        list->names = realloc(list->names, list->max_names_len);
+    }
+
+    /* Check for failure */
+    if (!list->inos || !list->types || !list->name_offs ||
+        !list->name_lens || !list->names) {
+        /* Exit with failure */
+        exit_err("Failed to allocate the directory listing\n");
+    }
+
+    /* Add the entry */
+    list->inos[list->nb_ents] = ent->ino;
+    list->types[list->nb_ents] = ent->type;
+    list->name_offs[list->nb_ents] = list->names_len;
+    list->name_lens[list->nb_ents] = ent->name_len;
+    memcpy(list->names + list->names_len, ent->name, ent->name_len);
+    list->names_len += ent->name_len;
+    list->nb_ents++;
+}
+
+/**
+ * @brief Formats the inode mode the way ls -l does
+ * @param[in] mode Inode mode
+ * @param[out] str String of 11 bytes
+ */
+static void _ext2_mode_to_str(_u16 mode, char str[11]) {
+
+    static const char types[16] = "?pc?d?b?-?l?s???";
+    static const char perms[9] = "rwxrwxrwx";
+    _u32 i;
+
+    /* File type character */
+    str[0] = types[(mode >> 12) & 0xF];
+
+    /* Permission characters */
+    for (i = 0; i < 9; i++) {
+        str[i + 1] = (mode & (0400 >> i)) ? perms[i] : '-';
+    }
+
+    /* Set-id and sticky bits */
+    if (mode & 04000) {
+        str[3] = (mode & 0100) ? 's' : 'S';
+    }
+    if (mode & 02000) {
+        str[6] = (mode & 0010) ? 's' : 'S';
+    }
+    if (mode & 01000) {
+        str[9] = (mode & 0001) ? 't' : 'T';
+    }
+
+    str[10] = '\0';
+}
+
+/**
+ * @brief Parses the list cursor of the form <block>:<offset>
+ * @param[in] arg Cursor string
+ * @return Resume cookie of the cursor
+ */
+static _u64 _ext2_parse_cursor(_u8 *arg) {
+
+    _u64 lblk;
+    _u64 off;
+    char *end;
+
+    /* Parse the block index */
+    lblk = strtoull(arg, &end, 10);
+
+    /* Check for the separator */
+    if ((end == (char *)arg) || (*end != ':')) {
+        /* Exit with failure */
+        exit_err("Invalid cursor\n");
+    }
+
+    /* Parse the byte offset */
+    arg = end + 1;
+    off = strtoull(arg, &end, 10);
+
+    /* Check for the end of the cursor */
+    if ((end == (char *)arg) || *end || (lblk > UINT32_MAX) ||
+        (off >= EXT2_BLOCK_SIZE(&_sb))) {
+        /* Exit with failure */
+        exit_err("Invalid cursor\n");
+    }
+
+    return EXT2_DIR_COOKIE(lblk, off);
+}
+
+/**
+ * @brief Prints the directory entries along with their inode metadata
+ *        the way ls -l does
+ * @param[in] ino Inode number of the directory
+ * @param[in] nb_args Number of request arguments
+ * @param[in] args Request arguments, an optional cursor and limit
+ * @note With a limit, a page of entries is printed followed by the
+ *       cursor of the next page (or "end")
+ */
+void _ext2_print_dir_list(_u64 ino, int nb_args, char **args) {
+
+    struct ext2_inode *ent_sts;
+    struct ext2_list list = {0};
+    struct ext2_dir dir;
+    struct ext2_dirent ent;
+    _u64 limit = UINT64_MAX;
+    _u64 cookie = 0;
+    _u8 more = 0;
+    _u32 i;
+    char mode_str[11];
+    char time_str[32];
+    time_t mtime;
+    char *end;
+
+    /* Open the directory */
+    if (ext2_opendir(ino, &dir)) {
+        /* Exit with failure */
+        exit_err("List request needs a directory\n");
+    }
+
+    /* If a cursor is given resume from it */
+    if (nb_args > 0) {
+        ext2_seekdir(&dir, _ext2_parse_cursor(args[0]));
+    }
+
+    /* If a limit is given */
+    if (nb_args > 1) {
+        errno = 0;
+        limit = strtoull(args[1], &end, 10);
+
+        /* Check for a whole positive number, an empty page never ends */
+        if ((end == args[1]) || *end || errno || !limit ||
+            (args[1][0] == '-')) {
+            /* Exit with failure */
+            exit_err("Invalid limit\n");
+        }
+    }
+
+    /* Collect the entries of the page */
+    while ((list.nb_ents < limit) && ext2_readdir(&dir, &ent)) {
+        _ext2_list_add(&list, &ent);
+    }
+
+    /* If the page is full check if an entry is left */
+    if (list.nb_ents == limit) {
+        cookie = ext2_telldir(&dir);
+        more = ext2_readdir(&dir, &ent);
+    }
+
+    /* Close the directory */
+    ext2_closedir(&dir);
+
+    /* Fetch the inodes of all the entries in one batch */
+    ent_sts = malloc(((_u64)list.nb_ents + 1) * sizeof(struct ext2_inode));
+
+    /* Check for failure */
+    if (!ent_sts) {
+        /* Exit with failure */
+        exit_err("Failed to allocate the inode batch\n");
+    }
+
+    _ext2_inos_to_ino_sts(list.inos, list.nb_ents, ent_sts);
+
+    /* Print the entries in the directory order */
+    _out_header("ino\tmode\tlinks\tuid\tgid\tsize\tmtime\tname");
+    for (i = 0; i < list.nb_ents; i++) {
+        /* If a structured format is requested */
+        if (_out.fmt != OUT_FMT_TEXT) {
+            _out_rec_begin();
+            _out_field_u64("ino", list.inos[i]);
+            _out_field_u64("mode", ent_sts[i].i_mode);
+            _out_field_u64("links", ent_sts[i].i_links_count);
+            _out_field_u64("uid", ent_sts[i].i_uid);
+            _out_field_u64("gid", ent_sts[i].i_gid);
+            _out_field_u64("size", EXT2_I_SIZE(&ent_sts[i]));
+            _out_field_u64("mtime", ent_sts[i].i_mtime);
+            _out_field_str("name", list.names + list.name_offs[i],
+                           list.name_lens[i]);
+            _out_rec_end();
+            continue;
+        }
+
+        _ext2_mode_to_str(ent_sts[i].i_mode, mode_str);
+
+        /* Format the time again only when the minute changes */
+        if (!i || (ent_sts[i].i_mtime / 60 != mtime / 60)) {
+            mtime = ent_sts[i].i_mtime;
+            strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M",
+                     localtime(&mtime));
+        }
+        _out_u64(list.inos[i]);
+        _out_chr('\t');
+        _out_str(mode_str);
+        _out_chr(' ');
+        _out_u64(ent_sts[i].i_links_count);
+        _out_chr(' ');
+        _out_u64(ent_sts[i].i_uid);
+        _out_chr(' ');
+        _out_u64(ent_sts[i].i_gid);
+        _out_chr(' ');
+        _out_u64(EXT2_I_SIZE(&ent_sts[i]));
+        _out_chr(' ');
+        _out_str(time_str);
+        _out_chr(' ');
+        _out_bytes(list.names + list.name_offs[i], list.name_lens[i]);
+        _out_chr('\n');
+    }
+
+    /* Print the cursor of the next page */
+    if (more || (limit != UINT64_MAX)) {
+        if (_out.fmt == OUT_FMT_NDJSON) {
+            _out_str("{\"next\":\"");
+        }
+        else {
+            _out_str("next\t");
+        }
+        if (more) {
+            _out_u64(EXT2_DIR_COOKIE_LBLK(cookie));
+            _out_chr(':');
+            _out_u64(EXT2_DIR_COOKIE_OFF(cookie));
+        }
+        else {
+            _out_str("end");
+        }
+        _out_str((_out.fmt == OUT_FMT_NDJSON) ? "\"}\n" : "\n");
+    }
+
+    /* Free the listing */
+    free(ent_sts);
+    free(list.inos);
+    free(list.types);
+    free(list.name_offs);
+    free(list.name_lens);
+    free(list.names);
+}
+
+/* Header of the snapshot rows in the TSV format */
+#define SNAP_TSV_HEADER  "ino\tmode\tuid\tgid\tsize\tblocks\tatime\tctime" \
+                         "\tmtime\tlinks"
+
+/**
+ * @brief Prints the row of the snapshot as a record of the structured
+ *        formats, a line the way ls -l does otherwise
+ * @param[in] snap Snapshot
+ * @param[in] row Row index
+ * @param[in] path Path of the inode, NULL if none
+ * @param[in] path_len Length of the path
+ */
+static void _ext2_print_snap_row(struct ext2_snap *snap, _u64 row,
+                                 const _u8 *path, _u32 path_len) {
+
+    char mode_str[11];
+    char time_str[32];
+    time_t mtime;
+    _u32 col;
+
+    /* If a structured format is requested */
+    if (_out.fmt != OUT_FMT_TEXT) {
+        _out_rec_begin();
+        for (col = 0; col < SNAP_NB_COLS; col++) {
+            _out_field_u64(_snap_cols[col].name,
+                           _ext2_snap_get(snap, col, row));
+        }
+        if (path) {
+            _out_field_str("path", path, path_len);
+        }
+        _out_rec_end();
+        return;
+    }
+
+    /* Print the inode number, mode, links, owner, size and mtime */
+    _ext2_mode_to_str(snap->mode[row], mode_str);
+    mtime = snap->mtime[row];
+    strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M", localtime(&mtime));
+    _out_u64(snap->ino[row]);
+    _out_chr('\t');
+    _out_str(mode_str);
+    _out_chr(' ');
+    _out_u64(snap->links[row]);
+    _out_chr(' ');
+    _out_u64(snap->uid[row]);
+    _out_chr(' ');
+    _out_u64(snap->gid[row]);
+    _out_chr(' ');
+    _out_u64(snap->size[row]);
+    _out_chr(' ');
+    _out_str(time_str);
+    if (path) {
+        _out_chr(' ');
+        _out_bytes(path, path_len);
+    }
+    _out_chr('\n');
+}
+
+/**
+ * @brief Prints the inodes in use of the file system, as a columnar file
+ *        in the text format, one record per inode otherwise
+ * @param[in] ino Inode number of the path, the root directory
+ * @note The columnar file is a header, a directory of the columns (name,
+ *       width in bytes, offset) and the columns, each an array of little
+ *       endian unsigned integers aligned on SCAN_ALIGN bytes
+ */
+void _ext2_print_scan(_u64 ino) {
+
+    static const _u8 pad[SCAN_ALIGN];
+    struct ext2_scan_hdr hdr = {0};
+    struct ext2_scan_col dir[SNAP_NB_COLS] = {0};
+    struct ext2_snap snap;
+    _u64 off;
+    _u64 row;
+    _u32 col;
+
+    /* The scan covers the whole file system */
+    if (ino != EXT2_ROOT_INO) {
+        /* Exit with failure */
+        exit_err("Scan request needs the root directory\n");
+    }
+
+    /* Load the inodes in use */
+    ext2_snap_load(&snap);
+
+    /* If a structured format is requested */
+    if (_out.fmt != OUT_FMT_TEXT) {
+        /* Print a record per inode */
+        _out_header(SNAP_TSV_HEADER);
+        for (row = 0; row < snap.nb_inos; row++) {
+            _ext2_print_snap_row(&snap, row, NULL, 0);
+        }
+        ext2_snap_free(&snap);
+        return;
+    }
+
+    /* Fill the header */
+    memcpy(hdr.magic, SCAN_MAGIC, 4);
+    hdr.version = SCAN_VERSION;
+    hdr.nb_rows = snap.nb_inos;
+    hdr.nb_cols = SNAP_NB_COLS;
+
+    /* Lay the columns out after the directory */
+    off = sizeof(hdr) + sizeof(dir);
+    for (col = 0; col < SNAP_NB_COLS; col++) {
+        off = (off + SCAN_ALIGN - 1) & ~(_u64)(SCAN_ALIGN - 1);
+        strncpy(dir[col].name, _snap_cols[col].name, sizeof(dir[col].name));
+        dir[col].width = _snap_cols[col].width;
+        dir[col].off = off;
+        off += snap.nb_inos * _snap_cols[col].width;
+    }
+
+    /* Print the header, the directory and the padded columns */
+    _out_bytes(&hdr, sizeof(hdr));
+    _out_bytes(dir, sizeof(dir));
+    off = sizeof(hdr) + sizeof(dir);
+    for (col = 0; col < SNAP_NB_COLS; col++) {
+        _out_bytes(pad, dir[col].off - off);
+        _out_bytes(SNAP_COL(&snap, col), snap.nb_inos * dir[col].width);
+        off = dir[col].off + snap.nb_inos * dir[col].width;
+    }
+
+    /* Free the snapshot */
+    ext2_snap_free(&snap);
+}
+
+/**
+ * @brief Prints the inodes in use matching the conditions
+ * @param[in] ino Inode number of the path, the root directory
+ * @param[in] nb_args Number of request arguments
+ * @param[in] args Request arguments, an optional @<scan file> followed by
+ *                 the conditions
+ * @note The inodes are loaded into the snapshot from the inode tables, or
+ *       mapped from a scan file, and filtered a column at a time
+ */
+void _ext2_print_filter(_u64 ino, int nb_args, char **args) {
+
+    struct ext2_filter filter = {0};
+    struct ext2_snap snap;
+    _u8 *sel;
+    _u64 row;
+    int i = 0;
+
+    /* The filter covers the whole file system */
+    if (ino != EXT2_ROOT_INO) {
+        /* Exit with failure */
+        exit_err("Filter request needs the root directory\n");
+    }
+
+    /* Map the scan file if given, load the inodes in use otherwise */
+    if ((nb_args > 0) && (args[0][0] == '@')) {
+        ext2_snap_map(&snap, args[0] + 1);
+        i++;
+    }
+    else {
+        ext2_snap_load(&snap);
+    }
+
+    /* Parse the conditions */
+    for (; i < nb_args; i++) {
+        _ext2_parse_cond(args[i], &filter);
+    }
+
+    /* Select the matching rows */
+    sel = malloc(snap.nb_inos + 1);
+
+    /* Check for failure */
+    if (!sel) {
+        /* Exit with failure */
+        exit_err("Failed to allocate the selection\n");
+    }
+
+    ext2_snap_filter(&snap, &filter, sel);
+
+    /* Print the matching rows */
+    _out_header(SNAP_TSV_HEADER);
+    for (row = 0; row < snap.nb_inos; row++) {
+        if (sel[row]) {
+            _ext2_print_snap_row(&snap, row, NULL, 0);
+        }
+    }
+
+    /* Free the selection and the snapshot */
+    free(sel);
+    ext2_snap_free(&snap);
+}
+
+/* Metadata query */
+struct ext2_query {
+    struct ext2_filter filter;
+    /* Chunk of the inodes scanned, filtered when full */
+    struct ext2_snap chunk;
+    _u8 *sel;
+    /* Inodes matching, in the inode number order */
+    struct ext2_snap matches;
+    /* Bitmap of the inodes matching */
+    _u8 *match_bmap;
+    /* Number of names of the matching inodes left to be found */
+    _u64 nb_names;
+    /* Path of the directory being walked */
+    _u8 path[MAX_PATH_LEN];
+};
+
+/**
+ * @brief Filters the chunk of the query and keeps the inodes matching
+ * @param[in] q Query
+ */
+static void _ext2_query_flush(struct ext2_query *q) {
+
+    _u64 row;
+    _u32 ino;
+
+    /* Select the matching rows of the chunk */
+    ext2_snap_filter(&q->chunk, &q->filter, q->sel);
+
+    /* Keep them, counting the names to be found */
+    for (row = 0; row < q->chunk.nb_inos; row++) {
+        if (q->sel[row]) {
+            ino = q->chunk.ino[row];
+            _ext2_snap_append(&q->matches, &q->chunk, row);
+            q->match_bmap[ino >> 3] |= 1 << (ino & 7);
+            q->nb_names += ((q->chunk.mode[row] & 0xF000) == 0x4000)
+                ? 1 : q->chunk.links[row];
+        }
+    }
+    q->chunk.nb_inos = 0;
+}
+
+/**
+ * @brief Scan visitor adding the inode to the chunk of the query
+ */
+static void _ext2_query_visit(void *ctx, _u64 ino, struct ext2_inode *ino_st) {
+
+    struct ext2_query *q = ctx;
+
+    /* Filter the chunk if full */
+    if (q->chunk.nb_inos == q->chunk.cap) {
+        _ext2_query_flush(q);
+    }
+
+    /* Add the inode */
+    _ext2_snap_visit(&q->chunk, ino, ino_st);
+}
+
+/**
+ * @brief Prints the matching inode under the path
+ * @param[in] q Query
+ * @param[in] ino Inode number
+ * @param[in] path_len Length of the path
+ */
+static void _ext2_query_print(struct ext2_query *q, _u64 ino,
+                              _u32 path_len) {
+
+    _u64 lo = 0;
+    _u64 hi = q->matches.nb_inos;
+    _u64 mid;
+
+    /* Find the row of the inode, the matches are sorted */
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (q->matches.ino[mid] < ino) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+
+    /* Print it with its path */
+    _ext2_print_snap_row(&q->matches, lo, q->path, path_len);
+    q->nb_names--;
+}
+
+/**
+ * @brief Walks the directory tree printing the matching inodes found
+ * @param[in] q Query
+ * @param[in] ino Inode number of the directory
+ * @param[in] path_len Length of the path of the directory
+ * @note Only directories are opened, the walk stops once every name of
+ *       the matching inodes is found
+ */
+static void _ext2_query_walk(struct ext2_query *q, _u64 ino, _u32 path_len) {
+
+    struct ext2_dir dir;
+    struct ext2_dirent ent;
+    _u32 len;
+
+    /* Open the directory */
+    if (ext2_opendir(ino, &dir)) {
+        return;
+    }
+
+    /* For each entry while names are left to be found */
+    while (q->nb_names && ext2_readdir(&dir, &ent)) {
+
+        /* Skip the self and parent entries */
+        if ((ent.name[0] == '.') && ((ent.name_len == 1) ||
+            ((ent.name_len == 2) && (ent.name[1] == '.')))) {
+            continue;
+        }
+
+        /* Skip the entries whose path is too long */
+        len = path_len + 1 + ent.name_len;
+        if (len >= MAX_PATH_LEN) {
+            continue;
+        }
+
+        /* Append the name to the path */
+        q->path[path_len] = '/';
+        memcpy(q->path + path_len + 1, ent.name, ent.name_len);
+
+        /* Print the entry if it matches */
+        if ((ent.ino <= _sb.s_inodes_count) &&
+            ((q->match_bmap[ent.ino >> 3] >> (ent.ino & 7)) & 1)) {
+            _ext2_query_print(q, ent.ino, len);
+        }
+
+        /* Walk the sub directories */
+        if ((ent.type == EXT2_FT_DIR) || (ent.type == EXT2_FT_UNKNOWN)) {
+            _ext2_query_walk(q, ent.ino, len);
+        }
+    }
+
+    /* Close the directory */
+    ext2_closedir(&dir);
+}
+
+/**
+ * @brief Prints the inodes matching the conditions along with their paths
+ *        under the directory
+ * @param[in] ino Inode number of the directory
+ * @param[in] nb_args Number of request arguments
+ * @param[in] args Request arguments, the conditions
+ * @note The inode tables are scanned (bitmap guided) and filtered a chunk
+ *       at a time without reading any directory. Only then the directories
+ *       under the path are walked to name the inodes matching; the paths
+ *       are printed relative to it, starting with "."
+ */
+void _ext2_print_query(_u64 ino, int nb_args, char **args) {
+
+    static struct ext2_query q;
+    int i;
+
+    /* Parse the conditions */
+    memset(&q, 0, sizeof(q));
+    for (i = 0; i < nb_args; i++) {
+        _ext2_parse_cond(args[i], &q.filter);
+    }
+
+    /* Allocate the chunk, the selection and the bitmap */
+    _ext2_snap_resize(&q.chunk, QUERY_CHUNK_ROWS);
+    q.sel = malloc(QUERY_CHUNK_ROWS);
+    q.match_bmap = calloc(_sb.s_inodes_count / 8 + 1, 1);
+
+    /* Check for failure */
+    if (!q.sel || !q.match_bmap) {
+        /* Exit with failure */
+        exit_err("Failed to allocate the query\n");
+    }
+
+    /* Scan the inode tables keeping the matching inodes */
+    ext2_scan(_ext2_query_visit, &q);
+    _ext2_query_flush(&q);
+
+    /* Print the directory itself if it matches */
+    q.path[0] = '.';
+    _out_header(SNAP_TSV_HEADER "\tpath");
+    if ((q.match_bmap[ino >> 3] >> (ino & 7)) & 1) {
+        _ext2_query_print(&q, ino, 1);
+    }
+
+    /* Name the matching inodes */
+    _ext2_query_walk(&q, ino, 1);
+
+    /* Free the query */
+    ext2_snap_free(&q.chunk);
+    ext2_snap_free(&q.matches);
+    free(q.sel);
+    free(q.match_bmap);
+}
+
+/* Directory of the disk usage walk, released once its entries and its
+ * sub directories are all done */
+struct ext2_du_dir {
+    struct ext2_du_dir *parent;
+    _u64 ino;
+    /* Blocks of the directory and of its entries other than directories */
+    _u64 own;
+    /* Blocks of the sub directories, added as they are done */
+    _u64 sub;
+    /* Listing of the directory and sub directories not done yet */
+    _u32 pending;
+    _u32 depth;
+    _u8 name_len;
+    _u8 name[EXT2_NAME_LEN];
+};
+
+/* Disk usage walk */
+struct ext2_du {
+    /* Blocks (512 bytes) of every inode, by inode number */
+    _u32 *blocks;
+    /* Inodes with more than one link, and the ones already counted */
+    _u8 *linked;
+    _u8 *seen;
+    /* Deepest directory printed */
+    _u32 max_depth;
+    /* Output lock, the directories are printed by the workers */
+    pthread_mutex_t lock;
+};
+
+/**
+ * @brief Scan visitor recording the blocks and links of the inode
+ */
+static void _ext2_du_scan_visit(void *ctx, _u64 ino,
+                                struct ext2_inode *ino_st) {
+
+    struct ext2_du *du = ctx;
+
+    du->blocks[ino] = ino_st->i_blocks;
+    if (!EXT2_IS_INODE_DIR(ino_st) && (ino_st->i_links_count > 1)) {
+        du->linked[ino >> 3] |= 1u << (ino & 7);
+    }
+}
+
+/**
+ * @brief Creates the directory of the walk
+ * @param[in] du Disk usage walk
+ * @param[in] parent Parent directory, NULL for the directory of the path
+ * @param[in] ino Inode number
+ * @param[in] name Name
+ * @param[in] name_len Length of the name
+ * @return Directory
+ */
+static struct ext2_du_dir *_ext2_du_dir_new(struct ext2_du *du,
+                                            struct ext2_du_dir *parent,
+                                            _u64 ino, const _u8 *name,
+                                            _u8 name_len) {
+
+    struct ext2_du_dir *dir;
+
+    /* Allocate the directory */
+    dir = malloc(sizeof(*dir));
+
+    /* Check for failure */
+    if (!dir) {
+        /* Exit with failure */
+        exit_err("Failed to allocate the disk usage walk\n");
+    }
+
+    /* It waits for its listing, the sub directories are added as found */
+    dir->parent = parent;
+    dir->ino = ino;
+    dir->own = (ino <= _sb.s_inodes_count) ? du->blocks[ino] : 0;
+    dir->sub = 0;
+    dir->pending = 1;
+    dir->depth = parent ? parent->depth + 1 : 0;
+    dir->name_len = name_len;
+    if (name_len) {
+        memcpy(dir->name, name, name_len);
+    }
+
+    return dir;
+}
+
+/**
+ * @brief Parallel walk visitor adding the entry to the directory
+ */
+static void *_ext2_du_visit(void *ctx, _u32 tid, void *dir_data,
+                            struct ext2_dirent *ent) {
+
+    struct ext2_du *du = ctx;
+    struct ext2_du_dir *dir = dir_data;
+    struct ext2_du_dir *sub;
+    _u8 bit = 1u << (ent->ino & 7);
+
+    /* A sub directory holds the directory until it is done */
+    if (ent->type == EXT2_FT_DIR) {
+        sub = _ext2_du_dir_new(du, dir, ent->ino, ent->name, ent->name_len);
+        __atomic_add_fetch(&dir->pending, 1, __ATOMIC_RELAXED);
+        return sub;
+    }
+
+    /* Count a file with hard links once, in the first directory that
+     * claims it */
+    if ((du->linked[ent->ino >> 3] & bit) &&
+        (__atomic_fetch_or(&du->seen[ent->ino >> 3], bit, __ATOMIC_RELAXED)
+         & bit)) {
+        return NULL;
+    }
+    dir->own += du->blocks[ent->ino];
+
+    return NULL;
+}
+
+/**
+ * @brief Prints the usage of the directory
+ * @param[in] dir Directory
+ * @param[in] blocks Blocks (512 bytes) of the directory and its tree
+ */
+static void _ext2_du_print(struct ext2_du_dir *dir, _u64 blocks) {
+
+    _u8 path[MAX_PATH_LEN];
+    struct ext2_du_dir *d;
+    _u32 pos = MAX_PATH_LEN;
+
+    /* Build the path relative to the directory of the walk from its end */
+    for (d = dir; d->parent; d = d->parent) {
+        if (pos < 1 + d->name_len + 1) {
+            fprintf(stderr, "Path of the inode %lu is too long\n", dir->ino);
+            return;
+        }
+        pos -= d->name_len;
+        memcpy(path + pos, d->name, d->name_len);
+        path[--pos] = '/';
+    }
+    path[--pos] = '.';
+
+    /* If a structured format is requested */
+    if (_out.fmt != OUT_FMT_TEXT) {
+        _out_rec_begin();
+        _out_field_u64("size", blocks * 512);
+        _out_field_str("path", path + pos, MAX_PATH_LEN - pos);
+        _out_rec_end();
+        return;
+    }
+
+    /* Print the usage in KiB as du does */
+    _out_u64((blocks + 1) / 2);
+    _out_chr('\t');
+    _out_bytes(path + pos, MAX_PATH_LEN - pos);
+    _out_chr('\n');
+}
+
+/**
+ * @brief Parallel walk visitor releasing the listing of the directory
+ * @note The last of the listing and sub directories of a directory to be
+ *       done prints it and hands its total up, so the directories are
+ *       printed bottom up as soon as their tree is done
+ */
+static void _ext2_du_done(void *ctx, _u32 tid, void *dir_data) {
+
+    struct ext2_du *du = ctx;
+    struct ext2_du_dir *dir = dir_data;
+    struct ext2_du_dir *parent;
+    _u64 blocks;
+
+    /* While the directory is done */
+    while (dir && !__atomic_sub_fetch(&dir->pending, 1, __ATOMIC_ACQ_REL)) {
+        blocks = dir->own + __atomic_load_n(&dir->sub, __ATOMIC_RELAXED);
+
+        /* Print it if not too deep */
+        if (dir->depth <= du->max_depth) {
+            pthread_mutex_lock(&du->lock);
+            _ext2_du_print(dir, blocks);
+            pthread_mutex_unlock(&du->lock);
+        }
+
+        /* Hand its total to its parent and release it */
+        parent = dir->parent;
+        if (parent) {
+            ATOMIC_ADD(parent->sub, blocks);
+        }
+        free(dir);
+        dir = parent;
+    }
+}
+
+/**
+ * @brief Prints the disk usage of every directory under the directory
+ * @param[in] ino Inode number of the directory
+ * @param[in] nb_args Number of request arguments
+ * @param[in] args Request arguments, an optional maximum depth of the
+ *                 directories printed
+ * @note The blocks and links of every inode are read first by a scan of
+ *       the inode tables, then the directories are walked in parallel
+ */
+void _ext2_print_du(_u64 ino, int nb_args, char **args) {
+
+    struct ext2_du du = {0};
+    struct ext2_du_dir *root;
+    struct ext2_inode ino_st;
+    unsigned long depth;
+    char *end;
+
+    /* Check that the path is a directory */
+    _ext2_ino_to_ino_st(ino, &ino_st);
+    if (!EXT2_IS_INODE_DIR(&ino_st)) {
+        /* Exit with failure */
+        exit_err("Du request needs a directory\n");
+    }
+
+    /* Get the maximum depth */
+    du.max_depth = UINT32_MAX;
+    if (nb_args > 0) {
+        errno = 0;
+        depth = strtoul(args[0], &end, 10);
+
+        /* Check for a whole number */
+        if ((end == args[0]) || *end || errno || (args[0][0] == '-') ||
+            (depth > UINT32_MAX)) {
+            /* Exit with failure */
+            exit_err("Invalid maximum depth\n");
+        }
+        du.max_depth = depth;
+    }
+
+    /* Allocate the blocks and the bitmaps */
+    du.blocks = calloc((_u64)_sb.s_inodes_count + 1, sizeof(*du.blocks));
+    du.linked = calloc(_sb.s_inodes_count / 8 + 1, 1);
+    du.seen = calloc(_sb.s_inodes_count / 8 + 1, 1);
+
+    /* Check for failure */
+    if (!du.blocks || !du.linked || !du.seen) {
+        /* Exit with failure */
+        exit_err("Failed to allocate the disk usage walk\n");
+    }
+    pthread_mutex_init(&du.lock, NULL);
+
+    /* Get the blocks of the inodes */
+    ext2_scan(_ext2_du_scan_visit, &du);
+
+    /* Walk the directories */
+    _out_header("size\tpath");
+    root = _ext2_du_dir_new(&du, NULL, ino, NULL, 0);
+    ext2_pwalk(ino, root, _ext2_du_visit, _ext2_du_done, &du);
+
+    /* Free the walk */
+    pthread_mutex_destroy(&du.lock);
+    free(du.blocks);
+    free(du.linked);
+    free(du.seen);
+}
+
+/* Name search over a parallel walk */
+struct ext2_find {
+    /* Glob on the names, NULL if none */
+    const char *glob;
+    /* Literal prefix and suffix every name matching the glob has, and the
+     * longest literal run in between, to reject names before the full
+     * match. The glob is a literal if its prefix is the whole of it */
+    _u32 glob_len;
+    _u32 pre_len;
+    _u32 suf_len;
+    const char *lit;
+    _u32 lit_len;
+    /* Regular expression on the names, if any */
+    _u8 has_re;
+    regex_t re;
+    /* Conditions on the inodes, and whether they need more of the inode
+     * than the type of the entry */
+    struct ext2_filter filter;
+    _u8 need_ino;
+    /* One row snapshot of every worker to evaluate the conditions */
+    struct ext2_snap rows[MAX_THREADS];
+    /* Output lock, the names are printed by the workers */
+    pthread_mutex_t lock;
+};
+
+/* Path of a directory of the search */
+struct ext2_find_dir {
+    _u32 len;
+    _u8 path[];
+};
+
+/**
+ * @brief Creates the path of a directory of the search
+ * @param[in] parent Parent directory, NULL for the directory of the walk
+ * @param[in] name Name of the directory
+ * @param[in] len Length of the name
+ * @return Path of the directory, freed by _ext2_find_done
+ */
+static struct ext2_find_dir *_ext2_find_dir_new(struct ext2_find_dir *parent,
+                                                const _u8 *name, _u32 len) {
+
+    struct ext2_find_dir *dir;
+    _u32 pos = parent ? parent->len + 1 : 0;
+
+    /* Allocate the path */
+    dir = malloc(sizeof(*dir) + pos + len);
+
+    /* Check for failure */
+    if (!dir) {
+        /* Exit with failure */
+        exit_err("Failed to allocate the walk\n");
+    }
+
+    /* Append the name to the path of the parent */
+    dir->len = pos + len;
+    if (parent) {
+        memcpy(dir->path, parent->path, parent->len);
+        dir->path[parent->len] = '/';
+    }
+    memcpy(dir->path + pos, name, len);
+
+    return dir;
+}
+
+/**
+ * @brief Sets the glob of the search, with its literal parts
+ * @param[in,out] f Search
+ * @param[in] glob Glob
+ */
+static void _ext2_find_glob(struct ext2_find *f, const char *glob) {
+
+    const char *wild = "*?[]\\";
+    _u32 br_start = 0;
+    _u8 in_br = 0;
+    _u32 start;
+    _u32 i;
+
+    f->glob = glob;
+    f->glob_len = strlen(glob);
+
+    /* Get the literal prefix and suffix */
+    f->pre_len = strcspn(glob, wild);
+    f->suf_len = 0;
+    while ((f->suf_len < f->glob_len - f->pre_len) &&
+           !strchr(wild, glob[f->glob_len - f->suf_len - 1])) {
+        f->suf_len++;
+    }
+
+    /* Get the longest literal run in between, out of the brackets */
+    f->lit_len = 0;
+    for (i = start = f->pre_len; i < f->glob_len - f->suf_len; i++) {
+        /* If in a bracket expression look for its end */
+        if (in_br) {
+            in_br = (glob[i] != ']') ||
+                    (i <= br_start + 1 + (glob[br_start + 1] == '!'));
+            start = i + 1;
+        }
+        /* If the character is special end the run */
+        else if (strchr(wild, glob[i])) {
+            in_br = (glob[i] == '[');
+            br_start = i;
+            start = i + 1;
+        }
+        /* Otherwise extend the run */
+        else if (i + 1 - start > f->lit_len) {
+            f->lit = glob + start;
+            f->lit_len = i + 1 - start;
+        }
+    }
+}
+
+/**
+ * @brief Returns if the name matches the glob and the regular expression
+ * @param[in] f Search
+ * @param[in] name Name
+ * @param[in] len Length of the name
+ */
+static _u8 _ext2_find_name(struct ext2_find *f, const _u8 *name, _u32 len) {
+
+    char str[EXT2_NAME_LEN + 1];
+
+    /* If there is a glob */
+    if (f->glob) {
+        /* If it is a literal the name must be it */
+        if (f->pre_len == f->glob_len) {
+            if ((len != f->glob_len) || memcmp(name, f->glob, len)) {
+                return 0;
+            }
+        }
+        /* Otherwise reject the names without its literal parts first */
+        else if ((len < f->pre_len + f->suf_len) ||
+                 memcmp(name, f->glob, f->pre_len) ||
+                 memcmp(name + len - f->suf_len,
+                        f->glob + f->glob_len - f->suf_len, f->suf_len) ||
+                 (f->lit_len &&
+                  !memmem(name + f->pre_len, len - f->pre_len - f->suf_len,
+                          f->lit, f->lit_len))) {
+            return 0;
+        }
+    }
+
+    /* Match the full glob and the regular expression on the string */
+    if ((f->glob && (f->pre_len != f->glob_len)) || f->has_re) {
+        memcpy(str, name, len);
+        str[len] = '\0';
+        if (f->glob && (f->pre_len != f->glob_len) &&
+            fnmatch(f->glob, str, 0)) {
+            return 0;
+        }
+        if (f->has_re && regexec(&f->re, str, 0, NULL, 0)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Parallel walk visitor printing the entry if it matches
+ */
+static void *_ext2_find_visit(void *ctx, _u32 tid, void *dir_data,
+                              struct ext2_dirent *ent) {
+
+    struct ext2_find *f = ctx;
+    struct ext2_find_dir *dir = dir_data;
+    struct ext2_find_dir *sub = NULL;
+    struct ext2_snap *row = &f->rows[tid];
+    struct ext2_inode ino_st = {0};
+    _u8 path[MAX_PATH_LEN];
+    const char *type;
+    _u32 len;
+    _u8 sel;
+
+    /* Give the sub directories their path */
+    if (ent->type == EXT2_FT_DIR) {
+        sub = _ext2_find_dir_new(dir, ent->name, ent->name_len);
+    }
+
+    /* Check the name */
+    if (!_ext2_find_name(f, ent->name, ent->name_len)) {
+        return sub;
+    }
+
+    /* Check the conditions on the inode, or on the type of the entry */
+    if (f->filter.nb_conds) {
+        if (f->need_ino) {
+            _ext2_ino_to_ino_st(ent->ino, &ino_st);
+        }
+        else if (ent->type < EXT2_FT_MAX) {
+            ino_st.i_mode = _ft_to_mode[ent->type];
+        }
+        row->nb_inos = 0;
+        _ext2_snap_visit(row, ent->ino, &ino_st);
+        if (!ext2_snap_filter(row, &f->filter, &sel)) {
+            return sub;
+        }
+    }
+
+    /* Build the path */
+    if (dir->len + 1 + ent->name_len > MAX_PATH_LEN) {
+        fprintf(stderr, "Path of the inode %lu is too long\n", ent->ino);
+        return sub;
+    }
+    memcpy(path, dir->path, dir->len);
+    path[dir->len] = '/';
+    memcpy(path + dir->len + 1, ent->name, ent->name_len);
+    len = dir->len + 1 + ent->name_len;
+
+    /* Print it */
+    pthread_mutex_lock(&f->lock);
+    if (_out.fmt != OUT_FMT_TEXT) {
+        type = _ft_to_name[(ent->type < EXT2_FT_MAX) ? ent->type
+                                                     : EXT2_FT_UNKNOWN];
+        _out_rec_begin();
+        _out_field_u64("ino", ent->ino);
+        _out_field_str("type", type, strlen(type));
+        _out_field_str("path", path, len);
+        _out_rec_end();
+    }
+    else {
+        _out_bytes(path, len);
+        _out_chr('\n');
+    }
+    pthread_mutex_unlock(&f->lock);
+
+    return sub;
+}
+
+/**
+ * @brief Parallel walk visitor freeing the path of the directory
+ */
+static void _ext2_find_done(void *ctx, _u32 tid, void *dir_data) {
+
+    free(dir_data);
+}
+
+/**
+ * @brief Prints the paths of the entries under the directory matching the
+ *        name patterns and the conditions
+ * @param[in] ino Inode number of the directory
+ * @param[in] nb_args Number of request arguments
+ * @param[in] args Request arguments, name=<glob>, regex=<extended regular
+ *                 expression> and conditions of filter
+ * @note The names are matched as the directories are walked in parallel,
+ *       the inode of an entry is only read when its name matches and a
+ *       condition needs more than the type of the entry
+ */
+void _ext2_print_find(_u64 ino, int nb_args, char **args) {
+
+    static struct ext2_find f;
+    struct ext2_find_dir *root;
+    struct ext2_cond *cond;
+    struct ext2_inode ino_st;
+    _u32 mode_col = _ext2_snap_col("mode", 4);
+    _u8 has_ft = !!(_sb.s_feature_incompat & EXT2_FEATURE_INCOMPAT_FILETYPE);
+    int ret;
+    int i;
+    _u32 c;
+
+    /* Check that the path is a directory */
+    _ext2_ino_to_ino_st(ino, &ino_st);
+    if (!EXT2_IS_INODE_DIR(&ino_st)) {
+        /* Exit with failure */
+        exit_err("Find request needs a directory\n");
+    }
+
+    /* Parse the patterns and the conditions */
+    memset(&f, 0, sizeof(f));
+    for (i = 0; i < nb_args; i++) {
+        if (!strncmp(args[i], "name=", 5)) {
+            _ext2_find_glob(&f, args[i] + 5);
+        }
+        else if (!strncmp(args[i], "regex=", 6)) {
+            if (f.has_re) {
+                regfree(&f.re);
+            }
+            ret = regcomp(&f.re, args[i] + 6, REG_EXTENDED | REG_NOSUB);
+            if (ret) {
+                exit_err("Invalid regular expression %s\n", args[i] + 6);
+            }
+            f.has_re = 1;
+        }
+        else {
+            _ext2_parse_cond(args[i], &f.filter);
+        }
+    }
+
+    /* The inodes are read unless every condition is on the type and the
+     * entries have one */
+    f.need_ino = !has_ft && f.filter.nb_conds;
+    for (c = 0; c < f.filter.nb_conds; c++) {
+        cond = &f.filter.conds[c];
+        if ((cond->col != mode_col) || (cond->mask != 0xF000)) {
+            f.need_ino = 1;
+        }
+    }
+    for (c = 0; c < _nb_threads; c++) {
+        _ext2_snap_resize(&f.rows[c], 1);
+    }
+    pthread_mutex_init(&f.lock, NULL);
+
+    /* Walk the directories from the directory of the path */
+    root = _ext2_find_dir_new(NULL, ".", 1);
+    _out_header("ino\ttype\tpath");
+    ext2_pwalk(ino, root, _ext2_find_visit, _ext2_find_done, &f);
+
+    /* Free the search */
+    for (c = 0; c < _nb_threads; c++) {
+        ext2_snap_free(&f.rows[c]);
+    }
+    if (f.has_re) {
+        regfree(&f.re);
+    }
+    pthread_mutex_destroy(&f.lock);
+}
+
+/* Entry found by a walk gathering the tree under a directory */
+struct ext2_tree_ent {
+    _u32 ino;
+    _u8 type;
+    _u32 path_len;
+    /* Offset of the path in the paths of the worker that found it, then
+     * its address once the entries are joined */
+    union {
+        _u64 path_off;
+        const _u8 *path;
+    };
+};
+
+/* Entries found by a worker */
+struct ext2_tree_list {
+    struct ext2_tree_ent *ents;
+    _u64 nb_ents;
+    _u64 max_ents;
+    _u8 *paths;
+    _u64 paths_len;
+    _u64 max_paths_len;
+};
+
+/**
+ * @brief Appends the entry to the entries of the worker
+ * @param[in] list Entries of the worker
+ * @param[in] dir Path of the directory of the entry
+ * @param[in] ent Entry
+ */
+static void _ext2_tree_add(struct ext2_tree_list *list,
+                           struct ext2_find_dir *dir,
+                           struct ext2_dirent *ent) {
+
+    struct ext2_tree_ent *te;
+    _u64 len = dir->len + 1 + ent->name_len;
+
+    /* Grow the entries and the paths if full */
+    if (list->nb_ents == list->max_ents) {
+        list->max_ents = list->max_ents ? 2 * list->max_ents : 1024;
+        list->ents = realloc(list->ents, list->max_ents * sizeof(*list->ents));
+    }
+    if (list->paths_len + len > list->max_paths_len) {
+        list->max_paths_len = 2 * list->max_paths_len + len + 65536;
+        list->paths = realloc(list->paths, list->max_paths_len);
+    }
+
+    /* Check for failure */
+    if (!list->ents || !list->paths) {
+        /* Exit with failure */
+        exit_err("Failed to allocate the entry list\n");
+    }
+
+    /* Record the entry and its path */
+    te = &list->ents[list->nb_ents++];
+    te->ino = ent->ino;
+    te->type = ent->type;
+    te->path_len = len;
+    te->path_off = list->paths_len;
+    memcpy(list->paths + list->paths_len, dir->path, dir->len);
+    list->paths[list->paths_len + dir->len] = '/';
+    memcpy(list->paths + list->paths_len + dir->len + 1, ent->name,
+           ent->name_len);
+    list->paths_len += len;
+}
+
+/**
+ * @brief Orders the entries by inode number, to read the inode tables in
+ *        their order
+ */
+static int _ext2_tree_ent_cmp(const void *a, const void *b) {
+
+    const struct ext2_tree_ent *ea = a;
+    const struct ext2_tree_ent *eb = b;
+
+    if (ea->ino != eb->ino) {
+        return (ea->ino > eb->ino) ? 1 : -1;
+    }
+
+    return (ea->path > eb->path) - (ea->path < eb->path);
+}
+
+/**
+ * @brief Joins the entries of the workers and orders them by inode number
+ * @param[in] lists Entries of every worker, kept for their paths
+ * @param[out] nb_ents Number of entries
+ * @return Entries, the hard links of an inode next to each other
+ */
+static struct ext2_tree_ent *_ext2_tree_join(struct ext2_tree_list *lists,
+                                             _u64 *nb_ents) {
+
+    struct ext2_tree_ent *ents;
+    _u64 nb = 0;
+    _u32 i;
+    _u64 j;
+
+    /* Allocate the entries */
+    for (i = 0; i < _nb_threads; i++) {
+        nb += lists[i].nb_ents;
+    }
+    ents = malloc((nb + 1) * sizeof(*ents));
+
+    /* Check for failure */
+    if (!ents) {
+        /* Exit with failure */
+        exit_err("Failed to allocate the entry list\n");
+    }
+
+    /* Copy them with the address of their path */
+    nb = 0;
+    for (i = 0; i < _nb_threads; i++) {
+        for (j = 0; j < lists[i].nb_ents; j++) {
+            ents[nb] = lists[i].ents[j];
+            ents[nb].path = lists[i].paths + lists[i].ents[j].path_off;
+            nb++;
+        }
+    }
+    qsort(ents, nb, sizeof(*ents), _ext2_tree_ent_cmp);
+    *nb_ents = nb;
+
+    return ents;
+}
+
+/**
+ * @brief Frees the entries of the workers
+ * @param[in] lists Entries of every worker
+ */
+static void _ext2_tree_free(struct ext2_tree_list *lists) {
+
+    _u32 i;
+
+    for (i = 0; i < _nb_threads; i++) {
+        free(lists[i].ents);
+        free(lists[i].paths);
+    }
+}
+
+/* Match in a window of a file */
+struct ext2_grep_match {
+    _u64 off;
+    _u32 pat;
+};
+
+/* Worker of the content search */
+struct ext2_grep_worker {
+    struct ext2_grep *g;
+    struct ext2_walk w;
+    struct ext2_tree_ent *file;
+    _u64 size;
+    /* Window of the file data, the tail of the previous window is carried
+     * over so that the matches across windows are found */
+    _u8 *win;
+    _u64 win_off;
+    _u64 win_len;
+    _u64 carried;
+    /* Physical blocks waiting to be read into the window at once */
+    _u32 run_pblk;
+    _u32 run_len;
+    /* Matches of the file, printed once it is searched */
+    struct ext2_grep_match *matches;
+    _u64 nb_matches;
+    _u64 max_matches;
+};
+
+/* Content search */
+struct ext2_grep {
+    char **pats;
+    _u32 *pat_lens;
+    _u32 nb_pats;
+    _u32 max_pat_len;
+    struct ext2_tree_list lists[MAX_THREADS];
+    struct ext2_tree_ent *files;
+    struct ext2_grep_worker workers[MAX_THREADS];
+    /* Output lock, the matches are printed by the workers */
+    pthread_mutex_t lock;
+};
+
+/**
+ * @brief Parallel walk visitor recording the regular files
+ */
+static void *_ext2_grep_visit(void *ctx, _u32 tid, void *dir_data,
+                              struct ext2_dirent *ent) {
+
+    struct ext2_grep *g = ctx;
+
+    /* Give the sub directories their path */
+    if (ent->type == EXT2_FT_DIR) {
+        return _ext2_find_dir_new(dir_data, ent->name, ent->name_len);
+    }
+
+    /* Record the regular files */
+    if (ent->type == EXT2_FT_REG_FILE) {
+        _ext2_tree_add(&g->lists[tid], dir_data, ent);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Orders the matches by offset, then pattern
+ */
+static int _ext2_grep_match_cmp(const void *a, const void *b) {
+
+    const struct ext2_grep_match *ma = a;
+    const struct ext2_grep_match *mb = b;
+
+    if (ma->off != mb->off) {
+        return (ma->off > mb->off) ? 1 : -1;
+    }
+
+    return (ma->pat > mb->pat) - (ma->pat < mb->pat);
+}
+
+/**
+ * @brief Reads the pending blocks into the window
+ * @param[in] gw Worker
+ */
+static void _ext2_grep_read(struct ext2_grep_worker *gw) {
+
+    _u64 bs = EXT2_BLOCK_SIZE(&_sb);
+
+    if (gw->run_len) {
+        _ext2_read((_u64)gw->run_pblk * bs, gw->win + gw->win_len,
+                   (_u64)gw->run_len * bs, EXT2_CAT_DATA);
+        gw->win_len += (_u64)gw->run_len * bs;
+        gw->run_len = 0;
+    }
+}
+
+/**
+ * @brief Searches the window for the patterns, adding to the matches of
+ *        the file
+ * @param[in] gw Worker
+ * @param[in] carry Whether the tail of the window is kept for the next
+ *                  window, the data following it
+ * @note The tail carried over from the previous window was searched with
+ *       it, only the matches ending past it are new
+ */
+static void _ext2_grep_search(struct ext2_grep_worker *gw, _u8 carry) {
+
+    struct ext2_grep *g = gw->g;
+    _u64 len = gw->win_len;
+    _u8 *hit;
+    _u8 *pos;
+    _u64 keep;
+    _u32 p;
+
+    /* Search up to the end of the file */
+    if (gw->win_off + len > gw->size) {
+        len = (gw->win_off < gw->size) ? gw->size - gw->win_off : 0;
+    }
+
+    /* Find every match of every pattern */
+    for (p = 0; p < g->nb_pats; p++) {
+        pos = gw->win;
+        while ((hit = memmem(pos, gw->win + len - pos, g->pats[p],
+                             g->pat_lens[p]))) {
+            pos = hit + 1;
+            if (hit - gw->win + g->pat_lens[p] <= gw->carried) {
+                continue;
+            }
+
+            /* Grow the matches if full */
+            if (gw->nb_matches == gw->max_matches) {
+                gw->max_matches = gw->max_matches ? 2 * gw->max_matches
+                                                  : 256;
+                gw->matches = realloc(gw->matches, gw->max_matches
+                                      * sizeof(*gw->matches));
+
+                /* Check for failure */
+                if (!gw->matches) {
+                    /* Exit with failure */
+                    exit_err("Failed to allocate the matches\n");
+                }
+            }
+            gw->matches[gw->nb_matches].off = gw->win_off + (hit - gw->win);
+            gw->matches[gw->nb_matches].pat = p;
+            gw->nb_matches++;
+        }
+    }
+
+    /* Carry the tail of the window over, or empty it */
+    keep = (carry && (len >= g->max_pat_len - 1)) ? g->max_pat_len - 1 : 0;
+    memmove(gw->win, gw->win + len - keep, keep);
+    gw->win_off += len - keep;
+    gw->win_len = keep;
+    gw->carried = keep;
+}
+
+/**
+ * @brief Prints the matches of the file in the file order
+ * @param[in] gw Worker
+ * @note The matches of a file are printed together, under the lock
+ */
+static void _ext2_grep_print(struct ext2_grep_worker *gw) {
+
+    struct ext2_grep *g = gw->g;
+    struct ext2_grep_match *m;
+    _u64 i;
+
+    /* Nothing to print */
+    if (!gw->nb_matches) {
+        return;
+    }
+
+    /* Order the matches of every window and print them */
+    qsort(gw->matches, gw->nb_matches, sizeof(*gw->matches),
+          _ext2_grep_match_cmp);
+    pthread_mutex_lock(&g->lock);
+    for (i = 0; i < gw->nb_matches; i++) {
+        m = &gw->matches[i];
+        if (_out.fmt != OUT_FMT_TEXT) {
+            _out_rec_begin();
+            _out_field_u64("ino", gw->file->ino);
+            _out_field_str("path", gw->file->path, gw->file->path_len);
+            _out_field_u64("offset", m->off);
+            _out_field_str("pattern", g->pats[m->pat], g->pat_lens[m->pat]);
+            _out_rec_end();
+            continue;
+        }
+        _out_bytes(gw->file->path, gw->file->path_len);
+        _out_printf("\t%lu\t%s\n", m->off, g->pats[m->pat]);
+    }
+    pthread_mutex_unlock(&g->lock);
+}
+
+/**
+ * @brief Walker visitor adding the data block to the window
+ * @note Runs of physically contiguous blocks are read at once. A hole
+ *       cannot hold any part of a match, the patterns have no zero byte,
+ *       so the window restarts after it.
+ */
+static int _ext2_grep_visit_blk(struct ext2_walk *w, void *ctx, _u64 lblk,
+                                _u32 pblk, _u8 level) {
+
+    struct ext2_grep_worker *gw = ctx;
+    _u64 bs = EXT2_BLOCK_SIZE(&_sb);
+    _u64 off = lblk * bs;
+    _u64 end = gw->win_off + gw->win_len + (_u64)gw->run_len * bs;
+
+    /* Skip the indirect blocks */
+    if (level) {
+        return EXT2_WALK_CONT;
+    }
+
+    /* If the block does not follow the window search it and restart it
+     * at the block */
+    if (off != end) {
+        _ext2_grep_read(gw);
+        _ext2_grep_search(gw, 0);
+        gw->win_off = off;
+    }
+    /* If the window is full search it, carrying its tail over */
+    else if (end - gw->win_off + bs > GREP_WIN_SIZE) {
+        _ext2_grep_read(gw);
+        _ext2_grep_search(gw, 1);
+    }
+    /* If the block does not continue the run read the run */
+    else if (gw->run_len && (gw->run_pblk + gw->run_len != pblk)) {
+        _ext2_grep_read(gw);
+    }
+
+    /* Add the block to the run */
+    if (!gw->run_len) {
+        gw->run_pblk = pblk;
+    }
+    gw->run_len++;
+
+    return EXT2_WALK_CONT;
+}
+
+/**
+ * @brief Parallel loop body searching a file
+ */
+static void _ext2_grep_file(void *ctx, _u32 tid, _u64 idx) {
+
+    struct ext2_grep *g = ctx;
+    struct ext2_grep_worker *gw = &g->workers[tid];
+    struct ext2_inode ino_st;
+
+    /* Get the inode, skipping what is not a regular file */
+    gw->file = &g->files[idx];
+    _ext2_ino_to_ino_st(gw->file->ino, &ino_st);
+    if (!EXT2_IS_INODE_REG_FILE(&ino_st) || !_ext2_ino_has_tree(&ino_st)) {
+        return;
+    }
+
+    /* Allocate the window of the worker */
+    if (!gw->win) {
+        gw->win = malloc(GREP_WIN_SIZE + g->max_pat_len);
+
+        /* Check for failure */
+        if (!gw->win) {
+            /* Exit with failure */
+            exit_err("Failed to allocate the search window\n");
+        }
+        _ext2_walk_init(&gw->w);
+    }
+
+    /* Stream the data through the window */
+    gw->g = g;
+    gw->size = EXT2_I_SIZE(&ino_st);
+    gw->win_off = 0;
+    gw->win_len = 0;
+    gw->carried = 0;
+    gw->run_len = 0;
+    gw->nb_matches = 0;
+    _ext2_walk(&gw->w, &ino_st, 0, _ext2_grep_visit_blk, gw);
+    _ext2_grep_read(gw);
+    _ext2_grep_search(gw, 0);
+    _ext2_grep_print(gw);
+}
+
+/**
+ * @brief Prints the offsets of the patterns in the regular files under the
+ *        directory
+ * @param[in] ino Inode number of the directory
+ * @param[in] nb_args Number of request arguments
+ * @param[in] args Request arguments, the patterns
+ * @note The regular files are found by a parallel walk first, then
+ *       searched in the inode number order by a parallel loop, a file at a
+ *       time per worker. The data is read a run of contiguous blocks at a
+ *       time into a window searched with memmem for every pattern.
+ */
+void _ext2_print_grep(_u64 ino, int nb_args, char **args) {
+
+    static struct ext2_grep g;
+    struct ext2_inode ino_st;
+    _u64 nb_files;
+    _u32 i;
+
+    /* Check that the path is a directory */
+    _ext2_ino_to_ino_st(ino, &ino_st);
+    if (!EXT2_IS_INODE_DIR(&ino_st)) {
+        /* Exit with failure */
+        exit_err("Grep request needs a directory\n");
+    }
+
+    /* Get the patterns */
+    memset(&g, 0, sizeof(g));
+    if (nb_args < 1) {
+        /* Exit with failure */
+        exit_err("Grep request needs a pattern\n");
+    }
+    g.pats = args;
+    g.nb_pats = nb_args;
+    g.pat_lens = malloc(nb_args * sizeof(*g.pat_lens));
+
+    /* Check for failure */
+    if (!g.pat_lens) {
+        /* Exit with failure */
+        exit_err("Failed to allocate the patterns\n");
+    }
+    for (i = 0; i < g.nb_pats; i++) {
+        g.pat_lens[i] = strlen(args[i]);
+        if (!g.pat_lens[i]) {
+            /* Exit with failure */
+            exit_err("Empty pattern\n");
+        }
+        if (g.pat_lens[i] > g.max_pat_len) {
+            g.max_pat_len = g.pat_lens[i];
+        }
+    }
+    pthread_mutex_init(&g.lock, NULL);
+
+    /* Find the regular files */
+    ext2_pwalk(ino, _ext2_find_dir_new(NULL, ".", 1), _ext2_grep_visit,
+               _ext2_find_done, &g);
+
+    /* Gather them and order them by inode number */
+    g.files = _ext2_tree_join(g.lists, &nb_files);
+
+    /* Search them */
+    _out_header("ino\tpath\toffset\tpattern");
+    ext2_pfor(nb_files, 1, _ext2_grep_file, &g);
+
+    /* Free the search */
+    _ext2_tree_free(g.lists);
+    for (i = 0; i < _nb_threads; i++) {
+        free(g.workers[i].win);
+        free(g.workers[i].matches);
+        _ext2_walk_deinit(&g.workers[i].w);
+    }
+    free(g.files);
+    free(g.pat_lens);
+    pthread_mutex_destroy(&g.lock);
+}
+
+/* Extraction of a tree to the host */
+struct ext2_extract {
+    /* Entries found by each worker */
+    struct ext2_tree_list lists[MAX_THREADS];
+    struct ext2_tree_ent *ents;
+    _u64 nb_ents;
+    /* Walker and copy buffer of each worker */
+    struct ext2_walk walks[MAX_THREADS];
+    _u8 *bufs[MAX_THREADS];
+    /* Counters */
+    _u64 nb_files;
+    _u64 nb_dirs;
+    _u64 nb_links;
+    _u64 nb_bytes;
+    _u64 nb_errs;
+};
+
+/* File being extracted, with the run of blocks waiting to be copied */
+struct ext2_extract_file {
+    struct ext2_extract *x;
+    _u32 tid;
+    int fd;
+    _u64 size;
+    _u64 run_lblk;
+    _u32 run_pblk;
+    _u64 run_len;
+    _u8 failed;
+};
+
+/**
+ * @brief Checks that the name of an entry is a single path component
+ * @param[in] name Name
+ * @param[in] len Length of the name
+ * @return 1 if the name is safe to append to a host path, 0 otherwise
+ */
+static _u8 _ext2_name_is_safe(const _u8 *name, _u32 len) {
+
+    /* Reject the empty, self and parent names */
+    if (!len || ((name[0] == '.') &&
+        ((len == 1) || ((len == 2) && (name[1] == '.'))))) {
+        return 0;
+    }
+
+    /* Reject the separators and the NUL bytes */
+    return !memchr(name, '/', len) && !memchr(name, '\0', len);
+}
+
+/**
+ * @brief Parallel walk visitor creating the directories and recording
+ *        every entry
+ * @note The names come from an image that may be crafted, an entry that
+ *       would escape the destination is reported and skipped, and the walk
+ *       prunes the tree under it. A directory is created once, the walk
+ *       does not reach a directory inode twice
+ */
+static void *_ext2_extract_visit(void *ctx, _u32 tid, void *dir_data,
+                                 struct ext2_dirent *ent) {
+
+    struct ext2_extract *x = ctx;
+    struct ext2_find_dir *dir;
+    struct stat st;
+
+    /* Reject the names that are not a single path component */
+    if (!_ext2_name_is_safe(ent->name, ent->name_len)) {
+        fprintf(stderr, "Unsafe name in %.*s: %.*s\n",
+                (int)((struct ext2_find_dir *)dir_data)->len,
+                ((struct ext2_find_dir *)dir_data)->path,
+                (int)ent->name_len, ent->name);
+        ATOMIC_ADD(x->nb_errs, 1);
+        return NULL;
+    }
+
+    /* Record the entries other than the directories */
+    if (ent->type != EXT2_FT_DIR) {
+        _ext2_tree_add(&x->lists[tid], dir_data, ent);
+        return NULL;
+    }
+
+    /* Create the sub directories before their entries are walked */
+    dir = _ext2_find_dir_new(dir_data, ent->name, ent->name_len);
+    dir = realloc(dir, sizeof(*dir) + dir->len + 1);
+
+    /* Check for failure */
+    if (!dir) {
+        /* Exit with failure */
+        exit_err("Failed to allocate the walk\n");
+    }
+    dir->path[dir->len] = '\0';
+
+    /* Create it, an existing one must be a directory, not a link */
+    if (mkdir(dir->path, 0700) && ((errno != EEXIST) ||
+        lstat(dir->path, &st) || !S_ISDIR(st.st_mode))) {
+        fprintf(stderr, "Failed to create %s: %s\n", dir->path,
+                (errno == EEXIST) ? "not a directory" : strerror(errno));
+        ATOMIC_ADD(x->nb_errs, 1);
+        free(dir);
+        return NULL;
+    }
+
+    /* Record it once created */
+    _ext2_tree_add(&x->lists[tid], dir_data, ent);
+    return dir;
+}
+
+/**
+ * @brief Copies the pending run of blocks to the file
+ * @param[in] xf File being extracted
+ */
+static void _ext2_extract_copy(struct ext2_extract_file *xf) {
+
+    _u64 bs = EXT2_BLOCK_SIZE(&_sb);
+    _u64 off = xf->run_lblk * bs;
+    _u64 dev_off = (_u64)xf->run_pblk * bs;
+    _u64 len = xf->run_len * bs;
+    _u8 *buf = xf->x->bufs[xf->tid];
+    _u64 done;
+    _u64 chunk;
+
+    /* Nothing to copy */
+    xf->run_len = 0;
+    if (xf->failed || (off >= xf->size)) {
+        return;
+    }
+
+    /* Do not copy past the end of the file */
+    if (len > xf->size - off) {
+        len = xf->size - off;
+    }
+
+    /* Copy in the kernel if possible */
+    done = _ext2_copy(dev_off, xf->fd, off, len);
+
+    /* Read and write the rest a buffer at a time */
+    while (done < len) {
+        chunk = (len - done < COPY_BUF_SIZE) ? len - done : COPY_BUF_SIZE;
+        _ext2_read(dev_off + done, buf, chunk, EXT2_CAT_DATA);
+        if (pwrite64(xf->fd, buf, chunk, off + done) != (ssize_t)chunk) {
+            xf->failed = 1;
+            return;
+        }
+        done += chunk;
+    }
+    ATOMIC_ADD(xf->x->nb_bytes, len);
+}
+
+/**
+ * @brief Walker visitor coalescing the data blocks into runs contiguous
+ *        both logically and physically
+ */
+static int _ext2_extract_visit_blk(struct ext2_walk *w, void *ctx, _u64 lblk,
+                                   _u32 pblk, _u8 level) {
+
+    struct ext2_extract_file *xf = ctx;
+
+    /* Skip the indirect blocks */
+    if (level) {
+        return EXT2_WALK_CONT;
+    }
+
+    /* If the block does not continue the run copy the run */
+    if (xf->run_len && ((xf->run_lblk + xf->run_len != lblk) ||
+        (xf->run_pblk + xf->run_len != pblk))) {
+        _ext2_extract_copy(xf);
+    }
+
+    /* Add the block to the run */
+    if (!xf->run_len) {
+        xf->run_lblk = lblk;
+        xf->run_pblk = pblk;
+    }
+    xf->run_len++;
+
+    return xf->failed ? EXT2_WALK_STOP : EXT2_WALK_CONT;
+}
+
+/**
+ * @brief Creates the regular file with the data of the inode
+ * @param[in] x Extraction
+ * @param[in] tid Index of the worker thread
+ * @param[in] ino_st Inode structure
+ * @param[in] path Path of the file
+ * @return 0 on success, -1 on failure
+ * @note Holes are left unwritten, so the file keeps them
+ */
+static int _ext2_extract_reg(struct ext2_extract *x, _u32 tid,
+                             struct ext2_inode *ino_st, const char *path) {
+
+    struct ext2_extract_file xf = {0};
+
+    /* Create the file, never through an existing link */
+    xf.fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0600);
+    if (xf.fd == -1) {
+        return -1;
+    }
+
+    /* Allocate the buffers of the worker */
+    if (!x->bufs[tid]) {
+        x->bufs[tid] = malloc(COPY_BUF_SIZE);
+
+        /* Check for failure */
+        if (!x->bufs[tid]) {
+            /* Exit with failure */
+            exit_err("Failed to allocate the copy buffer\n");
+        }
+        _ext2_walk_init(&x->walks[tid]);
+    }
+
+    /* Copy the runs of blocks */
+    xf.x = x;
+    xf.tid = tid;
+    xf.size = EXT2_I_SIZE(ino_st);
+    if (_ext2_ino_has_tree(ino_st)) {
+        _ext2_walk(&x->walks[tid], ino_st, 0, _ext2_extract_visit_blk, &xf);
+        _ext2_extract_copy(&xf);
+    }
+
+    /* Set the size, past the trailing hole if any */
+    if (!xf.failed && ftruncate64(xf.fd, xf.size)) {
+        xf.failed = 1;
+    }
+    if (close(xf.fd)) {
+        xf.failed = 1;
+    }
+
+    return xf.failed ? -1 : 0;
+}
+
+/**
+ * @brief Reads the target of the symbolic link
+ * @param[in] ino_st Inode structure
+ * @param[out] target Target, NUL terminated
+ * @return Length of the target, -1 if it is invalid
+ */
+static int _ext2_lnk_target(struct ext2_inode *ino_st,
+                            char target[MAX_PATH_LEN]) {
+
+    _u64 bs = EXT2_BLOCK_SIZE(&_sb);
+    _u64 size = EXT2_I_SIZE(ino_st);
+
+    /* Check the length of the target */
+    if ((size >= MAX_PATH_LEN) || (size > bs)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    /* A fast link holds the target in its block numbers */
+    if (!_ext2_ino_has_tree(ino_st)) {
+        if (size >= sizeof(ino_st->i_block)) {
+            errno = EINVAL;
+            return -1;
+        }
+        memcpy(target, ino_st->i_block, size);
+    }
+    /* Otherwise the target is in the first block */
+    else {
+        _ext2_read((_u64)ino_st->i_block[0] * bs, target, size,
+                   EXT2_CAT_DATA);
+    }
+    target[size] = '\0';
+
+    return size;
+}
+
+/**
+ * @brief Returns the device number of the device inode
+ * @param[in] ino_st Inode structure
+ * @return Device number
+ */
+static dev_t _ext2_ino_rdev(struct ext2_inode *ino_st) {
+
+    _u32 old = ino_st->i_block[0];
+    _u32 new = ino_st->i_block[1];
+
+    /* Decode the old 8:8 or the new 12:20 device number */
+    if (old) {
+        return makedev((old >> 8) & 0xFF, old & 0xFF);
+    }
+
+    return makedev((new >> 8) & 0xFFF, (new & 0xFF) | ((new >> 12) & 0xFFF00));
+}
+
+/**
+ * @brief Creates the symbolic link of the inode
+ * @param[in] ino_st Inode structure
+ * @param[in] path Path of the link
+ * @return 0 on success, -1 on failure
+ */
+static int _ext2_extract_lnk(struct ext2_inode *ino_st, const char *path) {
+
+    char target[MAX_PATH_LEN];
+
+    if (_ext2_lnk_target(ino_st, target) < 0) {
+        return -1;
+    }
+
+    return symlink(target, path);
+}
+
+/**
+ * @brief Creates the device, fifo or socket node of the inode
+ * @param[in] ino_st Inode structure
+ * @param[in] path Path of the node
+ * @return 0 on success, -1 on failure
+ */
+static int _ext2_extract_node(struct ext2_inode *ino_st, const char *path) {
+
+    return mknod(path, ino_st->i_mode & 0xF000, _ext2_ino_rdev(ino_st));
+}
+
+/**
+ * @brief Sets the owner, mode and times of the inode on the file
+ * @param[in] ino_st Inode structure
+ * @param[in] path Path of the file
+ * @return 0 on success, -1 on failure
+ * @note Setting the owner needs privileges, its failures are ignored
+ */
+static int _ext2_extract_attrs(struct ext2_inode *ino_st, const char *path) {
+
+    struct timespec ts[2];
+    _u8 is_lnk = ((ino_st->i_mode & 0xF000) == 0xA000);
+
+    /* Set the owner, the mode (a link has none) and the times */
+    if (lchown(path, inode_uid(*ino_st), inode_gid(*ino_st))) {
+        errno = 0;
+    }
+    if (!is_lnk && chmod(path, ino_st->i_mode & 07777)) {
+        return -1;
+    }
+    ts[0].tv_sec = ino_st->i_atime;
+    ts[0].tv_nsec = 0;
+    ts[1].tv_sec = ino_st->i_mtime;
+    ts[1].tv_nsec = 0;
+
+    return utimensat(AT_FDCWD, path, ts, AT_SYMLINK_NOFOLLOW);
+}
+
+/**
+ * @brief Creates the file of the inode at the path, with its attributes
+ * @param[in] x Extraction
+ * @param[in] tid Index of the worker thread
+ * @param[in] ino Inode number
+ * @param[in] path Path of the file
+ */
+static void _ext2_extract_ino(struct ext2_extract *x, _u32 tid, _u64 ino,
+                              const char *path) {
+
+    struct ext2_inode ino_st;
+    int ret;
+
+    /* Create the file for its type */
+    _ext2_ino_to_ino_st(ino, &ino_st);
+    switch (ino_st.i_mode & 0xF000) {
+    case 0x8000:
+        unlink(path);
+        ret = _ext2_extract_reg(x, tid, &ino_st, path);
+        break;
+    case 0xA000:
+        unlink(path);
+        ret = _ext2_extract_lnk(&ino_st, path);
+        break;
+    case 0x2000:
+    case 0x6000:
+    case 0x1000:
+    case 0xC000:
+        unlink(path);
+        ret = _ext2_extract_node(&ino_st, path);
+        break;
+    default:
+        errno = EINVAL;
+        ret = -1;
+    }
+
+    /* Then set its attributes */
+    if (!ret) {
+        ret = _ext2_extract_attrs(&ino_st, path);
+    }
+
+    /* Report the failure */
+    if (ret) {
+        fprintf(stderr, "Failed to extract %s: %s\n", path, strerror(errno));
+        ATOMIC_ADD(x->nb_errs, 1);
+        return;
+    }
+    ATOMIC_ADD(x->nb_files, 1);
+}
+
+/**
+ * @brief Copies the path of the entry into a NUL terminated buffer
+ * @param[in] te Entry
+ * @param[out] path Buffer
+ * @return 0 on success, -1 if the path is too long
+ */
+static int _ext2_extract_path(struct ext2_tree_ent *te,
+                              char path[MAX_PATH_LEN]) {
+
+    if (te->path_len >= MAX_PATH_LEN) {
+        fprintf(stderr, "Path too long: %.*s\n", (int)te->path_len, te->path);
+        return -1;
+    }
+    memcpy(path, te->path, te->path_len);
+    path[te->path_len] = '\0';
+
+    return 0;
+}
+
+/**
+ * @brief Parallel loop body extracting an entry other than a directory
+ * @note The hard links of an inode are next to each other: the first one
+ *       extracts the file and links the others to it
+ */
+static void _ext2_extract_ent(void *ctx, _u32 tid, _u64 idx) {
+
+    struct ext2_extract *x = ctx;
+    struct ext2_tree_ent *te = &x->ents[idx];
+    char first[MAX_PATH_LEN];
+    char path[MAX_PATH_LEN];
+    _u64 i;
+
+    /* Skip the directories and the links handled by the first entry */
+    if ((te->type == EXT2_FT_DIR) ||
+        (idx && (x->ents[idx - 1].ino == te->ino))) {
+        return;
+    }
+
+    /* Extract the file */
+    if (_ext2_extract_path(te, first)) {
+        ATOMIC_ADD(x->nb_errs, 1);
+        return;
+    }
+    _ext2_extract_ino(x, tid, te->ino, first);
+
+    /* Link its other names to it */
+    for (i = idx + 1; (i < x->nb_ents) && (x->ents[i].ino == te->ino); i++) {
+        if (_ext2_extract_path(&x->ents[i], path)) {
+            ATOMIC_ADD(x->nb_errs, 1);
+            continue;
+        }
+        unlink(path);
+        if (link(first, path)) {
+            fprintf(stderr, "Failed to link %s: %s\n", path, strerror(errno));
+            ATOMIC_ADD(x->nb_errs, 1);
+            continue;
+        }
+        ATOMIC_ADD(x->nb_links, 1);
+    }
+}
+
+/**
+ * @brief Orders the entries deepest path first, a directory after the
+ *        ones under it
+ */
+static int _ext2_extract_dir_cmp(const void *a, const void *b) {
+
+    const struct ext2_tree_ent *ea = a;
+    const struct ext2_tree_ent *eb = b;
+
+    return (ea->path_len < eb->path_len) - (ea->path_len > eb->path_len);
+}
+
+/**
+ * @brief Sets the attributes of a directory
+ * @param[in] x Extraction
+ * @param[in] ino Inode number of the directory
+ * @param[in] path Path of the directory
+ */
+static void _ext2_extract_dir(struct ext2_extract *x, _u64 ino,
+                              const char *path) {
+
+    struct ext2_inode ino_st;
+
+    _ext2_ino_to_ino_st(ino, &ino_st);
+    if (_ext2_extract_attrs(&ino_st, path)) {
+        fprintf(stderr, "Failed to extract %s: %s\n", path, strerror(errno));
+        ATOMIC_ADD(x->nb_errs, 1);
+        return;
+    }
+    x->nb_dirs++;
+}
+
+/**
+ * @brief Recreates the tree under the path on the host, with the contents,
+ *        modes, owners and times of the files
+ * @param[in] ino Inode number of the path
+ * @param[in] nb_args Number of request arguments
+ * @param[in] args Request arguments, the destination path
+ * @note The directories are walked in parallel and created as they are
+ *       found, then the other files are extracted in inode number order by
+ *       a parallel loop, a file at a time per worker. The data is copied a
+ *       run of blocks contiguous both logically and physically at a time,
+ *       with copy_file_range when the device and the destination allow it.
+ *       The attributes of the directories are set last, deepest first.
+ */
+void _ext2_print_extract(_u64 ino, int nb_args, char **args) {
+
+    static struct ext2_extract x;
+    struct ext2_inode ino_st;
+    struct ext2_tree_ent *dirs;
+    char path[MAX_PATH_LEN];
+    const char *dest;
+    _u64 nb_dirs = 0;
+    _u64 i;
+
+    /* Get the destination */
+    memset(&x, 0, sizeof(x));
+    if (nb_args < 1) {
+        /* Exit with failure */
+        exit_err("Extract request needs a destination\n");
+    }
+    dest = args[0];
+
+    /* A single file is extracted to the destination */
+    _ext2_ino_to_ino_st(ino, &ino_st);
+    if (!EXT2_IS_INODE_DIR(&ino_st)) {
+        _ext2_extract_ino(&x, 0, ino, dest);
+    }
+    else {
+        /* Create the destination */
+        if (mkdir(dest, 0700) && (errno != EEXIST)) {
+            /* Exit with failure */
+            exit_err("Failed to create %s\n", dest);
+        }
+
+        /* Create the directories and find the other files */
+        ext2_pwalk(ino, _ext2_find_dir_new(NULL, dest, strlen(dest)),
+                   _ext2_extract_visit, _ext2_find_done, &x);
+
+        /* Gather them and order them by inode number */
+        x.ents = _ext2_tree_join(x.lists, &x.nb_ents);
+
+        /* Extract the files */
+        ext2_pfor(x.nb_ents, 1, _ext2_extract_ent, &x);
+
+        /* Set the attributes of the directories, deepest first */
+        dirs = x.ents;
+        for (i = 0; i < x.nb_ents; i++) {
+            if (x.ents[i].type == EXT2_FT_DIR) {
+                dirs[nb_dirs++] = x.ents[i];
+            }
+        }
+        qsort(dirs, nb_dirs, sizeof(*dirs), _ext2_extract_dir_cmp);
+        for (i = 0; i < nb_dirs; i++) {
+            if (!_ext2_extract_path(&dirs[i], path)) {
+                _ext2_extract_dir(&x, dirs[i].ino, path);
+            }
+        }
+        _ext2_extract_dir(&x, ino, dest);
+    }
+
+    /* Print the summary */
+    _out_printf("%s: %lu files, %lu directories, %lu links, %lu bytes, "
+                "%lu errors\n", dest, x.nb_files, x.nb_dirs, x.nb_links,
+                x.nb_bytes, x.nb_errs);
+
+    /* Free the extraction */
+    _ext2_tree_free(x.lists);
+    for (i = 0; i < _nb_threads; i++) {
+        free(x.bufs[i]);
+        _ext2_walk_deinit(&x.walks[i]);
+    }
+    free(x.ents);
+}
+
+/* Archive format - POSIX ustar, with pax headers for what does not fit */
+#define TAR_FMT_USTAR    (0)
+/* Archive format - cpio new ASCII (newc) */
+#define TAR_FMT_NEWC     (1)
+
+/* Size of a tar block and of a tar record, the archive is padded to it */
+#define TAR_BLK_SIZE     (512u)
+#define TAR_REC_SIZE     (20u * TAR_BLK_SIZE)
+/* Largest size, owner and name of a ustar header */
+#define TAR_MAX_SIZE     (077777777777ull)
+#define TAR_MAX_ID       (07777777u)
+#define TAR_NAME_LEN     (100u)
+
+/* Entry of the archive with its inode */
+struct ext2_tar_ent {
+    struct ext2_tree_ent *te;
+    struct ext2_inode ino_st;
+    /* First block of the tree, for the physical order */
+    _u32 key;
+};
+
+/* Archive of a tree */
+struct ext2_tar {
+    /* Entries found by each worker */
+    struct ext2_tree_list lists[MAX_THREADS];
+    struct ext2_tree_ent *tes;
+    struct ext2_tar_ent *ents;
+    _u64 nb_ents;
+    _u8 fmt;
+    _u8 phys;
+    /* Number of bytes output */
+    _u64 len;
+    /* Walker and state of the file being archived */
+    struct ext2_walk w;
+    _u64 size;
+    _u64 done;
+    _u64 run_lblk;
+    _u32 run_pblk;
+    _u64 run_len;
+};
+
+/**
+ * @brief Parallel walk visitor recording every entry
+ */
+static void *_ext2_tar_visit(void *ctx, _u32 tid, void *dir_data,
+                             struct ext2_dirent *ent) {
+
+    struct ext2_tar *t = ctx;
+
+    /* Record the entry */
+    _ext2_tree_add(&t->lists[tid], dir_data, ent);
+
+    /* Give the sub directories their path */
+    if (ent->type == EXT2_FT_DIR) {
+        return _ext2_find_dir_new(dir_data, ent->name, ent->name_len);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Parallel loop body reading the inode of an entry
+ */
+static void _ext2_tar_ino(void *ctx, _u32 tid, _u64 idx) {
+
+    struct ext2_tar *t = ctx;
+    struct ext2_tar_ent *e = &t->ents[idx];
+    _u32 i;
+
+    /* Read the inode */
+    e->te = &t->tes[idx];
+    _ext2_ino_to_ino_st(e->te->ino, &e->ino_st);
+
+    /* Key the regular files on the first block of their tree */
+    e->key = 0;
+    if (EXT2_IS_INODE_REG_FILE(&e->ino_st) &&
+        _ext2_ino_has_tree(&e->ino_st)) {
+        for (i = 0; (i < EXT2_N_BLOCKS) && !e->key; i++) {
+            e->key = e->ino_st.i_block[i];
+        }
+    }
+}
+
+/* Archive being ordered, for the comparison */
+static struct ext2_tar *_tar_cmp;
+
+/**
+ * @brief Orders the entries of the archive: the files other than the
+ *        directories in inode number order or physical order, the names of
+ *        an inode next to each other, then the directories, a child before
+ *        its parent
+ */
+static int _ext2_tar_ent_cmp(const void *a, const void *b) {
+
+    const struct ext2_tar_ent *ea = a;
+    const struct ext2_tar_ent *eb = b;
+    _u8 da = EXT2_IS_INODE_DIR(&ea->ino_st);
+    _u8 db = EXT2_IS_INODE_DIR(&eb->ino_st);
+    _u32 len;
+    int ret;
+
+    /* Directories last, the longer paths first */
+    if (da != db) {
+        return da - db;
+    }
+    if (da && (ea->te->path_len != eb->te->path_len)) {
+        return (ea->te->path_len < eb->te->path_len) ? 1 : -1;
+    }
+
+    /* Then the first block if requested and the inode number */
+    if (!da && _tar_cmp->phys && (ea->key != eb->key)) {
+        return (ea->key > eb->key) ? 1 : -1;
+    }
+    if (ea->te->ino != eb->te->ino) {
+        return (ea->te->ino > eb->te->ino) ? 1 : -1;
+    }
+
+    /* Then the path, so the order does not depend on the walk */
+    len = (ea->te->path_len < eb->te->path_len) ? ea->te->path_len
+                                                : eb->te->path_len;
+    ret = memcmp(ea->te->path, eb->te->path, len);
+    if (ret) {
+        return ret;
+    }
+
+    return (ea->te->path_len > eb->te->path_len) -
+           (ea->te->path_len < eb->te->path_len);
+}
+
+/**
+ * @brief Writes the number in octal into a ustar header field
+ * @param[out] field Field
+ * @param[in] len Length of the field, with its NUL terminator
+ * @param[in] val Number
+ */
+static void _ext2_tar_oct(char *field, _u32 len, _u64 val) {
+
+    char tmp[24];
+
+    snprintf(tmp, sizeof(tmp), "%0*lo", (int)(len - 1), val);
+    memcpy(field, tmp, len);
+}
+
+/**
+ * @brief Appends a record to a pax extended header
+ * @param[in,out] pax Header
+ * @param[in,out] len Length of the header
+ * @param[in] key Keyword
+ * @param[in] val Value
+ * @param[in] val_len Length of the value
+ */
+static void _ext2_tar_pax(char *pax, _u32 *len, const char *key,
+                          const char *val, _u32 val_len) {
+
+    _u32 rec_len = strlen(key) + val_len + 3;
+    _u32 nb_digits = 1;
+    _u32 i;
+
+    /* The length of the record counts its own digits */
+    for (i = 10; i <= rec_len + nb_digits; i *= 10) {
+        nb_digits++;
+    }
+    rec_len += nb_digits;
+
+    *len += sprintf(pax + *len, "%u %s=", rec_len, key);
+    memcpy(pax + *len, val, val_len);
+    *len += val_len;
+    pax[(*len)++] = '\n';
+}
+
+/**
+ * @brief Outputs bytes of the archive
+ * @param[in] t Archive
+ * @param[in] data Bytes, NULL for zeros
+ * @param[in] len Number of bytes
+ */
+static inline void _ext2_tar_bytes(struct ext2_tar *t, const void *data,
+                                   _u64 len) {
+
+    _out_bytes(data, len);
+    t->len += len;
+}
+
+/**
+ * @brief Outputs the zeros padding the archive to the alignment
+ * @param[in] t Archive
+ * @param[in] align Alignment
+ */
+static inline void _ext2_tar_pad(struct ext2_tar *t, _u64 align) {
+
+    _ext2_tar_bytes(t, NULL, (align - t->len % align) % align);
+}
+
+/**
+ * @brief Outputs the ustar header of an entry, after a pax extended header
+ *        if its path, link target, size or owner does not fit
+ * @param[in] t Archive
+ * @param[in] ino_st Inode structure
+ * @param[in] type Type flag
+ * @param[in] path Path
+ * @param[in] path_len Length of the path
+ * @param[in] link Link target, NULL if none
+ * @param[in] link_len Length of the link target
+ * @param[in] size Size of the data
+ */
+static void _ext2_tar_ustar(struct ext2_tar *t, struct ext2_inode *ino_st,
+                            char type,
+                            const char *path, _u32 path_len, const char *link,
+                            _u32 link_len, _u64 size) {
+
+    static char pax[2 * MAX_PATH_LEN + 256];
+    _u8 hdr[TAR_BLK_SIZE];
+    _u32 uid = inode_uid(*ino_st);
+    _u32 gid = inode_gid(*ino_st);
+    _u32 pax_len = 0;
+    char num[24];
+    _u32 sum = 0;
+    dev_t dev;
+    _u32 i;
+
+    /* Put what does not fit in the header in pax records */
+    if (path_len > TAR_NAME_LEN) {
+        _ext2_tar_pax(pax, &pax_len, "path", path, path_len);
+    }
+    if (link && (link_len > TAR_NAME_LEN)) {
+        _ext2_tar_pax(pax, &pax_len, "linkpath", link, link_len);
+    }
+    if (size > TAR_MAX_SIZE) {
+        _ext2_tar_pax(pax, &pax_len, "size", num,
+                      sprintf(num, "%lu", size));
+    }
+    if (uid > TAR_MAX_ID) {
+        _ext2_tar_pax(pax, &pax_len, "uid", num, sprintf(num, "%u", uid));
+    }
+    if (gid > TAR_MAX_ID) {
+        _ext2_tar_pax(pax, &pax_len, "gid", num, sprintf(num, "%u", gid));
+    }
+
+    /* Output the pax header first if any */
+    if (pax_len) {
+        memset(hdr, 0, sizeof(hdr));
+        strcpy(hdr, "PaxHeader");
+        _ext2_tar_oct(hdr + 100, 8, 0644);
+        _ext2_tar_oct(hdr + 108, 8, 0);
+        _ext2_tar_oct(hdr + 116, 8, 0);
+        _ext2_tar_oct(hdr + 124, 12, pax_len);
+        _ext2_tar_oct(hdr + 136, 12, ino_st->i_mtime);
+        hdr[156] = 'x';
+        memcpy(hdr + 257, "ustar\0" "00", 8);
+        memset(hdr + 148, ' ', 8);
+        for (i = 0; i < TAR_BLK_SIZE; i++) {
+            sum += hdr[i];
+        }
+        _ext2_tar_oct(hdr + 148, 7, sum);
+        _ext2_tar_bytes(t, hdr, TAR_BLK_SIZE);
+        _ext2_tar_bytes(t, pax, pax_len);
+        _ext2_tar_pad(t, TAR_BLK_SIZE);
+        sum = 0;
+    }
+
+    /* Fill the header, the fields too large were zeroed by pax */
+    memset(hdr, 0, sizeof(hdr));
+    memcpy(hdr, path, (path_len < TAR_NAME_LEN) ? path_len : TAR_NAME_LEN);
+    _ext2_tar_oct(hdr + 100, 8, ino_st->i_mode & 07777);
+    _ext2_tar_oct(hdr + 108, 8, (uid > TAR_MAX_ID) ? 0 : uid);
+    _ext2_tar_oct(hdr + 116, 8, (gid > TAR_MAX_ID) ? 0 : gid);
+    _ext2_tar_oct(hdr + 124, 12, (size > TAR_MAX_SIZE) ? 0 : size);
+    _ext2_tar_oct(hdr + 136, 12, ino_st->i_mtime);
+    hdr[156] = type;
+    if (link) {
+        memcpy(hdr + 157, link,
+               (link_len < TAR_NAME_LEN) ? link_len : TAR_NAME_LEN);
+    }
+    memcpy(hdr + 257, "ustar\0" "00", 8);
+    if ((type == '3') || (type == '4')) {
+        dev = _ext2_ino_rdev(ino_st);
+        _ext2_tar_oct(hdr + 329, 8, major(dev));
+        _ext2_tar_oct(hdr + 337, 8, minor(dev));
+    }
+
+    /* Checksum the header with the checksum field as spaces */
+    memset(hdr + 148, ' ', 8);
+    for (i = 0; i < TAR_BLK_SIZE; i++) {
+        sum += hdr[i];
+    }
+    _ext2_tar_oct(hdr + 148, 7, sum);
+    _ext2_tar_bytes(t, hdr, TAR_BLK_SIZE);
+}
+
+/**
+ * @brief Outputs the newc header of an entry
+ * @param[in] t Archive
+ * @param[in] ino_st Inode structure
+ * @param[in] ino Inode number
+ * @param[in] nlink Number of names of the inode in the archive
+ * @param[in] path Path
+ * @param[in] path_len Length of the path
+ * @param[in] size Size of the data
+ */
+static void _ext2_tar_newc(struct ext2_tar *t, struct ext2_inode *ino_st,
+                           _u64 ino, _u32 nlink, const char *path,
+                           _u32 path_len, _u64 size) {
+
+    _u32 type = ino_st->i_mode & 0xF000;
+    char hdr[112];
+    dev_t dev = 0;
+
+    /* Get the device number of the device nodes */
+    if ((type == 0x2000) || (type == 0x6000)) {
+        dev = _ext2_ino_rdev(ino_st);
+    }
+
+    /* A directory has its own link count */
+    if (type == 0x4000) {
+        nlink = ino_st->i_links_count;
+    }
+
+    /* Output the header, the name and their padding */
+    snprintf(hdr, sizeof(hdr), "070701%08lX%08X%08X%08X%08X%08X%08lX%08X"
+             "%08X%08X%08X%08X%08X", ino, ino_st->i_mode, inode_uid(*ino_st),
+             inode_gid(*ino_st), nlink, ino_st->i_mtime, size, 0, 0,
+             major(dev), minor(dev), path_len + 1, 0);
+    _ext2_tar_bytes(t, hdr, 110);
+    _ext2_tar_bytes(t, path, path_len);
+    _ext2_tar_bytes(t, NULL, 1);
+    _ext2_tar_pad(t, 4);
+}
+
+/**
+ * @brief Outputs the pending run of blocks of the file, after the zeros of
+ *        the hole before it
+ * @param[in] t Archive
+ */
+static void _ext2_tar_run(struct ext2_tar *t) {
+
+    _u64 bs = EXT2_BLOCK_SIZE(&_sb);
+    _u64 off = t->run_lblk * bs;
+    _u64 dev_off = (_u64)t->run_pblk * bs;
+    _u64 len = t->run_len * bs;
+    _u64 done = 0;
+    _u64 chunk;
+
+    /* Nothing to output */
+    t->run_len = 0;
+    if (!len || (off >= t->size)) {
+        return;
+    }
+
+    /* Output the hole as zeros */
+    _ext2_tar_bytes(t, NULL, off - t->done);
+
+    /* Do not output past the end of the file */
+    if (len > t->size - off) {
+        len = t->size - off;
+    }
+
+    /* Send the large runs in the kernel if possible */
+    if (len >= SEND_MIN_SIZE) {
+        ext2_out_flush();
+        done = _ext2_send(dev_off, len);
+    }
+
+    /* Read the rest into the output buffer */
+    while (done < len) {
+        chunk = OUT_BUF_SIZE - _out.len;
+        if (!chunk) {
+            ext2_out_flush();
+            chunk = OUT_BUF_SIZE;
+        }
+        if (chunk > len - done) {
+            chunk = len - done;
+        }
+        _ext2_read(dev_off + done, _out.buf + _out.len, chunk, EXT2_CAT_DATA);
+        _out.len += chunk;
+        done += chunk;
+    }
+    t->done = off + len;
+    t->len += len;
+}
+
+/**
+ * @brief Walker visitor coalescing the data blocks into runs contiguous
+ *        both logically and physically
+ */
+static int _ext2_tar_visit_blk(struct ext2_walk *w, void *ctx, _u64 lblk,
+                               _u32 pblk, _u8 level) {
+
+    struct ext2_tar *t = ctx;
+
+    /* Skip the indirect blocks */
+    if (level) {
+        return EXT2_WALK_CONT;
+    }
+
+    /* If the block does not continue the run output the run */
+    if (t->run_len && ((t->run_lblk + t->run_len != lblk) ||
+        (t->run_pblk + t->run_len != pblk))) {
+        _ext2_tar_run(t);
+    }
+
+    /* Add the block to the run */
+    if (!t->run_len) {
+        t->run_lblk = lblk;
+        t->run_pblk = pblk;
+    }
+    t->run_len++;
+
+    return EXT2_WALK_CONT;
+}
+
+/**
+ * @brief Outputs the data of the regular file and its padding
+ * @param[in] t Archive
+ * @param[in] ino_st Inode structure
+ */
+static void _ext2_tar_data(struct ext2_tar *t, struct ext2_inode *ino_st) {
+
+    /* Output the runs of blocks and the holes */
+    t->size = EXT2_I_SIZE(ino_st);
+    t->done = 0;
+    t->run_len = 0;
+    if (_ext2_ino_has_tree(ino_st)) {
+        _ext2_walk(&t->w, ino_st, 0, _ext2_tar_visit_blk, t);
+        _ext2_tar_run(t);
+    }
+
+    /* Then the trailing hole and the padding */
+    _ext2_tar_bytes(t, NULL, t->size - t->done);
+    _ext2_tar_pad(t, (t->fmt == TAR_FMT_USTAR) ? TAR_BLK_SIZE : 4);
+}
+
+/**
+ * @brief Outputs an entry of the archive
+ * @param[in] t Archive
+ * @param[in] e Entry
+ * @param[in] first First name of the inode in the archive, NULL if it is
+ *                  the first
+ * @param[in] nlink Number of names of the inode in the archive
+ * @param[in] last Whether it is the last name of the inode in the archive
+ */
+static void _ext2_tar_ent(struct ext2_tar *t, struct ext2_tar_ent *e,
+                          struct ext2_tar_ent *first, _u32 nlink, _u8 last) {
+
+    struct ext2_inode *ino_st = &e->ino_st;
+    char path[MAX_PATH_LEN + 1];
+    char target[MAX_PATH_LEN];
+    _u32 path_len = e->te->path_len;
+    _u32 type = ino_st->i_mode & 0xF000;
+    _u64 size = EXT2_I_SIZE(ino_st);
+    int target_len = 0;
+    char flag;
+
+    /* Get the path, a directory ends with a slash in a tar */
+    if (path_len >= MAX_PATH_LEN) {
+        fprintf(stderr, "Path too long: %.*s\n", (int)path_len, e->te->path);
+        return;
+    }
+    memcpy(path, e->te->path, path_len);
+    if ((type == 0x4000) && (t->fmt == TAR_FMT_USTAR)) {
+        path[path_len++] = '/';
+    }
+
+    /* Get the target of the links */
+    if (type == 0xA000) {
+        target_len = _ext2_lnk_target(ino_st, target);
+        if (target_len < 0) {
+            fprintf(stderr, "Failed to read the link %.*s: %s\n",
+                    (int)path_len, path, strerror(errno));
+            return;
+        }
+    }
+
+    /* A newc entry carries the data of a file with its last name */
+    if (t->fmt == TAR_FMT_NEWC) {
+        if ((type == 0x8000) && (size > 0xFFFFFFFFu)) {
+            fprintf(stderr, "File too large for newc: %.*s\n",
+                    (int)path_len, path);
+            return;
+        }
+        if (type == 0xA000) {
+            size = target_len;
+        }
+        else if ((type != 0x8000) || !last) {
+            size = 0;
+        }
+        _ext2_tar_newc(t, ino_st, e->te->ino, nlink, path, path_len, size);
+        if (type == 0xA000) {
+            _ext2_tar_bytes(t, target, target_len);
+            _ext2_tar_pad(t, 4);
+        }
+        else if (size) {
+            _ext2_tar_data(t, ino_st);
+        }
+        return;
+    }
+
+    /* A ustar entry of a name after the first is a hard link to it */
+    if (first) {
+        _ext2_tar_ustar(t, ino_st, '1', path, path_len, first->te->path,
+                        first->te->path_len, 0);
+        return;
+    }
+
+    /* Otherwise it carries the type of the file */
+    switch (type) {
+    case 0x8000:
+        _ext2_tar_ustar(t, ino_st, '0', path, path_len, NULL, 0, size);
+        _ext2_tar_data(t, ino_st);
+        return;
+    case 0xA000:
+        _ext2_tar_ustar(t, ino_st, '2', path, path_len, target, target_len,
+                        0);
+        return;
+    case 0x4000:
+        flag = '5';
+        break;
+    case 0x2000:
+        flag = '3';
+        break;
+    case 0x6000:
+        flag = '4';
+        break;
+    case 0x1000:
+        flag = '6';
+        break;
+    default:
+        fprintf(stderr, "Skipping %.*s, a socket or of an unknown type\n",
+                (int)path_len, path);
+        return;
+    }
+    _ext2_tar_ustar(t, ino_st, flag, path, path_len, NULL, 0, 0);
+}
+
+/**
+ * @brief Streams an archive of the tree under the directory to the
+ *        standard output
+ * @param[in] ino Inode number of the directory
+ * @param[in] nb_args Number of request arguments
+ * @param[in] args Request arguments, an optional format=ustar|newc and
+ *                 order=ino|phys
+ * @note The directories are walked in parallel and the inodes of the
+ *       entries read by a parallel loop. The files come in inode number
+ *       order, or in the order of their first block so the data is read in
+ *       one sweep of the device, and the directories last, deepest first,
+ *       so that extracting the files does not change the times restored on
+ *       them. The large runs of contiguous blocks are sent from the device
+ *       with sendfile when it and the output allow it.
+ */
+void _ext2_print_tar(_u64 ino, int nb_args, char **args) {
+
+    static struct ext2_tar t;
+    struct ext2_tar_ent root = {0};
+    struct ext2_tree_ent root_te = {0};
+    _u64 i;
+    _u64 j;
+    _u64 k;
+
+    /* Get the format and the order */
+    memset(&t, 0, sizeof(t));
+    for (k = 0; k < (_u64)nb_args; k++) {
+        if (!strcmp(args[k], "format=ustar") ||
+            !strcmp(args[k], "format=tar")) {
+            t.fmt = TAR_FMT_USTAR;
+        }
+        else if (!strcmp(args[k], "format=newc") ||
+                 !strcmp(args[k], "format=cpio")) {
+            t.fmt = TAR_FMT_NEWC;
+        }
+        else if (!strcmp(args[k], "order=ino")) {
+            t.phys = 0;
+        }
+        else if (!strcmp(args[k], "order=phys")) {
+            t.phys = 1;
+        }
         else {
-            /* Print the next indirect block */
-            _ext2_indir_print(nxt_blk_addr, file_type, indir_level - 1);
+            /* Exit with failure */
+            exit_err("Invalid tar argument %s\n", args[k]);
+        }
+    }
+
+    /* The archive holds a tree */
+    _ext2_ino_to_ino_st(ino, &root.ino_st);
+    if (!EXT2_IS_INODE_DIR(&root.ino_st)) {
+        /* Exit with failure */
+        exit_err("Tar request needs a directory\n");
+    }
+
+    /* Find the entries */
+    ext2_pwalk(ino, _ext2_find_dir_new(NULL, ".", 1), _ext2_tar_visit,
+               _ext2_find_done, &t);
+    t.tes = _ext2_tree_join(t.lists, &t.nb_ents);
+
+    /* Read their inodes and order them */
+    t.ents = malloc((t.nb_ents + 1) * sizeof(*t.ents));
+
+    /* Check for failure */
+    if (!t.ents) {
+        /* Exit with failure */
+        exit_err("Failed to allocate the archive entries\n");
+    }
+    ext2_pfor(t.nb_ents, PFOR_GRAIN, _ext2_tar_ino, &t);
+    _tar_cmp = &t;
+    qsort(t.ents, t.nb_ents, sizeof(*t.ents), _ext2_tar_ent_cmp);
+
+    _ext2_walk_init(&t.w);
+    /* Output the entries, the names of an inode together */
+    for (i = 0; i < t.nb_ents; i = j) {
+        for (j = i + 1; (j < t.nb_ents) &&
+             (t.ents[j].te->ino == t.ents[i].te->ino); j++);
+        for (k = 0; k < j - i; k++) {
+            _ext2_tar_ent(&t, &t.ents[i + k], k ? &t.ents[i] : NULL, j - i,
+                          (i + k + 1) == j);
         }
+    }
+
+    /* Then the directory itself */
+    root_te.ino = ino;
+    root_te.path = ".";
+    root_te.path_len = 1;
+    root.te = &root_te;
+    _ext2_tar_ent(&t, &root, NULL, 1, 1);
+
+    /* Output the end of the archive and pad it to a whole record */
+    if (t.fmt == TAR_FMT_NEWC) {
+        memset(&root.ino_st, 0, sizeof(root.ino_st));
+        _ext2_tar_newc(&t, &root.ino_st, 0, 1, "TRAILER!!!", 10, 0);
+        _ext2_tar_pad(&t, TAR_BLK_SIZE);
+    }
+    else {
+        _ext2_tar_bytes(&t, NULL, 2 * TAR_BLK_SIZE);
+        _ext2_tar_pad(&t, TAR_REC_SIZE);
+    }
+    ext2_out_flush();
+
+    /* Free the archive */
+    _ext2_tree_free(t.lists);
+    _ext2_walk_deinit(&t.w);
+    free(t.tes);
+    free(t.ents);
+}
+
+/**
+ * @brief Builds the reverse path index and writes it to its file
+ * @param[in] ino Inode number of the path, the root directory
+ * @param[in] nb_args Number of request arguments
+ * @param[in] args Request arguments, an optional path of the index file
+ */
+void _ext2_print_rindex(_u64 ino, int nb_args, char **args) {
 
-        /* Update the pointer */
-        i++;
+    struct ext2_rindex ri;
+    char path[MAX_PATH_LEN];
+
+    /* The index covers the whole file system */
+    if (ino != EXT2_ROOT_INO) {
+        /* Exit with failure */
+        exit_err("Rindex request needs the root directory\n");
+    }
+
+    /* Get the path of the index file */
+    if (nb_args > 0) {
+        snprintf(path, sizeof(path), "%s", args[0]);
     }
+    else {
+        _ext2_sidecar_path(path, ".rindex");
+    }
+
+    /* Build and write the index */
+    ext2_rindex_build(&ri);
+    if (ext2_rindex_write(&ri, path)) {
+        /* Exit with failure */
+        exit_err("Failed to write the index to %s\n", path);
+    }
+
+    /* Print the summary */
+    _out_printf("%s: %lu names of %u inodes, %lu bytes\n", path,
+                ri.hdr->nb_names, ri.hdr->nb_inos, ri.len);
+
+    /* Free the index */
+    ext2_rindex_free(&ri);
 }
 
 /**
- * @brief Prints the data blocks of the inode
+ * @brief Prints the inode number along with a path of it
  * @param[in] ino Inode number
+ * @param[in] path Path
+ * @param[in] len Length of the path
  */
-void _ext2_print_ino_data(_u64 ino) {
+static void _ext2_print_ino_path(_u64 ino, const _u8 *path, _u32 len) {
 
-    struct ext2_inode ino_st;
-    _u8 file_type;
-    _u32 blk_addr;
-    _u32 i = 0;
+    /* If a structured format is requested */
+    if (_out.fmt != OUT_FMT_TEXT) {
+        _out_rec_begin();
+        _out_field_u64("ino", ino);
+        _out_field_str("path", path, len);
+        _out_rec_end();
+        return;
+    }
 
-    /* Get the inode structure */
-    _ext2_ino_to_ino_st(ino, &ino_st);
+    _out_u64(ino);
+    _out_chr('\t');
+    _out_bytes(path, len);
+    _out_chr('\n');
+}
 
-    /* If the inode is a regular file */
-    if (EXT2_IS_INODE_REG_FILE(&ino_st)) {
-        /* Set file type to regular file */
-        file_type = EXT2_FT_REG_FILE;
+/**
+ * @brief Parses a whole unsigned decimal number argument
+ * @param[in] arg Argument
+ * @param[in] what Name of the number, for the error message
+ * @return Number
+ */
+static _u64 _ext2_parse_num(const char *arg, const char *what) {
+
+    char *end;
+    _u64 val;
+
+    errno = 0;
+    val = strtoull(arg, &end, 10);
+
+    /* Check for a whole number */
+    if ((end == arg) || *end || errno || (arg[0] == '-')) {
+        /* Exit with failure */
+        exit_err("Invalid %s %s\n", what, arg);
     }
-    /* If the inode is a directory file */
-    else if (EXT2_IS_INODE_DIR(&ino_st)) {
-        /* Set file type to directory */
-        file_type = EXT2_FT_DIR;
+
+    return val;
+}
+
+/**
+ * @brief Prints the paths of the inodes out of the reverse path index
+ * @param[in] nb_args Number of request arguments
+ * @param[in] args Request arguments, an optional @<index file> followed by
+ *                 the inode numbers
+ * @note If the index file is missing or indexes another state of the file
+ *       system, the index is built and written first
+ */
+void _ext2_print_ipath(int nb_args, char **args) {
+
+    struct ext2_rindex ri;
+    char path[MAX_PATH_LEN];
+    _u8 ino_path[MAX_PATH_LEN];
+    _u32 nb_found;
+    _u32 len;
+    _u64 ino;
+    _u64 off;
+    int i = 0;
+    int j;
+
+    /* Get the path of the index file */
+    if ((nb_args > 0) && (args[0][0] == '@')) {
+        snprintf(path, sizeof(path), "%s", args[0] + 1);
+        i++;
     }
-    /* If we encountered any other file type */
     else {
-        /* Exit with error */
-        exit_err("File type not supported\n");
+        _ext2_sidecar_path(path, ".rindex");
     }
 
-    /* While we get valid addresses */
-    while ((i < EXT2_N_BLOCKS) && (blk_addr = ino_st.i_block[i])) {
-        /* If the current block is a direct block */
-        if (i < EXT2_NDIR_BLOCKS) {
-            /* Print the direct data block */
-            _ext2_dir_print(blk_addr, file_type);
+    /* Check the inode numbers before building anything */
+    for (j = i; j < nb_args; j++) {
+        _ext2_parse_num(args[j], "inode number");
+    }
+
+    /* Map the index, build it if it is missing or stale */
+    if (ext2_rindex_map(&ri, path)) {
+        ext2_rindex_build(&ri);
+        if (ext2_rindex_write(&ri, path)) {
+            fprintf(stderr, "Failed to write the index to %s\n", path);
         }
-        /* If the current block is single indirect block */
-        else if (i == EXT2_IND_BLOCK) {
+    }
+
+    /* For each inode number */
+    _out_header("ino\tpath");
+    for (; i < nb_args; i++) {
+        ino = _ext2_parse_num(args[i], "inode number");
+        nb_found = 0;
 
-            _ext2_indir_print(blk_addr, file_type, 1);
+        /* If the inode is the root directory */
+        if (ino == EXT2_ROOT_INO) {
+            _ext2_print_ino_path(ino, "/", 1);
+            nb_found++;
+        }
+        /* If the inode number is valid print the path of every name */
+        else if (ino && (ino <= ri.hdr->nb_inos)) {
+            for (off = ri.offs[ino]; off < ri.offs[ino + 1];
+                 off += 5 + ri.names[off + 4]) {
+                len = _ext2_rindex_path(&ri, ri.names + off, ino_path);
+                if (len) {
+                    _ext2_print_ino_path(ino, ino_path, len);
+                    nb_found++;
+                }
+            }
         }
-        /* If the current block is double indirect block */
-        else if (i == EXT2_DIND_BLOCK) {
 
-            _ext2_indir_print(blk_addr, file_type, 2);
+        /* Report the inodes without a name */
+        if (!nb_found) {
+            fprintf(stderr, "No path for the inode %lu\n", ino);
         }
-        /* If the current block is triple indirect block */
-        else if (i == EXT2_TIND_BLOCK) {
+    }
+
+    /* Free the index */
+    ext2_rindex_free(&ri);
+}
+
+/**
+ * @brief Builds the reverse block map and writes it to its file
+ * @param[in] ino Inode number of the path, the root directory
+ * @param[in] nb_args Number of request arguments
+ * @param[in] args Request arguments, an optional path of the map file
+ */
+void _ext2_print_rbmap(_u64 ino, int nb_args, char **args) {
+
+    struct ext2_rbmap rb;
+    char path[MAX_PATH_LEN];
+    _u64 nb_blks = 0;
+    _u64 i;
+
+    /* The map covers the whole file system */
+    if (ino != EXT2_ROOT_INO) {
+        /* Exit with failure */
+        exit_err("Rbmap request needs the root directory\n");
+    }
+
+    /* Get the path of the map file */
+    if (nb_args > 0) {
+        snprintf(path, sizeof(path), "%s", args[0]);
+    }
+    else {
+        _ext2_sidecar_path(path, ".rbmap");
+    }
+
+    /* Build and write the map */
+    ext2_rbmap_build(&rb);
+    if (ext2_rbmap_write(&rb, path)) {
+        /* Exit with failure */
+        exit_err("Failed to write the map to %s\n", path);
+    }
+
+    /* Print the summary */
+    for (i = 0; i < rb.hdr->nb_exts; i++) {
+        nb_blks += RBMAP_EXT_LEN(&rb.exts[i]);
+    }
+    _out_printf("%s: %lu extents of %lu blocks, %lu bytes\n", path,
+                rb.hdr->nb_exts, nb_blks, rb.len);
+
+    /* Free the map */
+    ext2_rbmap_free(&rb);
+}
+
+/**
+ * @brief Returns if the group holds a copy of the superblock and of the
+ *        group descriptor table
+ * @param[in] grp Group number
+ */
+static _u8 _ext2_grp_has_super(_u32 grp) {
+
+    _u32 base;
+    _u32 pow;
 
-            _ext2_indir_print(blk_addr, file_type, 3);
+    /* Without sparse superblocks every group has a copy */
+    if ((grp <= 1) ||
+        !(_sb.s_feature_ro_compat & EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER)) {
+        return 1;
+    }
+
+    /* Otherwise only the groups 0, 1 and the powers of 3, 5 and 7 */
+    for (base = 3; base <= 7; base += 2) {
+        for (pow = base; pow < grp; pow *= base);
+        if (pow == grp) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Returns the group metadata the block holds
+ * @param[in] blk Physical block number
+ * @return Name of the metadata, "free" or "unowned" if the block holds
+ *         none and is free or in use in the block bitmap
+ */
+static const char *_ext2_blk_meta(_u32 blk) {
+
+    _u64 bs = EXT2_BLOCK_SIZE(&_sb);
+    _u32 first = _sb.s_first_data_block;
+    struct ext2_group_desc *gd;
+    _u32 gdt_blks;
+    _u32 tab_blks;
+    _u32 grp;
+    _u32 idx;
+    _u8 byte;
+
+    /* The blocks before the first group hold the boot sector */
+    if (blk < first) {
+        return "boot";
+    }
+    grp = (blk - first) / EXT2_BLOCKS_PER_GROUP(&_sb);
+    idx = (blk - first) % EXT2_BLOCKS_PER_GROUP(&_sb);
+    gd = _ext2_grp_desc(grp);
+
+    /* If the group has a copy of the superblock and of the table */
+    if (_ext2_grp_has_super(grp)) {
+        gdt_blks = ((_u64)_nb_grps * EXT2_DESC_SIZE(&_sb) + bs - 1) / bs;
+        if (!idx) {
+            return "super";
+        }
+        if (idx <= gdt_blks) {
+            return "gdt";
         }
+        if (idx <= gdt_blks + _sb.s_reserved_gdt_blocks) {
+            return "reserved gdt";
+        }
+    }
 
-        /* Update the block number */
+    /* If the block holds a bitmap or the inode table of the group */
+    tab_blks = ((_u64)EXT2_INODES_PER_GROUP(&_sb) * EXT2_INODE_SIZE(&_sb)
+                + bs - 1) / bs;
+    if (blk == gd->bg_block_bitmap) {
+        return "block bitmap";
+    }
+    if (blk == gd->bg_inode_bitmap) {
+        return "inode bitmap";
+    }
+    if ((blk >= gd->bg_inode_table) && (blk < gd->bg_inode_table + tab_blks)) {
+        return "inode table";
+    }
+
+    /* Otherwise tell whether the block bitmap has it in use */
+    _ext2_read((_u64)gd->bg_block_bitmap * bs + idx / 8, &byte, 1,
+               EXT2_CAT_BMAP);
+
+    return ((byte >> (idx & 7)) & 1) ? "unowned" : "free";
+}
+
+/**
+ * @brief Prints the owner of a block
+ * @param[in] blk Physical block number
+ * @param[in] kind Kind of the block
+ * @param[in] ino Inode number owning the block, zero for group metadata
+ * @param[in] lblk Logical block of the block (first logical block mapped
+ *                 for an indirect block)
+ * @param[in] path Path of the inode, NULL if unknown
+ * @param[in] len Length of the path
+ */
+static void _ext2_print_owner_rec(_u32 blk, const char *kind, _u32 ino,
+                                  _u32 lblk, const _u8 *path, _u32 len) {
+
+    _u32 grp = (blk - _sb.s_first_data_block) / EXT2_BLOCKS_PER_GROUP(&_sb);
+
+    /* If a structured format is requested */
+    if (_out.fmt != OUT_FMT_TEXT) {
+        _out_rec_begin();
+        _out_field_u64("blk", blk);
+        _out_field_str("kind", kind, strlen(kind));
+        _out_field_u64("ino", ino);
+        _out_field_u64("lblk", lblk);
+        _out_field_u64("group", (blk < _sb.s_first_data_block) ? 0 : grp);
+        _out_field_str("path", path ? path : (const _u8 *)"", len);
+        _out_rec_end();
+        return;
+    }
+
+    /* Group metadata goes with its group, inode blocks with their inode */
+    if (!ino) {
+        _out_printf("%u\t%s\tgroup %u\n", blk, kind,
+                    (blk < _sb.s_first_data_block) ? 0 : grp);
+        return;
+    }
+    _out_printf("%u\t%s\t%u\t%u", blk, kind, ino, lblk);
+    if (path) {
+        _out_chr('\t');
+        _out_bytes(path, len);
+    }
+    _out_chr('\n');
+}
+
+/**
+ * @brief Prints the owners of the blocks out of the reverse block map
+ * @param[in] nb_args Number of request arguments
+ * @param[in] args Request arguments, an optional @<map file> followed by
+ *                 the block numbers
+ * @note If the map file is missing or maps another state of the file
+ *       system, the map is built and written first. The paths are taken
+ *       from the reverse path index file if it is up to date.
+ */
+void _ext2_print_owner(int nb_args, char **args) {
+
+    struct ext2_rbmap rb;
+    struct ext2_rindex ri;
+    struct ext2_rbmap_ext *ext;
+    char path[MAX_PATH_LEN];
+    _u8 ino_path[MAX_PATH_LEN];
+    _u8 has_ri;
+    _u8 nb_owners;
+    _u32 len;
+    _u32 lblk;
+    _u64 blk;
+    _u64 first;
+    _u64 nb;
+    _u64 j;
+    int i = 0;
+
+    /* Get the path of the map file */
+    if ((nb_args > 0) && (args[0][0] == '@')) {
+        snprintf(path, sizeof(path), "%s", args[0] + 1);
         i++;
     }
+    else {
+        _ext2_sidecar_path(path, ".rbmap");
+    }
+
+    /* Check the block numbers before building anything */
+    for (j = i; j < nb_args; j++) {
+        _ext2_parse_num(args[j], "block number");
+    }
+
+    /* Map the map, build it if it is missing or stale */
+    if (ext2_rbmap_map(&rb, path)) {
+        ext2_rbmap_build(&rb);
+        if (ext2_rbmap_write(&rb, path)) {
+            fprintf(stderr, "Failed to write the map to %s\n", path);
+        }
+    }
+
+    /* Map the reverse path index if there is one up to date */
+    _ext2_sidecar_path(path, ".rindex");
+    has_ri = !ext2_rindex_map(&ri, path);
+
+    /* For each block number */
+    _out_header("blk\tkind\tino\tlblk\tgroup\tpath");
+    for (; i < nb_args; i++) {
+        blk = _ext2_parse_num(args[i], "block number");
+
+        /* Check that the block is in the file system */
+        if (blk >= _sb.s_blocks_count) {
+            fprintf(stderr, "Block %lu is past the end of the file system\n",
+                    blk);
+            continue;
+        }
+
+        /* Print every inode owning the block */
+        nb_owners = 0;
+        nb = ext2_rbmap_find(&rb, blk, &first);
+        for (j = first; j < first + nb; j++) {
+            ext = &rb.exts[j];
+            if (ext->pblk + RBMAP_EXT_LEN(ext) <= blk) {
+                continue;
+            }
+
+            /* Get a path of the inode */
+            len = has_ri ? _ext2_rindex_ino_path(&ri, ext->ino, ino_path) : 0;
+
+            /* The logical block of a data block is within its extent */
+            lblk = ext->lblk;
+            if (RBMAP_EXT_KIND(ext) == RBMAP_KIND_DATA) {
+                lblk += blk - ext->pblk;
+            }
+            _ext2_print_owner_rec(blk, _rbmap_kind_to_str[RBMAP_EXT_KIND(ext)],
+                                  ext->ino, lblk, len ? ino_path : NULL, len);
+            nb_owners++;
+        }
+
+        /* Otherwise the block holds group metadata or nothing */
+        if (!nb_owners) {
+            _ext2_print_owner_rec(blk, _ext2_blk_meta(blk), 0, 0, NULL, 0);
+        }
+    }
+
+    /* Free the maps */
+    if (has_ri) {
+        ext2_rindex_free(&ri);
+    }
+    ext2_rbmap_free(&rb);
+}
+
+/**
+ * @brief Prints the layout of a file, its counts and block runs
+ * @param[in] ino Inode number
+ */
+static void _ext2_print_layout_file(_u64 ino) {
+
+    _u64 apb = EXT2_ADDR_PER_BLOCK(&_sb);
+    static const char *lvl_to_str[] = {"Data blocks", "Single indirect block",
+                                       "Double indirect block",
+                                       "Triple indirect block"};
+    struct ext2_layout l = {.keep = 1};
+    struct ext2_layout_rec *rec;
+    struct ext2_inode ino_st;
+    _u64 span;
+    _u64 i;
+    _u8 lvl;
+
+    /* Get the layout */
+    _ext2_ino_to_ino_st(ino, &ino_st);
+    ext2_layout(&_walk, &ino_st, &l);
+
+    /* If a structured format is requested */
+    if (_out.fmt != OUT_FMT_TEXT) {
+        /* Print the counts and the runs as one record */
+        _out_header("ino\tsize\tblocks\textents\tindirect\tseeks\tscore"
+                    "\truns");
+        _out_rec_begin();
+        _out_field_u64("ino", ino);
+        _out_field_u64("size", EXT2_I_SIZE(&ino_st));
+        _out_field_u64("blocks", l.nb_blks);
+        _out_field_u64("extents", l.nb_exts);
+        _out_field_u64("indirect", l.nb_ind);
+        _out_field_u64("seeks", l.nb_seeks);
+        _out_key("score");
+        _out_printf("%.2f", _ext2_layout_score(&l));
+
+        /* Print the runs as an array of level, logical block, physical
+         * block and length (a list of colon separated runs in TSV) */
+        _out_key("runs");
+        if (_out.fmt == OUT_FMT_NDJSON) {
+            _out_chr('[');
+        }
+        for (i = 0; i < l.nb_recs; i++) {
+            rec = &l.recs[i];
+            _out_printf((_out.fmt == OUT_FMT_NDJSON) ? "%s[%u,%lu,%u,%u]"
+                                                    : "%s%u:%lu:%u:%u",
+                        i ? "," : "", rec->level, rec->lblk, rec->pblk,
+                        rec->len);
+        }
+        if (_out.fmt == OUT_FMT_NDJSON) {
+            _out_chr(']');
+        }
+        _out_rec_end();
+        free(l.recs);
+        return;
+    }
+
+    /* Print the counts */
+    _out_printf("Inode: %lu Size: %lu\nData blocks: %lu Extents: %lu "
+                "Indirect blocks: %lu\nFragmentation: %.2f%% (%lu seeks over "
+                "%lu blocks)\nLAYOUT:\n", ino, EXT2_I_SIZE(&ino_st),
+                l.nb_blks, l.nb_exts, l.nb_ind, _ext2_layout_score(&l),
+                l.nb_seeks, l.nb_blks + l.nb_ind);
+
+    /* Print the runs with the logical blocks they map */
+    for (i = 0; i < l.nb_recs; i++) {
+        rec = &l.recs[i];
+        for (span = rec->len, lvl = 0; lvl < rec->level; lvl++) {
+            span *= apb;
+        }
+        _out_printf("%s (%lu-%lu): %u", lvl_to_str[rec->level], rec->lblk,
+                    rec->lblk + span - 1, rec->pblk);
+        if (rec->len > 1) {
+            _out_printf("-%u", rec->pblk + rec->len - 1);
+        }
+        _out_chr('\n');
+    }
+    free(l.recs);
+}
+
+/* Layouts of a parallel scan */
+struct ext2_layout_all {
+    /* Layouts of the inodes of the chunk */
+    struct ext2_layout *ls;
+    struct ext2_walk ws[MAX_THREADS];
+    /* Reverse path index, if there is one up to date */
+    struct ext2_rindex ri;
+    _u8 has_ri;
+    /* Totals over the files */
+    struct ext2_layout tot;
+    _u64 nb_files;
+    _u64 nb_frag;
+};
+
+/**
+ * @brief Parallel scan body getting the layout of the inode
+ */
+static void _ext2_layout_all_ino(void *ctx, _u32 tid, _u64 idx, _u32 ino,
+                                 struct ext2_inode *ino_st) {
+
+    struct ext2_layout_all *la = ctx;
+
+    ext2_layout(&la->ws[tid], ino_st, &la->ls[idx]);
+}
+
+/**
+ * @brief Parallel scan chunk visitor printing the layouts of the chunk in
+ *        the inode number order
+ */
+static void _ext2_layout_all_done(void *ctx, _u32 *inos, _u64 nb) {
+
+    struct ext2_layout_all *la = ctx;
+    struct ext2_layout *l;
+    _u8 path[MAX_PATH_LEN];
+    _u32 len;
+    _u64 i;
+
+    /* For each inode with blocks */
+    for (i = 0; i < nb; i++) {
+        l = &la->ls[i];
+        if (!l->nb_blks && !l->nb_ind) {
+            continue;
+        }
+
+        /* Add it to the totals */
+        la->tot.nb_blks += l->nb_blks;
+        la->tot.nb_exts += l->nb_exts;
+        la->tot.nb_ind += l->nb_ind;
+        la->tot.nb_seeks += l->nb_seeks;
+        la->nb_files++;
+        la->nb_frag += (l->nb_exts > 1);
+
+        /* Get a path of the inode */
+        len = la->has_ri ? _ext2_rindex_ino_path(&la->ri, inos[i], path) : 0;
+
+        /* If a structured format is requested */
+        if (_out.fmt != OUT_FMT_TEXT) {
+            _out_rec_begin();
+            _out_field_u64("ino", inos[i]);
+            _out_field_u64("blocks", l->nb_blks);
+            _out_field_u64("extents", l->nb_exts);
+            _out_field_u64("indirect", l->nb_ind);
+            _out_field_u64("seeks", l->nb_seeks);
+            _out_key("score");
+            _out_printf("%.2f", _ext2_layout_score(l));
+            _out_field_str("path", path, len);
+            _out_rec_end();
+            continue;
+        }
+
+        _out_printf("%u\t%lu\t%lu\t%lu\t%.2f", inos[i], l->nb_blks,
+                    l->nb_exts, l->nb_ind, _ext2_layout_score(l));
+        if (len) {
+            _out_chr('\t');
+            _out_bytes(path, len);
+        }
+        _out_chr('\n');
+    }
+}
+
+/**
+ * @brief Prints the layout counts of every inode in use with blocks
+ * @note The layouts are computed by a parallel scan and printed in the
+ *       inode number order, the paths are added when an up to date
+ *       reverse path index file exists
+ */
+static void _ext2_print_layout_all() {
+
+    struct ext2_layout_all la = {0};
+    char path[MAX_PATH_LEN];
+    _u64 nb_reads;
+    _u32 i;
+
+    /* Allocate the layouts of a chunk */
+    la.ls = calloc(PSCAN_CHUNK_INOS, sizeof(*la.ls));
+
+    /* Check for failure */
+    if (!la.ls) {
+        /* Exit with failure */
+        exit_err("Failed to allocate the layouts\n");
+    }
+
+    /* Map the reverse path index if there is one up to date */
+    _ext2_sidecar_path(path, ".rindex");
+    la.has_ri = !ext2_rindex_map(&la.ri, path);
+
+    /* Print the layouts */
+    _out_header("ino\tblocks\textents\tindirect\tseeks\tscore\tpath");
+    ext2_pscan(0, _ext2_layout_all_ino, _ext2_layout_all_done, &la);
+
+    /* Print the totals */
+    if (_out.fmt == OUT_FMT_TEXT) {
+        nb_reads = la.tot.nb_blks + la.tot.nb_ind;
+        _out_printf("%lu files, %lu data blocks in %lu extents, %lu indirect "
+                    "blocks, %lu fragmented files, %.2f%% seeks\n",
+                    la.nb_files, la.tot.nb_blks, la.tot.nb_exts,
+                    la.tot.nb_ind, la.nb_frag, (nb_reads > la.nb_files)
+                    ? 100.0 * la.tot.nb_seeks / (nb_reads - la.nb_files)
+                    : 0.0);
+    }
+
+    /* Free the layouts */
+    for (i = 0; i < _nb_threads; i++) {
+        _ext2_walk_deinit(&la.ws[i]);
+    }
+    if (la.has_ri) {
+        ext2_rindex_free(&la.ri);
+    }
+    free(la.ls);
+}
+
+/**
+ * @brief Prints the layout of the file, or of every file
+ * @param[in] ino Inode number
+ * @param[in] nb_args Number of request arguments
+ * @param[in] args Request arguments, "all" for every file
+ */
+void _ext2_print_layout(_u64 ino, int nb_args, char **args) {
+
+    /* If the layout of one file is asked for */
+    if ((nb_args < 1) || strcmp(args[0], "all")) {
+        _ext2_print_layout_file(ino);
+        return;
+    }
+
+    /* The layouts of every file cover the whole file system */
+    if (ino != EXT2_ROOT_INO) {
+        /* Exit with failure */
+        exit_err("Layout of every file needs the root directory\n");
+    }
+    _ext2_print_layout_all();
 }
 
 /**
@@ -636,8 +8428,10 @@ void _ext2_print_ino_data(_u64 ino) {
  *        request made
  * @param[in] ino Inode number
  * @param[in] req Request type
+ * @param[in] nb_args Number of request arguments
+ * @param[in] args Request arguments
  */
-void ext2_print_ino(_u64 ino, _u8 req) {
+void ext2_print_ino(_u64 ino, _u8 req, int nb_args, char **args) {
 
     /* If the request is to print inode struct */
     if (req == REQUEST_TYPE_INODE) {
@@ -649,6 +8443,80 @@ void ext2_print_ino(_u64 ino, _u8 req) {
         /* Print the inode data */
         _ext2_print_ino_data(ino);
     }
+    /* If the request is to list the directory */
+    else if (req == REQUEST_TYPE_LIST) {
+        /* Print the directory listing */
+        _ext2_print_dir_list(ino, nb_args, args);
+    }
+    /* If the request is to explain the path resolution */
+    else if (req == REQUEST_TYPE_EXPLAIN) {
+        /* Printed by the path resolution */
+    }
+    /* If the request is to scan the inode tables */
+    else if (req == REQUEST_TYPE_SCAN) {
+        /* Print the inodes in use */
+        _ext2_print_scan(ino);
+    }
+    /* If the request is to filter the inodes */
+    else if (req == REQUEST_TYPE_FILTER) {
+        /* Print the inodes matching */
+        _ext2_print_filter(ino, nb_args, args);
+    }
+    /* If the request is to query the inode metadata */
+    else if (req == REQUEST_TYPE_QUERY) {
+        /* Print the inodes matching with their paths */
+        _ext2_print_query(ino, nb_args, args);
+    }
+    /* If the request is to build the reverse path index */
+    else if (req == REQUEST_TYPE_RINDEX) {
+        /* Write the index */
+        _ext2_print_rindex(ino, nb_args, args);
+    }
+    /* If the request is to get the paths of inode numbers */
+    else if (req == REQUEST_TYPE_IPATH) {
+        /* Print the paths out of the index */
+        _ext2_print_ipath(nb_args, args);
+    }
+    /* If the request is to build the reverse block map */
+    else if (req == REQUEST_TYPE_RBMAP) {
+        /* Write the map */
+        _ext2_print_rbmap(ino, nb_args, args);
+    }
+    /* If the request is to get the owners of block numbers */
+    else if (req == REQUEST_TYPE_OWNER) {
+        /* Print the owners out of the map */
+        _ext2_print_owner(nb_args, args);
+    }
+    /* If the request is to print the layout */
+    else if (req == REQUEST_TYPE_LAYOUT) {
+        /* Print the layout of the file or of every file */
+        _ext2_print_layout(ino, nb_args, args);
+    }
+    /* If the request is to print the disk usage */
+    else if (req == REQUEST_TYPE_DU) {
+        /* Print the usage of every directory under the path */
+        _ext2_print_du(ino, nb_args, args);
+    }
+    /* If the request is to find entries by name */
+    else if (req == REQUEST_TYPE_FIND) {
+        /* Print the paths of the entries matching */
+        _ext2_print_find(ino, nb_args, args);
+    }
+    /* If the request is to search the file contents */
+    else if (req == REQUEST_TYPE_GREP) {
+        /* Print the offsets of the patterns */
+        _ext2_print_grep(ino, nb_args, args);
+    }
+    /* If the request is to extract the tree */
+    else if (req == REQUEST_TYPE_EXTRACT) {
+        /* Recreate the tree on the host */
+        _ext2_print_extract(ino, nb_args, args);
+    }
+    /* If the request is to archive the tree */
+    else if (req == REQUEST_TYPE_TAR) {
+        /* Stream the archive to the standard output */
+        _ext2_print_tar(ino, nb_args, args);
+    }
     /* If invalid request is passed  */
     else {
         /* Exit with failure */
@@ -656,35 +8524,156 @@ void ext2_print_ino(_u64 ino, _u8 req) {
     }
 }
 
+#ifndef EXT2_NO_MAIN
 /**
  * @brief Main routine
  */
 int main(int argc, char *argv[]) {
 
+    static const struct option opts[] = {
+        {"stats", optional_argument, NULL, 's'},
+        {"hist", optional_argument, NULL, 'h'},
+        {"device", required_argument, NULL, 'd'},
+        {"cold", no_argument, NULL, 'c'},
+        {"direct", no_argument, NULL, 'D'},
+        {"trace", required_argument, NULL, 't'},
+        {"cache-blocks", required_argument, NULL, 'b'},
+        {"format", required_argument, NULL, 'f'},
+        {"threads", required_argument, NULL, 'j'},
+        {NULL, 0, NULL, 0}
+    };
+    struct ext2_explain ex = {0};
     _u64 ino;
     _u8 req;
+    _u8 stats = 0;
+    _u8 stats_json = 0;
+    _u8 hist_json = 0;
+    _u8 *dev_path = DEVICE_FILE_PATH;
+    _u8 cold = 0;
+    _u8 *trace_path = NULL;
+    _u8 nb_threads_set = 0;
+    _u64 t;
+    int opt;
+
+    /* Parse the options preceding the path */
+    while ((opt = getopt_long(argc, argv, "+", opts, NULL)) != -1) {
+        /* If the statistics are requested */
+        if (opt == 's') {
+            stats = 1;
+            stats_json = optarg && !strcmp(optarg, "json");
+        }
+        /* If the histograms are requested */
+        else if (opt == 'h') {
+            _hist_on = 1;
+            hist_json = optarg && !strcmp(optarg, "json");
+            signal(SIGUSR1, _hist_sig_handler);
+        }
+        /* If the device is given */
+        else if (opt == 'd') {
+            dev_path = optarg;
+        }
+        /* If the page cache is to be dropped first */
+        else if (opt == 'c') {
+            cold = 1;
+        }
+        /* If the page cache is to be bypassed */
+        else if (opt == 'D') {
+            _io_direct = 1;
+        }
+        /* If the run is to be traced */
+        else if (opt == 't') {
+            trace_path = optarg;
+        }
+        /* If the block cache size is given */
+        else if ((opt == 'b') && (_bcache_nb_blks = atoi(optarg)) > 0) {
+            continue;
+        }
+        /* If the output format is given */
+        else if (opt == 'f') {
+            _out.fmt = _get_out_fmt(optarg);
+        }
+        /* If the number of worker threads is given */
+        else if ((opt == 'j') && (atoi(optarg) > 0)) {
+            _nb_threads = atoi(optarg);
+            nb_threads_set = 1;
+        }
+        /* If an unknown option is passed */
+        else {
+            /* Exit with failure */
+            exit_err("Invalid option\n");
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    /* Flush the buffered output on every exit */
+    atexit(ext2_out_flush);
+
+    /* Use a worker thread per processor unless told otherwise */
+    if (!nb_threads_set) {
+        _nb_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (_nb_threads > MAX_THREADS) {
+        _nb_threads = MAX_THREADS;
+    }
 
     /* Validate the number of command line arguments */
-    if (argc != 3) {
+    if (argc < 3) {
         /* Exit with failure */
         exit_err("Invalid number of arguments\n");
     }
 
-    /* Init the global vars */
-    ext2_init();
+    /* Start tracing the request */
+    if (trace_path) {
+        ext2_trace_start(trace_path, argc - 1, argv + 1);
+    }
 
-    /* Get the inode number of the file */
-    ino = ext2_path_to_ino(argv[1]);
+    /* Drop the cached pages of the device so that the run hits the device */
+    if (cold) {
+        ext2_drop_page_cache(dev_path);
+    }
+
+    /* Init the global vars */
+    t = _ext2_now_ns();
+    ext2_init(dev_path);
+    _stats.phase_ns[EXT2_PHASE_INIT] = _ext2_now_ns() - t;
 
     /* Get the requested action */
     req = _get_req_type(argv[2]);
 
+    /* If the request is to explain record the path resolution */
+    if (req == REQUEST_TYPE_EXPLAIN) {
+        _explain = &ex;
+    }
+
+    /* Get the inode number of the file */
+    t = _ext2_now_ns();
+    ino = ext2_path_to_ino(argv[1]);
+    _stats.phase_ns[EXT2_PHASE_PATH] = _ext2_now_ns() - t;
+
     /* Perform the action */
-    ext2_print_ino(ino, req);
+    t = _ext2_now_ns();
+    ext2_print_ino(ino, req, argc - 3, argv + 3);
+    ext2_out_flush();
+    _stats.phase_ns[EXT2_PHASE_OUT] = _ext2_now_ns() - t;
 
     /* Deinitialize the global vars */
     ext2_deinit();
 
+    /* Mark the traced request as successful */
+    ext2_trace_done();
+
+    /* Print the statistics if requested */
+    if (stats) {
+        _ext2_stats_print(stats_json);
+    }
+
+    /* Print the histograms if requested */
+    if (_hist_on) {
+        _hist_print(hist_json);
+    }
+
     /* Exit with success */
     exit(EXIT_SUCCESS);
 }
+#endif
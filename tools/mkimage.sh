@@ -0,0 +1,156 @@
+#!/bin/sh
+#
+# @file mkimage.sh
+# @brief Builds reproducible ext2 images of a given shape for benchmarking.
+#        The tree is staged in a temporary directory and written into the
+#        image with mke2fs -d, so no root or loop device is needed.
+#
+
+set -e
+
+usage() {
+    cat >&2 <<EOF
+usage: $0 [-b block_size] [-n count] [-d depth] [-S size_mb] <shape> <image>
+
+Shapes:
+  flat    one directory /flat holding <count> empty files (default 10000)
+  deep    a chain of <depth> nested directories /deep/d1/.../d<depth>
+          (default 64) with a file f at every level
+  tind    sparse files /tind/{direct,single,double,triple} whose last block
+          is mapped by the direct, single, double and triple indirect block
+  sparse  files /sparse/{holes,dense} written in every other block, the
+          holes file leaves whole indirect blocks unmapped
+  mixed   all of the above with <count> files in /flat
+
+Options:
+  -b  block size, 1024, 2048 or 4096 (default 4096)
+  -n  number of files of the flat shape
+  -d  depth of the deep shape
+  -S  image size in MiB (default computed from the staged tree)
+EOF
+    exit 1
+}
+
+BS=4096
+COUNT=10000
+DEPTH=64
+SIZE_MB=
+
+while getopts "b:n:d:S:" opt; do
+    case $opt in
+        b) BS=$OPTARG ;;
+        n) COUNT=$OPTARG ;;
+        d) DEPTH=$OPTARG ;;
+        S) SIZE_MB=$OPTARG ;;
+        *) usage ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+[ $# -eq 2 ] || usage
+SHAPE=$1
+IMAGE=$2
+
+case $BS in
+    1024|2048|4096) ;;
+    *) echo "Invalid block size $BS" >&2; exit 1 ;;
+esac
+
+# Fixed time and identifiers so the same arguments give the same image
+EPOCH=1700000000
+UUID=6c0f3c4a-0000-4000-8000-000000000000
+export E2FSPROGS_FAKE_TIME=$EPOCH
+
+STAGE=$(mktemp -d)
+trap 'rm -rf "$STAGE"' EXIT
+
+# Addresses per block, used to place blocks at each indirection level
+APB=$((BS / 4))
+
+# Writes the 8 byte marker of block <lblk> into <file>
+put_blk() {
+    printf '%08d' "$2" | dd of="$1" bs=8 seek=$(($2 * BS / 8)) \
+        conv=notrunc status=none
+}
+
+mk_flat() {
+    mkdir -p "$STAGE/flat"
+    (cd "$STAGE/flat" && seq -f "file_%08g" 1 "$COUNT" | xargs touch)
+}
+
+mk_deep() {
+    dir="$STAGE/deep"
+    mkdir -p "$dir"
+    i=1
+    while [ $i -le "$DEPTH" ]; do
+        dir="$dir/d$i"
+        mkdir "$dir"
+        echo "level $i" > "$dir/f"
+        i=$((i + 1))
+    done
+}
+
+mk_tind() {
+    mkdir -p "$STAGE/tind"
+    put_blk "$STAGE/tind/direct" 11
+    put_blk "$STAGE/tind/single" $((12 + APB - 1))
+    put_blk "$STAGE/tind/double" $((12 + APB + APB * APB - 1))
+    put_blk "$STAGE/tind/triple" $((12 + APB + APB * APB + 1))
+}
+
+mk_sparse() {
+    mkdir -p "$STAGE/sparse"
+    # A block in every level, leaving most of the indirect blocks unmapped
+    for lblk in 0 5 12 $((12 + APB / 2)) $((12 + APB)) \
+                $((12 + APB + APB * 3)) $((12 + APB + APB * APB + 7)); do
+        put_blk "$STAGE/sparse/holes" $lblk
+    done
+    # Every other block of the first few indirect blocks
+    lblk=0
+    while [ $lblk -lt $((12 + 3 * APB)) ]; do
+        put_blk "$STAGE/sparse/dense" $lblk
+        lblk=$((lblk + 2))
+    done
+}
+
+case $SHAPE in
+    flat) mk_flat ;;
+    deep) mk_deep ;;
+    tind) mk_tind ;;
+    sparse) mk_sparse ;;
+    mixed) mk_flat; mk_deep; mk_tind; mk_sparse ;;
+    *) usage ;;
+esac
+
+# Fixed timestamps for every staged file
+find "$STAGE" -exec touch -h -d "@$EPOCH" {} +
+
+# Size the image on the allocated bytes plus room for the metadata
+NB_INODES=$(find "$STAGE" | wc -l)
+if [ -z "$SIZE_MB" ]; then
+    USED_KB=$(du -sk "$STAGE" | cut -f1)
+    SIZE_MB=$(( (USED_KB * 2 + NB_INODES * 2 + NB_INODES * BS / 1024) / 1024 + 16 ))
+fi
+
+rm -f "$IMAGE"
+truncate -s "${SIZE_MB}M" "$IMAGE"
+mke2fs -q -F -t ext2 -b "$BS" -N $((NB_INODES + 1024)) -U "$UUID" \
+    -E "hash_seed=$UUID" -d "$STAGE" "$IMAGE"
+
+# mke2fs copies the access and change times of the staged files, which
+# cannot be fixed before, so pin them in the image. The command file
+# lives in the stage so the exit trap removes it on failure too
+CMDS="$STAGE/debugfs.cmds"
+(cd "$STAGE" && find . -mindepth 1 ! -path ./debugfs.cmds | sed 's#^\.##') |
+while read -r path; do
+    echo "sif \"$path\" atime $EPOCH"
+    echo "sif \"$path\" ctime $EPOCH"
+done > "$CMDS"
+for path in / /lost+found; do
+    for field in atime ctime mtime; do
+        echo "sif \"$path\" $field $EPOCH" >> "$CMDS"
+    done
+done
+debugfs -w -f "$CMDS" "$IMAGE" > /dev/null 2>&1
+
+echo "$IMAGE: $SHAPE, block size $BS, $NB_INODES files, ${SIZE_MB} MiB"
@@ -0,0 +1,40 @@
+#!/bin/sh
+#
+# @file pgo-train.sh
+# @brief Runs the training workload of the profile guided build: path
+#        lookups in a huge directory and a deep chain, listings, and data
+#        streams through every indirection level of a mixed image.
+#
+
+set -e
+
+[ $# -eq 2 ] || { echo "usage: $0 <binary> <mixed image>" >&2; exit 1; }
+BIN=$1
+IMAGE=$2
+
+run() {
+    "$BIN" --device "$IMAGE" "$@" > /dev/null
+}
+
+# Lookups in the flat directory, hits at the start, middle and end
+for name in file_00000001 file_00005000 file_00010000 file_00020000; do
+    run "/flat/$name" inode 2> /dev/null || true
+done
+run /flat list
+run /flat list 0:0 500
+
+# Lookups down the deep chain
+path=/deep
+i=1
+while [ $i -le 64 ]; do
+    path="$path/d$i"
+    run "$path/f" inode 2> /dev/null || break
+    i=$((i + 1))
+done
+run "$path" explain 2> /dev/null || true
+
+# Data streams through the direct, indirect and hole paths of the walker
+for file in /tind/direct /tind/single /tind/double /tind/triple \
+            /sparse/holes /sparse/dense; do
+    run "$file" data
+done